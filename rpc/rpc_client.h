@@ -50,13 +50,17 @@ public:
                     google::protobuf::RpcController*,
                     const Request*, Response*, Callback*),
                     const Request* request, Response* response,
-                    int32_t rpc_timeout, int retry_times) {
+                    int32_t rpc_timeout, int retry_times,
+                    int* error_code = NULL) {
         //  controller ڿƱεã趨ʱʱ䣨ҲԲãȱʡΪ10s
         sofa::pbrpc::RpcController controller;
         controller.SetTimeout(rpc_timeout * 1000L);
         for (int32_t retry = 0; retry < retry_times; ++retry) {
             (stub->*func)(&controller, request, response, NULL);
             if (controller.Failed()) {
+                if (error_code) {
+                    *error_code = controller.ErrorCode();
+                }
                 if (retry < retry_times - 1) {
                     LOG(WARNING, "Send failed, retry ...\n");
                     usleep(1000000);
@@ -70,6 +74,14 @@ public:
         }
         return false;
     }
+    // the request never reached the service, sending it again is safe
+    // even when it is not idempotent
+    static bool NeverDelivered(int error_code) {
+        return error_code == sofa::pbrpc::RPC_ERROR_SERVER_UNREACHABLE
+               || error_code == sofa::pbrpc::RPC_ERROR_RESOLVE_ADDRESS
+               || error_code == sofa::pbrpc::RPC_ERROR_SEND_BUFFER_FULL
+               || error_code == sofa::pbrpc::RPC_ERROR_SERVER_SHUTDOWN;
+    }
     template <class Stub, class Request, class Response, class Callback>
     void AsyncRequest(Stub* stub, void(Stub::*func)(
                     google::protobuf::RpcController*,
@@ -1,14 +1,18 @@
 #!/bin/bash
 while true
 do
-	read -e -p "galaxy ins> " cmd arg1 arg2
+	read -e -p "galaxy ins> " cmd arg1 arg2 arg3
 	case $cmd in
 	"show")
 		sh ./show_cluster.sh
 	;;
 
+	"stat")
+		sh ./show_stat.sh
+	;;
+
 	"put")
-		sh ./test_put.sh $arg1 $arg2
+		sh ./test_put.sh $arg1 $arg2 $arg3
 	;;
 
 	"get")
@@ -26,11 +30,23 @@ do
 		sh ./test_scan.sh $arg1 $arg2
 	;;
 	"ls")
-		sh ./test_scan.sh $arg1 $arg1"~"
+		sh ./test_ls.sh $arg1
+	;;
+	"count")
+		sh ./test_count.sh $arg1
+	;;
+	"rmr")
+		sh ./test_rmr.sh $arg1
+	;;
+	"incr")
+		sh ./test_incr.sh $arg1 $arg2
 	;;
 	"watch")
 		sh ./test_watch.sh $arg1 &
 	;;
+	"watchp")
+		sh ./test_watchp.sh $arg1 &
+	;;
 	"lock")
 		sh ./test_lock.sh $arg1
 	;;
@@ -40,11 +56,17 @@ do
 
 	*)
 		echo "  show [ show cluster ]"
-		echo "  put (key) (value) [ update the data ] "
+		echo "  stat [ show read cache statistics ]"
+		echo "  put (key) (value) [ttl_ms] [ update the data, expire after ttl_ms ] "
 	        echo "  get (key) [read the data by key ]"	
 		echo "  delete (key) [remove the data by key]"
 		echo "  scan (start-key) (end-key) [scan from start-key to end-key(excluded)]"
+		echo "  ls (key) [list the direct children of key]"
+		echo "  count (prefix) [count the keys starting with prefix]"
+		echo "  rmr (prefix) [remove every key starting with prefix]"
+		echo "  incr (key) [delta] [add delta(default 1) to a counter]"
 		echo "  watch (key) [event will be triggered once value changed or deleted]"
+		echo "  watchp (prefix) [event will be triggered once any key under prefix changed]"
 		echo "  lock (key) [lock on specific key]"
 		echo "  enter quit to exit shell"
 	;;
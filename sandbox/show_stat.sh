@@ -0,0 +1,2 @@
+#!/bin/bash
+../output/bin/ins_cli --ins_cmd=stat --flagfile=ins.flag
@@ -0,0 +1,2 @@
+#!/bin/bash
+../output/bin/ins_cli --ins_cmd=count --flagfile=ins.flag --ins_prefix=$1
@@ -0,0 +1,2 @@
+#!/bin/bash
+../output/bin/ins_cli --ins_cmd=incr --flagfile=ins.flag --ins_key=$1 --ins_delta=${2:-1}
@@ -0,0 +1,2 @@
+#!/bin/bash
+../output/bin/ins_cli --ins_cmd=ls --flagfile=ins.flag --ins_key=$1 --ins_keys_only=true
@@ -1,3 +1,3 @@
 #!/bin/bash
-../output/bin/ins_cli --ins_cmd=put --flagfile=ins.flag --ins_key=$1 --ins_value=$2
+../output/bin/ins_cli --ins_cmd=put --flagfile=ins.flag --ins_key=$1 --ins_value=$2 --ins_ttl_ms=${3:-0}
 
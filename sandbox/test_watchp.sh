@@ -0,0 +1,2 @@
+#!/bin/bash
+../output/bin/ins_cli --ins_cmd=watch --flagfile=ins.flag --ins_prefix=$1
@@ -14,10 +14,20 @@
 DECLARE_string(ins_cmd);
 DECLARE_string(ins_key);
 DECLARE_string(ins_value);
+DECLARE_string(ins_old_value);
+DECLARE_int64(ins_delta);
+DECLARE_int64(ins_ttl_ms);
 DECLARE_string(ins_start_key);
 DECLARE_string(ins_end_key);
+DECLARE_string(ins_prefix);
+DECLARE_bool(ins_keys_only);
+DECLARE_bool(ins_skip_locks);
+DECLARE_int64(ins_scan_max_bytes);
 DECLARE_string(ins_rm_binlog_server_id);
 DECLARE_int64(ins_rm_binlog_index);
+DECLARE_string(ins_backup_file);
+DECLARE_bool(ins_as_of);
+DECLARE_int64(ins_as_of_index);
 
 using namespace galaxy::ins::sdk;
 
@@ -25,6 +35,8 @@ void my_watch_callback(const WatchParam& param, SDKError error) {
     printf("key: %s\n", param.key.c_str());
     printf("value: %s\n", param.value.c_str());
     printf("deleted: %s\n", param.deleted ?"true":"false");
+    printf("revision: create %ld, mod %ld\n",
+           param.create_revision, param.mod_revision);
     printf("error code: %d\n", static_cast<int>(error));
     bool* done = reinterpret_cast<bool*>(param.context);
     if (done) {
@@ -80,17 +92,95 @@ int main(int argc, char* argv[]) {
                       << std::endl;
         }
     }
+    if (FLAGS_ins_cmd == "stat") {
+        std::vector<ClusterNodeInfo> cluster_info;
+        sdk.ShowCluster(&cluster_info);
+        std::vector<ClusterNodeInfo>::iterator it;
+        char stat_header[1024] = {'\0'};
+        snprintf(stat_header, sizeof(stat_header),
+                 "%-*s\t%-*s\t%-*s\t%-*s\t%-*s\t%-*s\t%-*s\t%-*s\t%-*s\t%-*s",
+                 35, "server node",
+                 15, "cache_hits",
+                 15, "cache_misses",
+                 15, "hit_rate",
+                 15, "cache_memory",
+                 15, "notified",
+                 15, "notify_p50_us",
+                 15, "notify_p99_us",
+                 15, "notify_p999_us",
+                 15, "notify_max_us");
+        std::cout << stat_header << std::endl;
+        for(it = cluster_info.begin(); it != cluster_info.end(); it++ ) {
+            int64_t total = it->cache_hits + it->cache_misses;
+            double hit_rate = total > 0 ? 100.0 * it->cache_hits / total : 0;
+            char raw_info[1024] = {'\0'};
+            snprintf(raw_info, sizeof(raw_info),
+                     "%-*s\t%-*ld\t%-*ld\t%-*.2f%%\t%-*ld"
+                     "\t%-*ld\t%-*ld\t%-*ld\t%-*ld\t%-*ld",
+                     35, it->server_id.c_str(),
+                     15, it->cache_hits,
+                     15, it->cache_misses,
+                     14, hit_rate,
+                     15, it->cache_memory,
+                     15, it->notify_count,
+                     15, it->notify_p50_us,
+                     15, it->notify_p99_us,
+                     15, it->notify_p999_us,
+                     15, it->notify_max_us);
+            std::cout << raw_info << std::endl;
+        }
+    }
     if (FLAGS_ins_cmd == "put") {
         std::string key = FLAGS_ins_key;
         std::string value = FLAGS_ins_value;
         LOG(DEBUG, "key: %s, value: %s", key.c_str(), value.c_str());
-        if (sdk.Put(key, value, &ins_err)) {
+        if (sdk.Put(key, value, FLAGS_ins_ttl_ms, &ins_err)) {
             LOG(DEBUG, "put success");
         } else {
             LOG(FATAL, "put failed");
         }
     }
 
+    if (FLAGS_ins_cmd == "cas") {
+        std::string key = FLAGS_ins_key;
+        LOG(DEBUG, "key: %s, old value: %s, value: %s", key.c_str(),
+            FLAGS_ins_old_value.c_str(), FLAGS_ins_value.c_str());
+        if (sdk.CompareAndSwap(key, FLAGS_ins_old_value, FLAGS_ins_value,
+                               &ins_err)) {
+            LOG(DEBUG, "cas success");
+        } else if (ins_err == kCompareFail) {
+            fprintf(stderr, "value of %s is not %s\n", key.c_str(),
+                    FLAGS_ins_old_value.c_str());
+        } else {
+            LOG(FATAL, "cas failed");
+        }
+    }
+
+    if (FLAGS_ins_cmd == "rmr") {
+        int64_t deleted_count = 0;
+        bool ok = FLAGS_ins_prefix.empty()
+                  ? sdk.DeleteRange(FLAGS_ins_start_key, FLAGS_ins_end_key,
+                                    &deleted_count, &ins_err)
+                  : sdk.DeletePrefix(FLAGS_ins_prefix, &deleted_count, &ins_err);
+        if (ok) {
+            printf("deleted %ld keys\n", deleted_count);
+        } else {
+            LOG(FATAL, "delete range failed");
+        }
+    }
+
+    if (FLAGS_ins_cmd == "incr") {
+        std::string key = FLAGS_ins_key;
+        int64_t value = 0;
+        if (sdk.Increment(key, FLAGS_ins_delta, &value, &ins_err)) {
+            printf("value: %ld\n", value);
+        } else if (ins_err == kNotANumber) {
+            fprintf(stderr, "value of %s is not a number\n", key.c_str());
+        } else {
+            LOG(FATAL, "incr failed");
+        }
+    }
+
     if (FLAGS_ins_cmd == "delete") {
         std::string key = FLAGS_ins_key;
         LOG(DEBUG, "key: %s", key.c_str());
@@ -105,13 +195,29 @@ int main(int argc, char* argv[]) {
         std::string key = FLAGS_ins_key;
         std::string value;
         LOG(DEBUG, "key: %s", key.c_str());
-        if (sdk.Get(key, &value, &ins_err)) {
+        int64_t as_of_index = FLAGS_ins_as_of_index;
+        int64_t create_revision = -1;
+        int64_t mod_revision = -1;
+        bool ok = FLAGS_ins_as_of
+                  ? sdk.GetAsOf(key, &as_of_index, &value, &ins_err)
+                  : sdk.Get(key, &value, &create_revision, &mod_revision,
+                            &ins_err);
+        if (ok) {
+            if (FLAGS_ins_as_of) {
+                printf("as of [%ld]\n", as_of_index);
+            }
             LOG(DEBUG, "get success");
             if (ins_err == kOK) {
                 printf("value: %s\n", value.c_str());
+                if (!FLAGS_ins_as_of) {
+                    printf("revision: create %ld, mod %ld\n",
+                           create_revision, mod_revision);
+                }
             } else {
                 printf("NOT FOUND\n");
             }
+        } else if (ins_err == kHistoryUnavailable) {
+            fprintf(stderr, "no history at [%ld]\n", as_of_index);
         } else {
             LOG(FATAL, "get failed");
         }
@@ -121,21 +227,86 @@ int main(int argc, char* argv[]) {
         std::string start_key = FLAGS_ins_start_key;
         std::string end_key = FLAGS_ins_end_key;
         LOG(INFO, "scan: [%s, %s)", start_key.c_str(), end_key.c_str());
-        ScanResult* result = sdk.Scan(start_key, end_key);
+        ScanOptions options;
+        options.prefix = FLAGS_ins_prefix;
+        options.keys_only = FLAGS_ins_keys_only;
+        options.skip_locks = FLAGS_ins_skip_locks;
+        options.max_bytes = FLAGS_ins_scan_max_bytes;
+        options.as_of = FLAGS_ins_as_of;
+        options.as_of_index = FLAGS_ins_as_of_index;
+        ScanResult* result = sdk.Scan(start_key, end_key, options);
         int i = 0;
         while (!result->Done()) {
-            printf("[%d]\t%s -> %s\n", ++i,
-                   result->Key().c_str(), result->Value().c_str());
+            if (FLAGS_ins_keys_only) {
+                printf("[%d]\t%s\n", ++i, result->Key().c_str());
+            } else {
+                printf("[%d]\t%s -> %s\n", ++i,
+                       result->Key().c_str(), result->Value().c_str());
+            }
             result->Next();
         }
+        if (result->Error() == kHistoryUnavailable) {
+            fprintf(stderr, "no history at [%ld]\n", FLAGS_ins_as_of_index);
+        }
         delete result;
     }
 
+    if (FLAGS_ins_cmd == "ls") {
+        SDKError error;
+        std::vector<KVPair> children;
+        if (!sdk.ListChildren(FLAGS_ins_key, !FLAGS_ins_keys_only,
+                              &children, &error)) {
+            fprintf(stderr, "rpc error: %d", static_cast<int>(error));
+            return 1;
+        }
+        for (size_t i = 0; i < children.size(); i++) {
+            if (FLAGS_ins_keys_only) {
+                printf("%s\n", children[i].key.c_str());
+            } else {
+                printf("%s -> %s\n", children[i].key.c_str(),
+                       children[i].value.c_str());
+            }
+        }
+    }
+
+    if (FLAGS_ins_cmd == "backup") {
+        SDKError error;
+        int64_t applied_index = -1;
+        if (!sdk.Backup(FLAGS_ins_backup_file, &applied_index, &error)) {
+            fprintf(stderr, "backup failed: %d\n", static_cast<int>(error));
+            return 1;
+        }
+        printf("backup to %s at [%ld] done\n",
+               FLAGS_ins_backup_file.c_str(), applied_index);
+    }
+
+    if (FLAGS_ins_cmd == "count") {
+        ScanOptions options;
+        options.prefix = FLAGS_ins_prefix;
+        options.skip_locks = FLAGS_ins_skip_locks;
+        options.as_of = FLAGS_ins_as_of;
+        options.as_of_index = FLAGS_ins_as_of_index;
+        SDKError error;
+        int64_t count = 0;
+        if (!sdk.Count(FLAGS_ins_start_key, FLAGS_ins_end_key,
+                       options, &count, &error)) {
+            fprintf(stderr, "rpc error: %d", static_cast<int>(error));
+            return 1;
+        }
+        printf("%ld\n", count);
+    }
+
     if (FLAGS_ins_cmd == "watch") {
         std::string key = FLAGS_ins_key;
         SDKError error;
         bool done = false;
-        bool ret = sdk.Watch(key, my_watch_callback, &done, &error);
+        bool ret = false;
+        if (!FLAGS_ins_prefix.empty()) { //the whole subtree
+            ret = sdk.WatchPrefix(FLAGS_ins_prefix, -1, my_watch_callback,
+                                  &done, &error);
+        } else {
+            ret = sdk.Watch(key, my_watch_callback, &done, &error);
+        }
         if (!ret) {
             fprintf(stderr, "rpc error: %d", static_cast<int>(error));
             return 1;
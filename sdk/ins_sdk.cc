@@ -1,6 +1,8 @@
 #include "ins_sdk.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <algorithm>
 #include <iterator>
 #include <sstream>
@@ -20,6 +22,7 @@
 #include "common/thread_pool.h"
 #include "rpc/rpc_client.h"
 #include "proto/ins_node.pb.h"
+#include "storage/dump_file.h"
 
 DECLARE_string(cluster_members);
 DECLARE_int32(ins_watch_timeout);
@@ -29,6 +32,13 @@ namespace galaxy {
 namespace ins {
 namespace sdk {
 
+// a callback of a persistent watch, made once mu_ is released
+struct StreamCall {
+    WatchCallback cb;
+    WatchParam param;
+    SDKError error;
+};
+
 void InsSDK::ParseFlagFromArgs(int argc, char* argv[], 
                                std::vector<std::string> * members) {
     google::ParseCommandLineFlags(&argc, &argv, true);
@@ -65,6 +75,9 @@ void InsSDK::Init(const std::vector<std::string>& members) {
     handle_session_timeout_ = NULL;
     session_timeout_ctx_ = NULL;
     watch_task_id_ = 0;
+    is_poll_bg_ = false;
+    stream_id_ = 0;
+    acked_seq_ = 0;
     last_succ_alive_timestamp_ = ins_common::timer::get_micros();
     if (members.size() < 1) {
         LOG(FATAL, "invalid cluster size");
@@ -116,6 +129,13 @@ void InsSDK::PrepareServerList(std::vector<std::string>& server_list) {
               std::back_inserter(server_list) );
 }
 
+void InsSDK::ForgetLeader(const std::string& server_id) {
+    MutexLock lock(mu_);
+    if (leader_id_ == server_id) {
+        leader_id_ = "";
+    }
+}
+
 bool InsSDK::ShowCluster(std::vector<ClusterNodeInfo>* cluster_info) {
     assert(cluster_info);
     std::vector<std::string>::iterator it;
@@ -136,6 +156,14 @@ bool InsSDK::ShowCluster(std::vector<ClusterNodeInfo>* cluster_info) {
             node_info.last_log_term = -1;
             node_info.commit_index = -1;
             node_info.last_applied = -1;
+            node_info.cache_hits = -1;
+            node_info.cache_misses = -1;
+            node_info.cache_memory = -1;
+            node_info.notify_count = -1;
+            node_info.notify_p50_us = -1;
+            node_info.notify_p99_us = -1;
+            node_info.notify_p999_us = -1;
+            node_info.notify_max_us = -1;
         } else {
             node_info.status = response.status();
             node_info.term = response.term();
@@ -143,6 +171,14 @@ bool InsSDK::ShowCluster(std::vector<ClusterNodeInfo>* cluster_info) {
             node_info.last_log_term = response.last_log_term();
             node_info.commit_index = response.commit_index();
             node_info.last_applied = response.last_applied();
+            node_info.cache_hits = response.cache_hits();
+            node_info.cache_misses = response.cache_misses();
+            node_info.cache_memory = response.cache_memory();
+            node_info.notify_count = response.notify_count();
+            node_info.notify_p50_us = response.notify_p50_us();
+            node_info.notify_p99_us = response.notify_p99_us();
+            node_info.notify_p999_us = response.notify_p999_us();
+            node_info.notify_max_us = response.notify_max_us();
         }
         cluster_info->push_back(node_info);
     }
@@ -168,7 +204,124 @@ std::string InsSDK::StatusToString(int32_t status) {
 }
 
 
+static void SetCompare(const WriteCondition& condition,
+                       galaxy::ins::Compare* compare) {
+    switch (condition.type) {
+        case kValueEquals:
+            compare->set_target(galaxy::ins::kCompareValue);
+            compare->set_value(condition.value);
+            break;
+        case kModRevisionEquals:
+            compare->set_target(galaxy::ins::kCompareModRevision);
+            compare->set_mod_revision(condition.mod_revision);
+            break;
+        case kKeyExists:
+        case kKeyMissing:
+            compare->set_target(galaxy::ins::kCompareExists);
+            compare->set_exists(condition.type == kKeyExists);
+            break;
+    }
+}
+
 bool InsSDK::Put(const std::string& key, const std::string& value, SDKError* error) {
+    galaxy::ins::PutRequest request;
+    galaxy::ins::PutResponse response;
+    request.set_key(key);
+    request.set_value(value);
+    return PutOnce(request, &response, error);
+}
+
+bool InsSDK::Put(const std::string& key, const std::string& value,
+                 int64_t ttl_ms, SDKError* error) {
+    galaxy::ins::PutRequest request;
+    galaxy::ins::PutResponse response;
+    request.set_key(key);
+    request.set_value(value);
+    request.set_ttl_ms(ttl_ms);
+    return PutOnce(request, &response, error);
+}
+
+bool InsSDK::PutEphemeral(const std::string& key, const std::string& value,
+                          SDKError* error) {
+    bool first_beat = false;
+    {
+        MutexLock lock(mu_);
+        if (!is_keep_alive_bg_) {
+            is_keep_alive_bg_ = true;
+            first_beat = true;
+        }
+    }
+    if (first_beat) { //the leader refuses a session it never heard of
+        KeepAliveTask();
+    }
+    galaxy::ins::PutRequest request;
+    galaxy::ins::PutResponse response;
+    request.set_key(key);
+    request.set_value(value);
+    request.set_ephemeral(true);
+    request.set_session_id(GetSessionID());
+    return PutOnce(request, &response, error);
+}
+
+bool InsSDK::PutIf(const std::string& key, const std::string& value,
+                   const WriteCondition& condition, SDKError* error) {
+    galaxy::ins::PutRequest request;
+    galaxy::ins::PutResponse response;
+    request.set_key(key);
+    request.set_value(value);
+    SetCompare(condition, request.mutable_compare());
+    if (!PutOnce(request, &response, error)) {
+        return false;
+    }
+    if (response.compare_failed()) {
+        *error = kCompareFail;
+        return false;
+    }
+    return true;
+}
+
+bool InsSDK::CompareAndSwap(const std::string& key,
+                            const std::string& old_value,
+                            const std::string& new_value,
+                            SDKError* error) {
+    WriteCondition condition;
+    condition.type = kValueEquals;
+    condition.value = old_value;
+    return PutIf(key, new_value, condition, error);
+}
+
+bool InsSDK::Increment(const std::string& key, int64_t delta,
+                       int64_t* value, SDKError* error) {
+    galaxy::ins::IncrRequest request;
+    galaxy::ins::IncrResponse response;
+    request.set_key(key);
+    request.set_delta(delta);
+    if (!IncrOnce(request, &response, error)) {
+        return false;
+    }
+    if (response.not_a_number()) {
+        *error = kNotANumber;
+        return false;
+    }
+    *value = response.value();
+    return true;
+}
+
+bool InsSDK::AllocateIds(const std::string& key, int64_t count,
+                         int64_t* first_id, SDKError* error) {
+    assert(count > 0);
+    int64_t last_id = 0;
+    if (!Increment(key, count, &last_id, error)) {
+        return false;
+    }
+    *first_id = last_id - count + 1;
+    return true;
+}
+
+template <class Request, class Response, class Method>
+bool InsSDK::LeaderRequest(Method method, const Request& request,
+                           Response* response, bool resend,
+                           SDKError* error) {
     std::vector<std::string> server_list;
     PrepareServerList(server_list);
     std::vector<std::string>::const_iterator it ;
@@ -178,18 +331,22 @@ bool InsSDK::Put(const std::string& key, const std::string& value, SDKError* err
         galaxy::ins::InsNode_Stub *stub, *stub2;
         rpc_client_->GetStub(server_id, &stub);
         boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
-        galaxy::ins::PutRequest request;
-        galaxy::ins::PutResponse response;
-        request.set_key(key);
-        request.set_value(value);
-        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Put,
-                                          &request, &response, 2, 1);
+        response->Clear();
+        int rpc_error = 0;
+        bool ok = rpc_client_->SendRequest(stub, method,
+                                           &request, response, 2, 1,
+                                           &rpc_error);
         if (!ok) {
             LOG(FATAL, "faild to rcp %s", server_id.c_str());
+            ForgetLeader(server_id);
+            if (!resend && !RpcClient::NeverDelivered(rpc_error)) {
+                *error = kTimeout; //it may have been applied
+                return false;
+            }
             continue;
         }
 
-        if (response.success()) {
+        if (response->success()) {
             {
                 MutexLock lock(mu_);
                 leader_id_ = server_id;
@@ -197,14 +354,17 @@ bool InsSDK::Put(const std::string& key, const std::string& value, SDKError* err
             *error = kOK;
             return true;
         } else {
-            if (!response.leader_id().empty()) {
-                server_id = response.leader_id();
+            if (!response->leader_id().empty()) {
+                server_id = response->leader_id();
                 LOG(DEBUG, "redirect to leader :%s", server_id.c_str());
                 rpc_client_->GetStub(server_id, &stub2);
                 boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard2(stub2);
-                ok = rpc_client_->SendRequest(stub2, &InsNode_Stub::Put,
-                                             &request, &response, 2, 1);
-                if (ok && response.success()) {
+                response->Clear();
+                rpc_error = 0;
+                ok = rpc_client_->SendRequest(stub2, method,
+                                              &request, response, 2, 1,
+                                              &rpc_error);
+                if (ok && response->success()) {
                     {
                         MutexLock lock(mu_);
                         leader_id_ = server_id;
@@ -212,6 +372,14 @@ bool InsSDK::Put(const std::string& key, const std::string& value, SDKError* err
                     *error = kOK;
                     return true;
                 }
+                if (!ok) {
+                    LOG(FATAL, "faild to rcp %s", server_id.c_str());
+                    ForgetLeader(server_id);
+                    if (!resend && !RpcClient::NeverDelivered(rpc_error)) {
+                        *error = kTimeout;
+                        return false;
+                    }
+                }
             }
         }
         ThisThread::Sleep(1000);
@@ -220,8 +388,116 @@ bool InsSDK::Put(const std::string& key, const std::string& value, SDKError* err
     return false;
 }
 
+bool InsSDK::IncrOnce(const galaxy::ins::IncrRequest& request,
+                      galaxy::ins::IncrResponse* response,
+                      SDKError* error) {
+    //not idempotent, never sent twice
+    return LeaderRequest(&InsNode_Stub::Incr, request, response, false, error);
+}
+
+static void SetTxnOps(const std::vector<TxnOp>& ops,
+                      ::google::protobuf::RepeatedPtrField<galaxy::ins::TxnOp>* out) {
+    for (size_t i = 0; i < ops.size(); i++) {
+        galaxy::ins::TxnOp* op = out->Add();
+        op->set_op(ops[i].type == kTxnPut ? galaxy::ins::kPut : galaxy::ins::kDel);
+        op->set_key(ops[i].key);
+        if (ops[i].type == kTxnPut) {
+            op->set_value(ops[i].value);
+        }
+    }
+}
+
+bool InsSDK::Txn(const std::vector<TxnGuard>& guards,
+                 const std::vector<TxnOp>& then_ops,
+                 const std::vector<TxnOp>& else_ops,
+                 bool* guards_held,
+                 SDKError* error) {
+    galaxy::ins::TxnRequest request;
+    galaxy::ins::TxnResponse response;
+    for (size_t i = 0; i < guards.size(); i++) {
+        galaxy::ins::TxnGuard* guard = request.add_guards();
+        guard->set_key(guards[i].key);
+        SetCompare(guards[i].condition, guard->mutable_compare());
+    }
+    SetTxnOps(then_ops, request.mutable_then_ops());
+    SetTxnOps(else_ops, request.mutable_else_ops());
+    if (!TxnOnce(request, &response, error)) {
+        return false;
+    }
+    *guards_held = response.guards_held();
+    return true;
+}
+
+bool InsSDK::TxnOnce(const galaxy::ins::TxnRequest& request,
+                     galaxy::ins::TxnResponse* response,
+                     SDKError* error) {
+    //resent after it applied, the guards would see its own ops
+    return LeaderRequest(&InsNode_Stub::Txn, request, response, false, error);
+}
+
+bool InsSDK::PutOnce(const galaxy::ins::PutRequest& request,
+                     galaxy::ins::PutResponse* response,
+                     SDKError* error) {
+    //a conditional write that applied but timed out would fail its own
+    //compare when sent again
+    return LeaderRequest(&InsNode_Stub::Put, request, response,
+                         !request.has_compare(), error);
+}
+
+bool InsSDK::Get(const std::string& key, std::string* value,
+                 SDKError* error) {
+    galaxy::ins::GetRequest request;
+    galaxy::ins::GetResponse response;
+    request.set_key(key);
+    if (!GetOnce(request, &response, error)) {
+        return false;
+    }
+    *value = response.value();
+    *error = response.hit() ? kOK : kNoSuchKey;
+    return true;
+}
+
 bool InsSDK::Get(const std::string& key, std::string* value,
+                 int64_t* create_revision, int64_t* mod_revision,
                  SDKError* error) {
+    galaxy::ins::GetRequest request;
+    galaxy::ins::GetResponse response;
+    request.set_key(key);
+    if (!GetOnce(request, &response, error)) {
+        return false;
+    }
+    *value = response.value();
+    *create_revision = response.hit() ? response.create_revision() : -1;
+    *mod_revision = response.hit() ? response.mod_revision() : -1;
+    *error = response.hit() ? kOK : kNoSuchKey;
+    return true;
+}
+
+bool InsSDK::GetAsOf(const std::string& key,
+                     int64_t* as_of_index,
+                     std::string* value,
+                     SDKError* error) {
+    assert(as_of_index);
+    galaxy::ins::GetRequest request;
+    galaxy::ins::GetResponse response;
+    request.set_key(key);
+    request.set_as_of_index(*as_of_index);
+    if (!GetOnce(request, &response, error)) {
+        return false;
+    }
+    if (response.history_unavailable()) {
+        *error = kHistoryUnavailable;
+        return false;
+    }
+    *as_of_index = response.as_of_index();
+    *value = response.value();
+    *error = response.hit() ? kOK : kNoSuchKey;
+    return true;
+}
+
+bool InsSDK::GetOnce(const galaxy::ins::GetRequest& request,
+                     galaxy::ins::GetResponse* response,
+                     SDKError* error) {
     std::vector<std::string> server_list;
     PrepareServerList(server_list);
     std::vector<std::string>::const_iterator it ;
@@ -231,48 +507,36 @@ bool InsSDK::Get(const std::string& key, std::string* value,
         galaxy::ins::InsNode_Stub *stub, *stub2;
         rpc_client_->GetStub(server_id, &stub);
         boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
-        galaxy::ins::GetRequest request;
-        galaxy::ins::GetResponse response;
-        request.set_key(key);
+        response->Clear();
         bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Get,
-                                          &request, &response, 2, 1);
+                                          &request, response, 2, 1);
         if (!ok) {
             LOG(FATAL, "faild to rcp %s", server_id.c_str());
             continue;
         }
 
-        if (response.success()) {
-            *value = response.value();
-            if (response.hit()) {
-                *error = kOK;
-            } else {
-                *error = kNoSuchKey;
-            }
+        if (response->success()) {
+            *error = kOK;
             {
                 MutexLock lock(mu_);
                 leader_id_ = server_id;
             }
             return true;
         } else {
-            if (!response.leader_id().empty()) {
-                server_id = response.leader_id();
+            if (!response->leader_id().empty()) {
+                server_id = response->leader_id();
                 LOG(DEBUG, "redirect to leader :%s", server_id.c_str());
                 rpc_client_->GetStub(server_id, &stub2);
                 boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard2(stub2);
+                response->Clear();
                 ok = rpc_client_->SendRequest(stub2, &InsNode_Stub::Get,
-                                             &request, &response, 2, 1);
-                if (ok && response.success()) {
+                                             &request, response, 2, 1);
+                if (ok && response->success()) {
                     {
                         MutexLock lock(mu_);
                         leader_id_ = server_id;
                     }
                     *error = kOK;
-                    if (response.hit()) {
-                        *error = kOK;
-                        *value = response.value();
-                    } else {
-                        *error = kNoSuchKey;
-                    }
                     return true;
                 }
             }
@@ -286,10 +550,84 @@ bool InsSDK::Get(const std::string& key, std::string* value,
 bool InsSDK::ScanOnce(const std::string& start_key,
                       const std::string& end_key,
                       std::vector<KVPair>* buffer,
-                      SDKError* error) {
+                      SDKError* error,
+                      int64_t* cursor_id,
+                      const ScanOptions* options) {
     assert(buffer);
+    galaxy::ins::ScanRequest request;
+    galaxy::ins::ScanResponse response;
+    request.set_start_key(start_key);
+    request.set_end_key(end_key);
+    request.set_size_limit(500);
+    if (cursor_id) {
+        request.set_use_cursor(true);
+        if (*cursor_id > 0) {
+            request.set_cursor_id(*cursor_id);
+        }
+    }
+    if (options) {
+        request.set_keys_only(options->keys_only);
+        request.set_prefix(options->prefix);
+        request.set_max_bytes(options->max_bytes);
+        request.set_skip_locks(options->skip_locks);
+        if (options->as_of) {
+            request.set_as_of_index(options->as_of_index);
+        }
+    }
+    if (!ScanPage(&request, &response, error)) {
+        return false;
+    }
+    if (response.history_unavailable()) {
+        *error = kHistoryUnavailable;
+        return false;
+    }
+    for(int i = 0; i < response.items_size(); i++) {
+        KVPair kv_pair;
+        kv_pair.key = response.items(i).key();
+        kv_pair.value = response.items(i).value();
+        kv_pair.create_revision = response.items(i).create_revision();
+        kv_pair.mod_revision = response.items(i).mod_revision();
+        buffer->push_back(kv_pair);
+    }
+    if (cursor_id) {
+        *cursor_id = response.cursor_id();
+    }
+    return true;
+}
+
+bool InsSDK::Count(const std::string& start_key,
+                   const std::string& end_key,
+                   const ScanOptions& options,
+                   int64_t* count,
+                   SDKError* error) {
+    assert(count);
+    galaxy::ins::ScanRequest request;
+    galaxy::ins::ScanResponse response;
+    request.set_start_key(start_key);
+    request.set_end_key(end_key);
+    request.set_size_limit(0);
+    request.set_count_only(true);
+    request.set_prefix(options.prefix);
+    request.set_skip_locks(options.skip_locks);
+    if (options.as_of) {
+        request.set_as_of_index(options.as_of_index);
+    }
+    if (!ScanPage(&request, &response, error)) {
+        return false;
+    }
+    if (response.history_unavailable()) {
+        *error = kHistoryUnavailable;
+        return false;
+    }
+    *count = response.count();
+    return true;
+}
+
+bool InsSDK::ScanPage(galaxy::ins::ScanRequest* request,
+                      galaxy::ins::ScanResponse* response,
+                      SDKError* error) {
     std::string value;
-    if (!Get(start_key, &value, error)) { //avoid network partition problem
+    if (!Get(request->start_key(), &value, error)) { //avoid network partition problem
         LOG(FATAL, "the leader may be unavilable");
         return false;
     }
@@ -302,51 +640,36 @@ bool InsSDK::ScanOnce(const std::string& start_key,
         galaxy::ins::InsNode_Stub *stub, *stub2;
         rpc_client_->GetStub(server_id, &stub);
         boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
-        galaxy::ins::ScanRequest request;
-        galaxy::ins::ScanResponse response;
-        request.set_start_key(start_key);
-        request.set_end_key(end_key);
-        request.set_size_limit(500);
+        response->Clear();
         bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Scan,
-                                           &request, &response, 5, 1);
+                                           request, response, 5, 1);
         if (!ok) {
             LOG(FATAL, "faild to rcp %s", server_id.c_str());
             continue;
         }
 
-        if (response.success()) {
+        if (response->success()) {
             *error = kOK;
-            for(int i = 0; i < response.items_size(); i++) {
-                KVPair kv_pair;
-                kv_pair.key = response.items(i).key();
-                kv_pair.value = response.items(i).value();
-                buffer->push_back(kv_pair);
-            }
             {
                 MutexLock lock(mu_);
                 leader_id_ = server_id;
             }
             return true;
         } else {
-            if (!response.leader_id().empty()) {
-                server_id = response.leader_id();
+            if (!response->leader_id().empty()) {
+                server_id = response->leader_id();
                 LOG(DEBUG, "redirect to leader :%s", server_id.c_str());
                 rpc_client_->GetStub(server_id, &stub2);
                 boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard2(stub2);
+                response->Clear();
                 ok = rpc_client_->SendRequest(stub2, &InsNode_Stub::Scan,
-                                              &request, &response, 5, 1);
-                if (ok && response.success()) {
+                                              request, response, 5, 1);
+                if (ok && response->success()) {
                     {
                         MutexLock lock(mu_);
                         leader_id_ = server_id;
                     }
                     *error = kOK;
-                    for(int i = 0; i < response.items_size(); i++) {
-                        KVPair kv_pair;
-                        kv_pair.key = response.items(i).key();
-                        kv_pair.value = response.items(i).value();
-                        buffer->push_back(kv_pair);
-                    }       
                     return true;
                 }
             }
@@ -357,7 +680,38 @@ bool InsSDK::ScanOnce(const std::string& start_key,
     return false;
 }
 
-bool InsSDK::Delete(const std::string& key, SDKError* error) {
+bool InsSDK::ListChildren(const std::string& parent,
+                          bool with_values,
+                          std::vector<KVPair>* children,
+                          SDKError* error) {
+    assert(children);
+    galaxy::ins::ListChildrenRequest request;
+    request.set_parent(parent);
+    request.set_with_values(with_values);
+    while (true) {
+        galaxy::ins::ListChildrenResponse response;
+        if (!ListChildrenOnce(request, &response, error)) {
+            return false;
+        }
+        for (int i = 0; i < response.children_size(); i++) {
+            KVPair kv_pair;
+            kv_pair.key = response.children(i).name();
+            kv_pair.value = response.children(i).value();
+            children->push_back(kv_pair);
+        }
+        if (!response.has_more() || response.children_size() == 0) {
+            break;
+        }
+        request.set_start_after(
+            response.children(response.children_size() - 1).name()
+        );
+    }
+    return true;
+}
+
+bool InsSDK::ListChildrenOnce(const galaxy::ins::ListChildrenRequest& request,
+                              galaxy::ins::ListChildrenResponse* response,
+                              SDKError* error) {
     std::vector<std::string> server_list;
     PrepareServerList(server_list);
     std::vector<std::string>::const_iterator it ;
@@ -366,17 +720,16 @@ bool InsSDK::Delete(const std::string& key, SDKError* error) {
         LOG(DEBUG, "rpc to %s", server_id.c_str());
         galaxy::ins::InsNode_Stub *stub, *stub2;
         rpc_client_->GetStub(server_id, &stub);
-        galaxy::ins::DelRequest request;
-        galaxy::ins::DelResponse response;
-        request.set_key(key);
-        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Delete,
-                                          &request, &response, 2, 1);
+        boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
+        response->Clear();
+        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::ListChildren,
+                                           &request, response, 5, 1);
         if (!ok) {
             LOG(FATAL, "faild to rcp %s", server_id.c_str());
             continue;
         }
 
-        if (response.success()) {
+        if (response->success()) {
             {
                 MutexLock lock(mu_);
                 leader_id_ = server_id;
@@ -384,14 +737,15 @@ bool InsSDK::Delete(const std::string& key, SDKError* error) {
             *error = kOK;
             return true;
         } else {
-            if (!response.leader_id().empty()) {
-                server_id = response.leader_id();
+            if (!response->leader_id().empty()) {
+                server_id = response->leader_id();
                 LOG(DEBUG, "redirect to leader :%s", server_id.c_str());
                 rpc_client_->GetStub(server_id, &stub2);
                 boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard2(stub2);
-                ok = rpc_client_->SendRequest(stub2, &InsNode_Stub::Delete,
-                                             &request, &response, 2, 1);
-                if (ok && response.success()) {
+                response->Clear();
+                ok = rpc_client_->SendRequest(stub2, &InsNode_Stub::ListChildren,
+                                              &request, response, 5, 1);
+                if (ok && response->success()) {
                     {
                         MutexLock lock(mu_);
                         leader_id_ = server_id;
@@ -399,7 +753,7 @@ bool InsSDK::Delete(const std::string& key, SDKError* error) {
                     *error = kOK;
                     return true;
                 }
-            } 
+            }
         }
         ThisThread::Sleep(1000);
     }
@@ -407,25 +761,240 @@ bool InsSDK::Delete(const std::string& key, SDKError* error) {
     return false;
 }
 
+bool InsSDK::Backup(const std::string& file_name,
+                    int64_t* applied_index,
+                    SDKError* error) {
+    std::vector<std::string> server_list;
+    PrepareServerList(server_list);
+    std::vector<std::string>::const_iterator it ;
+    for (it = server_list.begin(); it != server_list.end(); it++){
+        std::string server_id = *it;
+        LOG(DEBUG, "rpc to %s", server_id.c_str());
+        galaxy::ins::InsNode_Stub *stub;
+        rpc_client_->GetStub(server_id, &stub);
+        boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
+        galaxy::ins::BackupRequest request;
+        galaxy::ins::BackupResponse response;
+        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Backup,
+                                           &request, &response, 60, 1);
+        if (!ok || !response.success()) {
+            LOG(FATAL, "faild to rcp %s", server_id.c_str());
+            continue;
+        }
+        //the snapshot lives on this server, stay with it until the end
+        *applied_index = response.applied_index();
+        //a backup appears at file_name whole or not at all
+        std::string tmp_name = file_name + ".tmp";
+        DumpWriter writer;
+        SDKError write_error = kOK;
+        if (!writer.Open(tmp_name, response.applied_index(), response.term())) {
+            LOG(FATAL, "failed to open %s", tmp_name.c_str());
+            write_error = kClusterDown;
+        }
+        while (write_error == kOK) {
+            if (!writer.AppendChunk(response.chunk(), response.raw_size(),
+                                    response.checksum(),
+                                    response.record_count())) {
+                LOG(FATAL, "failed to write %s", tmp_name.c_str());
+                write_error = kClusterDown;
+                break;
+            }
+            if (!response.has_more()) {
+                break;
+            }
+            request.set_backup_id(response.backup_id());
+            request.set_start_key(response.next_key());
+            response.Clear();
+            ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Backup,
+                                          &request, &response, 60, 1);
+            if (!ok || !response.success()) {
+                LOG(FATAL, "backup broken off by %s", server_id.c_str());
+                write_error = kTimeout;
+            }
+        }
+        if (write_error == kOK && !writer.Close()) {
+            LOG(FATAL, "failed to close %s", tmp_name.c_str());
+            write_error = kClusterDown;
+        }
+        if (write_error == kOK
+            && rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+            LOG(FATAL, "failed to rename %s", tmp_name.c_str());
+            write_error = kClusterDown;
+        }
+        if (write_error != kOK) {
+            unlink(tmp_name.c_str());
+        }
+        *error = write_error;
+        return write_error == kOK;
+    }
+    *error = kClusterDown;
+    return false;
+}
+
+bool InsSDK::Delete(const std::string& key, SDKError* error) {
+    galaxy::ins::DelRequest request;
+    galaxy::ins::DelResponse response;
+    request.set_key(key);
+    return DeleteOnce(request, &response, error);
+}
+
+bool InsSDK::DeleteRange(const std::string& start_key,
+                         const std::string& end_key,
+                         int64_t* deleted_count,
+                         SDKError* error) {
+    galaxy::ins::DeleteRangeRequest request;
+    request.set_start_key(start_key);
+    request.set_end_key(end_key);
+    return DeleteRangeAll(request, deleted_count, error);
+}
+
+bool InsSDK::DeletePrefix(const std::string& prefix,
+                          int64_t* deleted_count,
+                          SDKError* error) {
+    galaxy::ins::DeleteRangeRequest request;
+    request.set_prefix(prefix);
+    return DeleteRangeAll(request, deleted_count, error);
+}
+
+bool InsSDK::DeleteRangeAll(const galaxy::ins::DeleteRangeRequest& request,
+                            int64_t* deleted_count,
+                            SDKError* error) {
+    //the leader caps the keys of one entry, repeat until none is left
+    *deleted_count = 0;
+    galaxy::ins::DeleteRangeResponse response;
+    do {
+        if (!DeleteRangeOnce(request, &response, error)) {
+            return false;
+        }
+        *deleted_count += response.deleted_count();
+    } while (response.deleted_count() > 0);
+    return true;
+}
+
+bool InsSDK::DeleteRangeOnce(const galaxy::ins::DeleteRangeRequest& request,
+                             galaxy::ins::DeleteRangeResponse* response,
+                             SDKError* error) {
+    return LeaderRequest(&InsNode_Stub::DeleteRange, request, response, true,
+                         error);
+}
+
+bool InsSDK::DeleteIf(const std::string& key, const WriteCondition& condition,
+                      SDKError* error) {
+    galaxy::ins::DelRequest request;
+    galaxy::ins::DelResponse response;
+    request.set_key(key);
+    SetCompare(condition, request.mutable_compare());
+    if (!DeleteOnce(request, &response, error)) {
+        return false;
+    }
+    if (response.compare_failed()) {
+        *error = kCompareFail;
+        return false;
+    }
+    return true;
+}
+
+bool InsSDK::DeleteOnce(const galaxy::ins::DelRequest& request,
+                        galaxy::ins::DelResponse* response,
+                        SDKError* error) {
+    //a conditional write that applied but timed out would fail its own
+    //compare when sent again
+    return LeaderRequest(&InsNode_Stub::Delete, request, response,
+                         !request.has_compare(), error);
+}
+
 bool InsSDK::Watch(const std::string& key, 
                    WatchCallback user_callback, 
                    void* context,
                    SDKError* error) {
-    std::string old_value;
-    Get(key, &old_value, error);
-    if (*error != kOK && *error != kNoSuchKey) {
+    galaxy::ins::GetRequest request;
+    galaxy::ins::GetResponse response;
+    request.set_key(key);
+    if (!GetOnce(request, &response, error)) {
         LOG(FATAL, "faild to issue a watch: %s", key.c_str());
         return false;
     }
-    bool key_exist = true;
-    if (*error == kNoSuchKey) {
-        key_exist = false;
+    if (response.hit()) {
+        return Watch(key, response.mod_revision(), user_callback, context,
+                     error);
+    }
+    //missing as of the read index, a member behind it waits to reach it
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(key);
+    spec.set_key_exist(false);
+    spec.set_after_revision(response.read_index());
+    spec.set_from_index(response.read_index());
+    return AddWatch(spec, user_callback, context, error);
+}
+
+bool InsSDK::Watch(const std::string& key,
+                   int64_t after_revision,
+                   WatchCallback user_callback,
+                   void* context,
+                   SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(key);
+    spec.set_key_exist(after_revision >= 0);
+    spec.set_after_revision(after_revision >= 0 ? after_revision : 0);
+    if (after_revision >= 0) {
+        spec.set_from_index(after_revision);
+    }
+    return AddWatch(spec, user_callback, context, error);
+}
+
+bool InsSDK::WatchPrefix(const std::string& prefix,
+                         int64_t after_revision,
+                         WatchCallback user_callback,
+                         void* context,
+                         SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(prefix);
+    spec.set_prefix(true);
+    if (after_revision >= 0) {
+        spec.set_after_revision(after_revision);
+        spec.set_from_index(after_revision);
+    }
+    return AddWatch(spec, user_callback, context, error);
+}
+
+bool InsSDK::WatchRange(const std::string& start_key,
+                        const std::string& end_key,
+                        int64_t after_revision,
+                        WatchCallback user_callback,
+                        void* context,
+                        SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(start_key);
+    spec.set_end_key(end_key);
+    if (after_revision >= 0) {
+        spec.set_after_revision(after_revision);
+        spec.set_from_index(after_revision);
+    }
+    return AddWatch(spec, user_callback, context, error);
+}
+
+std::string InsSDK::WatchName(const galaxy::ins::WatchRequest& spec) {
+    //keys never start with '\0', so these never meet a key watch
+    if (spec.prefix()) {
+        return std::string(1, '\0') + "prefix:" + spec.key();
+    }
+    if (spec.has_end_key()) {
+        return std::string(1, '\0') + "range:" + spec.key()
+               + std::string(1, '\0') + spec.end_key();
     }
+    return spec.key();
+}
+
+bool InsSDK::AddWatch(const galaxy::ins::WatchRequest& spec,
+                      WatchCallback user_callback,
+                      void* context,
+                      SDKError* error) {
+    std::string name = WatchName(spec);
     {
         MutexLock lock(mu_);
-        watch_keys_.insert(key);
-        watch_cbs_[key] = user_callback;
-        watch_ctx_[key] = context;
+        watch_keys_.insert(name);
+        watch_cbs_[name] = user_callback;
+        watch_ctx_[name] = context;
         int64_t watch_id = (++watch_task_id_);
         pending_watches_.insert(watch_id);
         if (!is_keep_alive_bg_) {
@@ -434,9 +1003,10 @@ bool InsSDK::Watch(const std::string& key,
             );
             is_keep_alive_bg_ = true;
         }
+        galaxy::ins::WatchRequest request(spec);
+        request.set_session_id(session_id_);
         keep_watch_pool_->AddTask(
-            boost::bind(&InsSDK::KeepWatchTask, this, key,
-                        old_value, key_exist, session_id_, watch_id)
+            boost::bind(&InsSDK::KeepWatchTask, this, request, watch_id)
         );
     }
     *error = kOK;
@@ -547,21 +1117,20 @@ void InsSDK::KeepWatchCallback(const galaxy::ins::WatchRequest* request,
             return;
         }
     }
-    if (!failed && response_ptr->success()) {
+    if (!failed && response_ptr->success() && !response_ptr->compacted()) {
         WatchCallback cb = NULL;
         void * cb_ctx = NULL;
         {
             MutexLock lock(mu_);
-            leader_id_ = server_id;
-            cb = watch_cbs_[response_ptr->watch_key()];
-            cb_ctx = watch_ctx_[response_ptr->watch_key()];
+            cb = watch_cbs_[WatchName(*request)];
+            cb_ctx = watch_ctx_[WatchName(*request)];
         }
         if (cb) {
             {
                 MutexLock lock(mu_);
-                watch_keys_.erase(response->watch_key());
-                watch_cbs_.erase(response->watch_key());
-                watch_ctx_.erase(response->watch_key());
+                watch_keys_.erase(WatchName(*request));
+                watch_cbs_.erase(WatchName(*request));
+                watch_ctx_.erase(WatchName(*request));
                 pending_watches_.erase(watch_id);
                 LOG(INFO, "watch #%ld trigger", watch_id);
             }
@@ -569,17 +1138,18 @@ void InsSDK::KeepWatchCallback(const galaxy::ins::WatchRequest* request,
             param.key = response_ptr->key();
             param.value = response_ptr->value();
             param.deleted = response_ptr->deleted();
+            param.create_revision = response_ptr->create_revision();
+            param.mod_revision = response_ptr->mod_revision();
             param.context = cb_ctx;
             cb(param, kOK);
         }
         return;
+    } else if (!failed && response_ptr->compacted()) {
+        LOG(INFO, "watch history trimmed, check the store again");
     } else if (!failed && !response_ptr->leader_id().empty()) {
         server_id = response_ptr->leader_id();
     } else {
-        std::vector<std::string> server_list;
-        PrepareServerList(server_list);
-        int s_no = (int32_t) (server_list.size() * rand()/(RAND_MAX+1.0));
-        server_id = server_list[s_no];
+        server_id = PickWatchServer();
     }
     if (!response_ptr->canceled()) { //retry, if not cancel
         if (request->session_id() != GetSessionID()) {
@@ -588,7 +1158,7 @@ void InsSDK::KeepWatchCallback(const galaxy::ins::WatchRequest* request,
         }
         {
             MutexLock lock(mu_);
-            if (watch_keys_.find(request->key()) == watch_keys_.end()) {
+            if (watch_keys_.find(WatchName(*request)) == watch_keys_.end()) {
                 LOG(INFO, "watcher has been triggered");
                 return;
             }
@@ -600,6 +1170,9 @@ void InsSDK::KeepWatchCallback(const galaxy::ins::WatchRequest* request,
         galaxy::ins::WatchRequest* req = new galaxy::ins::WatchRequest();
         galaxy::ins::WatchResponse* rsps = new galaxy::ins::WatchResponse();
         req->CopyFrom(*request);
+        if (!failed && response_ptr->compacted()) {
+            req->clear_from_index();
+        }
         boost::function< void (const galaxy::ins::WatchRequest*,
                                galaxy::ins::WatchResponse*, 
                                bool, int) > callback;
@@ -613,25 +1186,14 @@ void InsSDK::KeepWatchCallback(const galaxy::ins::WatchRequest* request,
     }
 }
 
-void InsSDK::BackupWatchTask(const std::string& key, int64_t watch_id) {
-    std::string old_value;
-    SDKError error;
-    Get(key, &old_value, &error);
-    if (error != kOK && error != kNoSuchKey) {
-        LOG(FATAL, "faild to issue a backup watch: %s", key.c_str());
-        return;
-    }
-    bool key_exist = true;
-    if (error == kNoSuchKey) {
-        key_exist = false;
-    }
-    KeepWatchTask(key, old_value, key_exist, GetSessionID(), watch_id);
+void InsSDK::BackupWatchTask(galaxy::ins::WatchRequest spec,
+                             int64_t watch_id) {
+    //same revision, changes since the first watch still fire
+    spec.set_session_id(GetSessionID());
+    KeepWatchTask(spec, watch_id);
 }
 
-void InsSDK::KeepWatchTask(const std::string& key, 
-                           const std::string& old_value,
-                           bool key_exist,
-                           std::string session_id,
+void InsSDK::KeepWatchTask(const galaxy::ins::WatchRequest& spec,
                            int64_t watch_id) {
     {
         MutexLock lock(mu_);
@@ -644,28 +1206,22 @@ void InsSDK::KeepWatchTask(const std::string& key,
         }
     }
 
-    if (session_id != GetSessionID()) {
-        LOG(INFO, "expried watch on %s", key.c_str());
+    if (spec.session_id() != GetSessionID()) {
+        LOG(INFO, "expried watch on %s", spec.key().c_str());
         return;
     }
 
     keep_watch_pool_->DelayTask(FLAGS_ins_backup_watch_timeout * 1000, //ms
-        boost::bind(&InsSDK::BackupWatchTask, this, key, watch_id)
+        boost::bind(&InsSDK::BackupWatchTask, this, spec, watch_id)
     );
-    std::vector<std::string> server_list;
-    PrepareServerList(server_list);
-    int s_no = (int32_t) (server_list.size() * rand()/(RAND_MAX+1.0));
-    std::string server_id = server_list[s_no];
+    std::string server_id = PickWatchServer();
     LOG(INFO, "watch to %s", server_id.c_str());
     galaxy::ins::InsNode_Stub *stub;
     rpc_client_->GetStub(server_id, &stub);
     boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
     galaxy::ins::WatchRequest* request = new galaxy::ins::WatchRequest();
     galaxy::ins::WatchResponse* response = new galaxy::ins::WatchResponse();
-    request->set_session_id(GetSessionID());
-    request->set_key(key);
-    request->set_old_value(old_value);
-    request->set_key_exist(key_exist);
+    request->CopyFrom(spec);
     boost::function< void (const galaxy::ins::WatchRequest*,
                            galaxy::ins::WatchResponse*, 
                            bool, int) > callback;
@@ -676,6 +1232,312 @@ void InsSDK::KeepWatchTask(const std::string& key,
                               FLAGS_ins_watch_timeout, 1); 
 }
 
+bool InsSDK::WatchCovers(const galaxy::ins::WatchRequest& spec,
+                         const std::string& key) {
+    if (spec.prefix()) {
+        return key.compare(0, spec.key().size(), spec.key()) == 0;
+    }
+    if (spec.has_end_key()) {
+        return key >= spec.key()
+               && (spec.end_key().empty() || key < spec.end_key());
+    }
+    if (key == spec.key()) {
+        return true;
+    }
+    std::string::size_type tail_index = key.rfind("/");
+    return tail_index != std::string::npos
+           && tail_index == spec.key().size()
+           && key.compare(0, tail_index, spec.key()) == 0;
+}
+
+bool InsSDK::PersistentWatch(const std::string& key,
+                             int64_t after_revision,
+                             WatchCallback user_callback,
+                             void* context,
+                             SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(key);
+    if (after_revision >= 0) {
+        spec.set_from_index(after_revision);
+    }
+    return AddStreamWatch(spec, user_callback, context, error);
+}
+
+bool InsSDK::PersistentWatchPrefix(const std::string& prefix,
+                                   int64_t after_revision,
+                                   WatchCallback user_callback,
+                                   void* context,
+                                   SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(prefix);
+    spec.set_prefix(true);
+    if (after_revision >= 0) {
+        spec.set_from_index(after_revision);
+    }
+    return AddStreamWatch(spec, user_callback, context, error);
+}
+
+bool InsSDK::CancelWatch(const std::string& key, SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(key);
+    return CancelStreamWatch(spec, error);
+}
+
+bool InsSDK::CancelWatchPrefix(const std::string& prefix, SDKError* error) {
+    galaxy::ins::WatchRequest spec;
+    spec.set_key(prefix);
+    spec.set_prefix(true);
+    return CancelStreamWatch(spec, error);
+}
+
+std::string InsSDK::PickWatchServer() {
+    int s_no = (int32_t) (members_.size() * rand()/(RAND_MAX+1.0));
+    return members_[s_no];
+}
+
+bool InsSDK::WatchOnce(const galaxy::ins::WatchRequest& request,
+                       galaxy::ins::WatchResponse* response,
+                       SDKError* error) {
+    for (size_t i = 0; i <= members_.size(); i++) {
+        std::string server_id;
+        {
+            MutexLock lock(mu_);
+            if (watch_server_.empty()) {
+                watch_server_ = PickWatchServer();
+            }
+            server_id = watch_server_;
+        }
+        LOG(DEBUG, "watch rpc to %s", server_id.c_str());
+        galaxy::ins::InsNode_Stub *stub;
+        rpc_client_->GetStub(server_id, &stub);
+        boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
+        response->Clear();
+        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::Watch,
+                                           &request, response, 2, 1);
+        if (ok && response->success()) {
+            *error = kOK;
+            return true;
+        }
+        bool redirect = ok && !response->leader_id().empty();
+        {
+            MutexLock lock(mu_);
+            if (watch_server_ == server_id) { //try another member
+                watch_server_ = redirect ? response->leader_id() : "";
+            }
+        }
+        if (!redirect) {
+            LOG(FATAL, "faild to rcp %s", server_id.c_str());
+            ThisThread::Sleep(1000);
+        }
+    }
+    *error = kClusterDown;
+    return false;
+}
+
+bool InsSDK::AddStreamWatch(const galaxy::ins::WatchRequest& spec,
+                            WatchCallback user_callback,
+                            void* context,
+                            SDKError* error) {
+    std::string name = WatchName(spec);
+    galaxy::ins::WatchRequest request(spec);
+    request.set_persistent(true);
+    request.set_session_id(GetSessionID());
+    {
+        MutexLock lock(mu_);
+        stream_specs_[name] = spec;
+        stream_cbs_[name] = user_callback;
+        stream_ctx_[name] = context;
+        if (!is_keep_alive_bg_) {
+            keep_alive_pool_->AddTask(
+                boost::bind(&InsSDK::KeepAliveTask, this)
+            );
+            is_keep_alive_bg_ = true;
+        }
+    }
+    galaxy::ins::WatchResponse response;
+    if (!WatchOnce(request, &response, error)) {
+        MutexLock lock(mu_);
+        stream_specs_.erase(name);
+        stream_cbs_.erase(name);
+        stream_ctx_.erase(name);
+        return false;
+    }
+    {
+        MutexLock lock(mu_);
+        if (!is_poll_bg_) {
+            keep_watch_pool_->AddTask(
+                boost::bind(&InsSDK::PollWatchTask, this)
+            );
+            is_poll_bg_ = true;
+        }
+    }
+    if (response.compacted()) {
+        WatchParam param;
+        param.key = spec.key();
+        param.deleted = false;
+        param.create_revision = 0;
+        param.mod_revision = 0;
+        param.context = context;
+        user_callback(param, kWatchOverflow);
+    }
+    *error = kOK;
+    return true;
+}
+
+bool InsSDK::CancelStreamWatch(const galaxy::ins::WatchRequest& spec,
+                               SDKError* error) {
+    std::string name = WatchName(spec);
+    {
+        MutexLock lock(mu_);
+        stream_specs_.erase(name);
+        stream_cbs_.erase(name);
+        stream_ctx_.erase(name);
+    }
+    galaxy::ins::WatchRequest request(spec);
+    request.set_persistent(true);
+    request.set_cancel(true);
+    request.set_session_id(GetSessionID());
+    galaxy::ins::WatchResponse response;
+    return WatchOnce(request, &response, error);
+}
+
+void InsSDK::RegisterStreamWatches() {
+    std::map<std::string, galaxy::ins::WatchRequest> specs;
+    {
+        MutexLock lock(mu_);
+        stream_id_ = 0;
+        acked_seq_ = 0;
+        specs = stream_specs_;
+    }
+    std::map<std::string, galaxy::ins::WatchRequest>::iterator it;
+    for (it = specs.begin(); it != specs.end(); it++) {
+        galaxy::ins::WatchRequest request(it->second);
+        request.set_persistent(true);
+        request.set_session_id(GetSessionID());
+        galaxy::ins::WatchResponse response;
+        SDKError error;
+        if (!WatchOnce(request, &response, &error)) {
+            LOG(WARNING, "fail to watch %s again", request.key().c_str());
+            continue;
+        }
+        if (response.compacted()) {
+            WatchCallback cb = NULL;
+            WatchParam param;
+            {
+                MutexLock lock(mu_);
+                if (stream_specs_.find(it->first) == stream_specs_.end()) {
+                    continue; //canceled meanwhile
+                }
+                cb = stream_cbs_[it->first];
+                param.context = stream_ctx_[it->first];
+            }
+            param.key = request.key();
+            param.deleted = false;
+            param.create_revision = 0;
+            param.mod_revision = 0;
+            cb(param, kWatchOverflow);
+        }
+    }
+}
+
+void InsSDK::PollWatchTask() {
+    std::string server_id;
+    while (true) {
+        galaxy::ins::PollWatchRequest request;
+        {
+            MutexLock lock(mu_);
+            if (stop_ || stream_specs_.empty()) {
+                is_poll_bg_ = false;
+                return;
+            }
+            request.set_stream_id(stream_id_);
+            request.set_ack_seq(acked_seq_);
+            if (watch_server_.empty()) {
+                watch_server_ = PickWatchServer();
+            }
+            server_id = watch_server_;
+        }
+        request.set_session_id(GetSessionID());
+        galaxy::ins::InsNode_Stub *stub;
+        rpc_client_->GetStub(server_id, &stub);
+        boost::scoped_ptr<galaxy::ins::InsNode_Stub> stub_guard(stub);
+        galaxy::ins::PollWatchResponse response;
+        bool ok = rpc_client_->SendRequest(stub, &InsNode_Stub::PollWatch,
+                                           &request, &response,
+                                           FLAGS_ins_watch_timeout, 1);
+        if (!ok || !response.success()) {
+            bool redirect = ok && !response.leader_id().empty();
+            {
+                MutexLock lock(mu_);
+                if (watch_server_ == server_id) { //the next poll resets there
+                    watch_server_ = redirect ? response.leader_id() : "";
+                }
+            }
+            if (!redirect) {
+                ThisThread::Sleep(1000);
+            }
+            continue;
+        }
+        if (response.reset()) {
+            LOG(INFO, "register persistent watches to %s", server_id.c_str());
+            RegisterStreamWatches();
+            continue;
+        }
+        std::vector<StreamCall> calls;
+        {
+            MutexLock lock(mu_);
+            if (response.stream_id() != stream_id_) {
+                stream_id_ = response.stream_id();
+                acked_seq_ = response.first_seq() - 1;
+            }
+            std::map<std::string, galaxy::ins::WatchRequest>::iterator it;
+            if (response.overflowed()) {
+                LOG(WARNING, "persistent watches dropped changes");
+                for (it = stream_specs_.begin(); it != stream_specs_.end(); it++) {
+                    StreamCall call;
+                    call.cb = stream_cbs_[it->first];
+                    call.param.key = it->second.key();
+                    call.param.deleted = false;
+                    call.param.create_revision = 0;
+                    call.param.mod_revision = 0;
+                    call.param.context = stream_ctx_[it->first];
+                    call.error = kWatchOverflow;
+                    calls.push_back(call);
+                }
+            }
+            for (int i = 0; i < response.events_size(); i++) {
+                int64_t seq = response.first_seq() + i;
+                if (seq <= acked_seq_) {
+                    continue; //seen already, the ack got lost
+                }
+                const galaxy::ins::WatchResponse& event = response.events(i);
+                for (it = stream_specs_.begin(); it != stream_specs_.end(); it++) {
+                    //resume after it if the node forgets the session
+                    it->second.set_from_index(std::max(it->second.from_index(),
+                                                       event.mod_revision()));
+                    if (!WatchCovers(it->second, event.key())) {
+                        continue;
+                    }
+                    StreamCall call;
+                    call.cb = stream_cbs_[it->first];
+                    call.param.key = event.key();
+                    call.param.value = event.value();
+                    call.param.deleted = event.deleted();
+                    call.param.create_revision = event.create_revision();
+                    call.param.mod_revision = event.mod_revision();
+                    call.param.context = stream_ctx_[it->first];
+                    call.error = kOK;
+                    calls.push_back(call);
+                }
+                acked_seq_ = seq;
+            }
+        }
+        for (size_t i = 0; i < calls.size(); i++) {
+            calls[i].cb(calls[i].param, calls[i].error);
+        }
+    }
+}
+
 bool InsSDK::Lock(const std::string& key, SDKError* error) {
     {
         MutexLock lock(mu_);
@@ -859,23 +1721,39 @@ void InsSDK::RegisterSessionTimeout(void (*handle_session_timeout)(void *), void
 
 ScanResult::ScanResult(InsSDK* sdk) : offset_(0),
                                       sdk_(sdk),
-                                      error_(kOK) {
+                                      error_(kOK),
+                                      cursor_id_(0) {
 
 }
 
 ScanResult* InsSDK::Scan(const std::string& start_key, 
                          const std::string& end_key) {
+    return Scan(start_key, end_key, ScanOptions());
+}
+
+ScanResult* InsSDK::Scan(const std::string& start_key, 
+                         const std::string& end_key,
+                         const ScanOptions& options) {
     ScanResult* result =  new ScanResult(this);
-    result->Init(start_key, end_key);
+    result->Init(start_key, end_key, options);
     return result;
 }
 
 void ScanResult::Init(const std::string& start_key,
-                      const std::string& end_key) {
+                      const std::string& end_key,
+                      const ScanOptions& options) {
     assert(sdk_);
     end_key_ =  end_key;
-    sdk_->ScanOnce(start_key, end_key, &buffer_, &error_);
+    options_ = options;
     offset_ = 0;
+    if (options_.as_of && options_.as_of_index < 0) { //every page, one index
+        std::string value;
+        if (!sdk_->GetAsOf(start_key, &options_.as_of_index, &value, &error_)) {
+            return;
+        }
+    }
+    sdk_->ScanOnce(start_key, end_key, &buffer_, &error_,
+                   &cursor_id_, &options_);
 }
 
 bool ScanResult::Done() {
@@ -896,6 +1774,16 @@ const std::string ScanResult::Value() {
     return buffer_[offset_].value;
 }
 
+int64_t ScanResult::CreateRevision() {
+    assert(offset_ < buffer_.size());
+    return buffer_[offset_].create_revision;
+}
+
+int64_t ScanResult::ModRevision() {
+    assert(offset_ < buffer_.size());
+    return buffer_[offset_].mod_revision;
+}
+
 void ScanResult::Next() {
     offset_ ++ ;
     if (offset_ >= buffer_.size() && !buffer_.empty()) {
@@ -903,7 +1791,10 @@ void ScanResult::Next() {
         std::vector<KVPair> empty_v;
         buffer_.swap(empty_v);
         last_key.append(1,'\0');
-        sdk_->ScanOnce(last_key, end_key_, &buffer_, &error_); 
+        //the cursor continues where the last page ended on the same
+        //snapshot, last_key is only used if the server dropped it
+        sdk_->ScanOnce(last_key, end_key_, &buffer_, &error_,
+                       &cursor_id_, &options_);
         offset_ = 0;      
     }
 }
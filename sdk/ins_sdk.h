@@ -21,6 +21,22 @@ namespace galaxy {
 namespace ins {
     class WatchRequest;
     class WatchResponse;
+    class GetRequest;
+    class GetResponse;
+    class PutRequest;
+    class PutResponse;
+    class DelRequest;
+    class DelResponse;
+    class TxnRequest;
+    class TxnResponse;
+    class IncrRequest;
+    class IncrResponse;
+    class DeleteRangeRequest;
+    class DeleteRangeResponse;
+    class ScanRequest;
+    class ScanResponse;
+    class ListChildrenRequest;
+    class ListChildrenResponse;
 }
 }
 
@@ -34,7 +50,45 @@ enum SDKError {
     kNoSuchKey = 2,
     kTimeout = 3,
     kLockFail = 4,
-    kCleanBinlogFail = 5
+    kCleanBinlogFail = 5,
+    kHistoryUnavailable = 6, //as-of index compacted away, or mvcc off
+    kCompareFail = 7, //the condition of a conditional write did not hold
+    kNotANumber = 8, //incr on a value that is not a decimal int64
+    kWatchOverflow = 9 //a persistent watch dropped changes, read again
+};
+
+enum CompareType {
+    kValueEquals = 1,
+    kModRevisionEquals = 2, //-1 matches a missing key
+    kKeyExists = 3,
+    kKeyMissing = 4
+};
+
+// checked against the key when the write is applied, in log order
+struct WriteCondition {
+    CompareType type;
+    std::string value;
+    int64_t mod_revision;
+    WriteCondition() : type(kKeyMissing), mod_revision(-1) {
+    }
+};
+
+struct TxnGuard {
+    std::string key;
+    WriteCondition condition;
+};
+
+enum TxnOpType {
+    kTxnPut = 1,
+    kTxnDelete = 2
+};
+
+struct TxnOp {
+    TxnOpType type;
+    std::string key;
+    std::string value; //only for kTxnPut
+    TxnOp() : type(kTxnPut) {
+    }
 };
 
 struct ClusterNodeInfo {
@@ -45,11 +99,40 @@ struct ClusterNodeInfo {
     int64_t last_log_term;
     int64_t commit_index;
     int64_t last_applied;
+    int64_t cache_hits;
+    int64_t cache_misses;
+    int64_t cache_memory;
+    int64_t notify_count; //watches answered, latencies below from commit
+    int64_t notify_p50_us;
+    int64_t notify_p99_us;
+    int64_t notify_p999_us;
+    int64_t notify_max_us;
 };
 
 struct KVPair {
     std::string key;
     std::string value;
+    int64_t create_revision; //log index that created the key
+    int64_t mod_revision; //log index that changed it last
+    KVPair() : create_revision(0), mod_revision(0) {
+    }
+};
+
+struct ScanOptions {
+    bool keys_only; //values come back empty
+    bool count_only; //only used by Count
+    std::string prefix; //only keys starting with it
+    int64_t max_bytes; //bytes of keys and values per page, 0 for no limit
+    bool skip_locks; //leave lock entries out
+    bool as_of; //read the versions as of as_of_index, needs --mvcc_retention
+    int64_t as_of_index; //-1 for the latest applied index
+    ScanOptions() : keys_only(false),
+                    count_only(false),
+                    max_bytes(0),
+                    skip_locks(false),
+                    as_of(false),
+                    as_of_index(-1) {
+    }
 };
 
 class ScanResult;
@@ -58,6 +141,8 @@ struct WatchParam {
     std::string key;
     std::string value;
     bool deleted;
+    int64_t create_revision;
+    int64_t mod_revision; //the index of the change, watch again after it
     void* context;
 };
 
@@ -72,22 +157,141 @@ public:
     ~InsSDK();
     bool ShowCluster(std::vector<ClusterNodeInfo>* cluster_info);
     bool Put(const std::string& key, const std::string& value, SDKError* error);
+    // the key is deleted once ttl_ms passed, a later put without ttl
+    // keeps it for good
+    bool Put(const std::string& key, const std::string& value,
+             int64_t ttl_ms, SDKError* error);
+    // the key lives as long as the session of this client, the servers
+    // delete it once the session expires
+    bool PutEphemeral(const std::string& key, const std::string& value,
+                      SDKError* error);
     bool Get(const std::string& key, std::string* value, 
              SDKError* error);
+    // revisions are the log indexes that created and last changed key
+    bool Get(const std::string& key, std::string* value,
+             int64_t* create_revision, int64_t* mod_revision,
+             SDKError* error);
+    // value of key as of a log index, -1 reads at the latest applied
+    // index; as_of_index is set to the index actually read. A key with a
+    // ttl is returned as it was written, expired or not
+    bool GetAsOf(const std::string& key,
+                 int64_t* as_of_index,
+                 std::string* value,
+                 SDKError* error);
     bool Delete(const std::string& key, SDKError* error);
+    // removes every key in [start_key, end_key), an empty end_key means
+    // no upper bound; a big range goes in several log entries, each one
+    // atomic, until one finds nothing left
+    bool DeleteRange(const std::string& start_key,
+                     const std::string& end_key,
+                     int64_t* deleted_count,
+                     SDKError* error);
+    bool DeletePrefix(const std::string& prefix,
+                      int64_t* deleted_count,
+                      SDKError* error);
+    // fail with kCompareFail and write nothing unless condition holds;
+    // kTimeout means the write may or may not have been applied
+    bool PutIf(const std::string& key, const std::string& value,
+               const WriteCondition& condition, SDKError* error);
+    bool DeleteIf(const std::string& key, const WriteCondition& condition,
+                  SDKError* error);
+    bool CompareAndSwap(const std::string& key,
+                        const std::string& old_value,
+                        const std::string& new_value,
+                        SDKError* error);
+    // adds delta to the decimal counter at key, a missing key counts
+    // from 0; value is the counter after this add. kTimeout means the add
+    // may or may not have happened, it is never resent
+    bool Increment(const std::string& key, int64_t delta,
+                   int64_t* value, SDKError* error);
+    // reserves count ids in one round, [*first_id, *first_id + count)
+    bool AllocateIds(const std::string& key, int64_t count,
+                     int64_t* first_id, SDKError* error);
+    // one log entry: then_ops if all guards hold, else_ops otherwise,
+    // applied atomically; guards_held tells which branch ran. A Get or
+    // a Scan page sees all of its ops or none, two Gets may fall on
+    // either side of it. kTimeout means it may or may not have applied
+    bool Txn(const std::vector<TxnGuard>& guards,
+             const std::vector<TxnOp>& then_ops,
+             const std::vector<TxnOp>& else_ops,
+             bool* guards_held,
+             SDKError* error);
     ScanResult* Scan(const std::string& start_key, 
                      const std::string& end_key);
+    ScanResult* Scan(const std::string& start_key, 
+                     const std::string& end_key,
+                     const ScanOptions& options);
+    // number of keys in [start_key, end_key) matching the options
+    bool Count(const std::string& start_key,
+               const std::string& end_key,
+               const ScanOptions& options,
+               int64_t* count,
+               SDKError* error);
+    // cursor_id: pass a zero-initialized id to scan on a server-side
+    // snapshot cursor, it is updated with the cursor of the next page
     bool ScanOnce(const std::string& start_key,
                   const std::string& end_key,
                   std::vector<KVPair>* buffer,
-                  SDKError* error);
+                  SDKError* error,
+                  int64_t* cursor_id = NULL,
+                  const ScanOptions* options = NULL);
+    // direct children of parent, key of each pair is the child name
+    bool ListChildren(const std::string& parent,
+                      bool with_values,
+                      std::vector<KVPair>* children,
+                      SDKError* error);
     bool Watch(const std::string& key, 
                WatchCallback user_callback,
                void* context, 
                SDKError* error);
+    // fires on the first change after after_revision, -1 means the key
+    // did not exist; no change is lost between two watches chained this way
+    bool Watch(const std::string& key,
+               int64_t after_revision,
+               WatchCallback user_callback,
+               void* context,
+               SDKError* error);
+    // fires on the first change of any key starting with prefix, or in
+    // [start_key, end_key) with an empty end_key as no upper bound;
+    // after_revision -1 watches from now on, otherwise keys put after it
+    // fire at once. param.key tells which key changed
+    bool WatchPrefix(const std::string& prefix,
+                     int64_t after_revision,
+                     WatchCallback user_callback,
+                     void* context,
+                     SDKError* error);
+    bool WatchRange(const std::string& start_key,
+                    const std::string& end_key,
+                    int64_t after_revision,
+                    WatchCallback user_callback,
+                    void* context,
+                    SDKError* error);
+    // stays armed after it fires: every later change of the key or its
+    // children, or of a key under prefix, calls back until CancelWatch.
+    // The changes of all such watches of the session come back batched
+    // by one long poll; kWatchOverflow tells the changes were too many to
+    // queue, or older than the node keeps, and param.key is the watch
+    bool PersistentWatch(const std::string& key,
+                         int64_t after_revision,
+                         WatchCallback user_callback,
+                         void* context,
+                         SDKError* error);
+    bool PersistentWatchPrefix(const std::string& prefix,
+                               int64_t after_revision,
+                               WatchCallback user_callback,
+                               void* context,
+                               SDKError* error);
+    bool CancelWatch(const std::string& key, SDKError* error);
+    bool CancelWatchPrefix(const std::string& prefix, SDKError* error);
     bool Lock(const std::string& key, SDKError* error); //may block
     bool TryLock(const std::string& key, SDKError *error); //none block
     bool UnLock(const std::string& key, SDKError* error);
+    // dump the store of one node into file_name, consistent as of
+    // applied_index; the file is what ins --ins_restore_from loads and
+    // only shows up once it is complete
+    bool Backup(const std::string& file_name,
+                int64_t* applied_index,
+                SDKError* error);
     bool CleanBinlog(const std::string& server_id,
                      int64_t end_index, 
                      SDKError* error);
@@ -98,11 +302,44 @@ public:
 private:
     void Init(const std::vector<std::string>& members);
     void PrepareServerList(std::vector<std::string>& server_list);
+    // a failed server is no longer tried first
+    void ForgetLeader(const std::string& server_id);
+    bool GetOnce(const galaxy::ins::GetRequest& request,
+                 galaxy::ins::GetResponse* response,
+                 SDKError* error);
+    bool PutOnce(const galaxy::ins::PutRequest& request,
+                 galaxy::ins::PutResponse* response,
+                 SDKError* error);
+    bool DeleteOnce(const galaxy::ins::DelRequest& request,
+                    galaxy::ins::DelResponse* response,
+                    SDKError* error);
+    // sends request to the leader, following redirects; with resend false
+    // a request that may have reached a server is not sent again and fails
+    // with kTimeout, one that never left is tried on the next member
+    template <class Request, class Response, class Method>
+    bool LeaderRequest(Method method, const Request& request,
+                       Response* response, bool resend, SDKError* error);
+    bool DeleteRangeAll(const galaxy::ins::DeleteRangeRequest& request,
+                        int64_t* deleted_count,
+                        SDKError* error);
+    bool DeleteRangeOnce(const galaxy::ins::DeleteRangeRequest& request,
+                         galaxy::ins::DeleteRangeResponse* response,
+                         SDKError* error);
+    bool IncrOnce(const galaxy::ins::IncrRequest& request,
+                  galaxy::ins::IncrResponse* response,
+                  SDKError* error);
+    bool TxnOnce(const galaxy::ins::TxnRequest& request,
+                 galaxy::ins::TxnResponse* response,
+                 SDKError* error);
+    bool ListChildrenOnce(const galaxy::ins::ListChildrenRequest& request,
+                          galaxy::ins::ListChildrenResponse* response,
+                          SDKError* error);
+    bool ScanPage(galaxy::ins::ScanRequest* request,
+                  galaxy::ins::ScanResponse* response,
+                  SDKError* error);
     void KeepAliveTask();
-    void KeepWatchTask(const std::string& key, 
-                       const std::string& old_value,
-                       bool key_exist,
-                       std::string session_id,
+    // spec is the request of the watch, with the session it belongs to
+    void KeepWatchTask(const galaxy::ins::WatchRequest& spec,
                        int64_t watch_id);
     void MakeSessionID();
     void KeepWatchCallback(const galaxy::ins::WatchRequest* request,
@@ -110,7 +347,33 @@ private:
                            bool failed, int error,
                            std::string server_id,
                            int64_t watch_id);
-    void BackupWatchTask(const std::string& key, int64_t watch_id);
+    void BackupWatchTask(galaxy::ins::WatchRequest spec, int64_t watch_id);
+    bool AddWatch(const galaxy::ins::WatchRequest& spec,
+                  WatchCallback user_callback,
+                  void* context,
+                  SDKError* error);
+    // callbacks are kept by it, a prefix or range watch never shares
+    // the name of a key watch
+    static std::string WatchName(const galaxy::ins::WatchRequest& spec);
+    static bool WatchCovers(const galaxy::ins::WatchRequest& spec,
+                            const std::string& key);
+    // a random member, followers serve watches as well as the leader;
+    // members_ never changes, no lock needed
+    std::string PickWatchServer();
+    // registers a persistent watch on watch_server_
+    bool WatchOnce(const galaxy::ins::WatchRequest& request,
+                   galaxy::ins::WatchResponse* response,
+                   SDKError* error);
+    bool AddStreamWatch(const galaxy::ins::WatchRequest& spec,
+                        WatchCallback user_callback,
+                        void* context,
+                        SDKError* error);
+    bool CancelStreamWatch(const galaxy::ins::WatchRequest& spec,
+                           SDKError* error);
+    // one thread polls the changes of every persistent watch
+    void PollWatchTask();
+    // the node forgot the session, e.g. a new leader
+    void RegisterStreamWatches();
     std::string leader_id_;
     std::string session_id_;
     std::vector<std::string> members_;
@@ -129,17 +392,28 @@ private:
     int64_t last_succ_alive_timestamp_;
     int64_t watch_task_id_;
     std::set<int64_t> pending_watches_;
+    //persistent watches by name, from_index is the last change seen
+    std::map<std::string, galaxy::ins::WatchRequest> stream_specs_;
+    std::map<std::string, WatchCallback> stream_cbs_;
+    std::map<std::string, void*> stream_ctx_;
+    bool is_poll_bg_;
+    std::string watch_server_; //the member polled for persistent watches
+    int64_t stream_id_;
+    int64_t acked_seq_;
 };
 
 class ScanResult {
 public:
     ScanResult(InsSDK* sdk);
     void Init(const std::string& start_key,
-              const std::string& end_key);
+              const std::string& end_key,
+              const ScanOptions& options = ScanOptions());
     bool Done();
     SDKError Error();
     const std::string Key();
     const std::string Value();
+    int64_t CreateRevision();
+    int64_t ModRevision();
     void Next();
 private:
     std::vector<KVPair> buffer_;
@@ -147,6 +421,8 @@ private:
     InsSDK* sdk_;
     SDKError error_;
     std::string end_key_;
+    int64_t cursor_id_;
+    ScanOptions options_;
 };
 
 } //namespace sdk
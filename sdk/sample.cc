@@ -24,6 +24,11 @@ void my_watch_cb(const WatchParam& param, SDKError error) {
     }
 }
 
+void my_stream_cb(const WatchParam& param, SDKError error) { //stays armed
+    printf("key: %s, mod_revision: %ld, error code: %d\n",
+           param.key.c_str(), param.mod_revision, static_cast<int>(error));
+}
+
 void on_session_timeout(void* context) {
     (void)context;
     fprintf(stderr, "in session timeout\n");
@@ -33,7 +38,7 @@ void on_session_timeout(void* context) {
 int main(int argc, char* argv[]) {
     std::vector<std::string> members;
     if (argc < 2) {
-        fprintf(stderr, "./sample [read|write]\n");
+        fprintf(stderr, "./sample [read|write|watch|pwatch]\n");
         return 1;
     }
     if (strcmp("write", argv[1]) == 0) {
@@ -95,6 +100,20 @@ int main(int argc, char* argv[]) {
         while (true) {
             sleep(1);
         }
+    } else if(strcmp("pwatch", argv[1]) == 0) {
+        fprintf(stderr, "persistent watch test\n");
+        InsSDK::ParseFlagFromArgs(argc, argv, &members);
+        InsSDK sdk(members);
+        sdk.RegisterSessionTimeout(on_session_timeout, NULL);
+        char key_buf[1024] = {'\0'};
+        SDKError err;
+        for (int i=1; i<=1000; i++) {
+            snprintf(key_buf, sizeof(key_buf), "key_%d", i);
+            sdk.PersistentWatch(key_buf, -1, my_stream_cb, NULL, &err);
+        }
+        while (true) {
+            sleep(1);
+        }
     } 
     return 0;
 }
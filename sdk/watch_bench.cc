@@ -0,0 +1,185 @@
+#include "ins_sdk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include "common/mutex.h"
+#include "common/timer.h"
+#include "storage/latency_histogram.h"
+
+DEFINE_string(bench_mode, "distinct", "same: every watcher on one key, "
+              "distinct: a key each, parent: a parent each, put to a child");
+DEFINE_int32(bench_clients, 10, "sdk clients, each one session; a client "
+             "holds one watch per key, so in same mode watchers are clients");
+DEFINE_int32(bench_watchers, 1000, "watchers in distinct and parent mode");
+DEFINE_int32(bench_writes, 10000, "puts to make");
+DEFINE_int32(bench_rate, 1000, "puts per second, at most");
+DEFINE_string(bench_prefix, "/watch_bench", "keys are put under it");
+DEFINE_int32(bench_drain_ms, 5000, "wait for the last events after the puts");
+
+using namespace galaxy::ins::sdk;
+using galaxy::ins::LatencyHistogram;
+
+// One chained watch; it should see every put with seq = next_seq + k * step
+struct Watcher {
+    InsSDK* sdk;
+    std::string key;
+    int64_t next_seq;
+    int64_t step;
+};
+
+static ins_common::Mutex s_mu;
+static LatencyHistogram s_latency; //put sent to callback, in micros
+static int64_t s_delivered = 0;
+static int64_t s_missed = 0;
+static int64_t s_duplicated = 0;
+static int64_t s_errors = 0;
+
+static void on_watch(const WatchParam& param, SDKError error) {
+    Watcher* watcher = static_cast<Watcher*>(param.context);
+    int64_t now = ins_common::timer::get_micros();
+    long seq = 0;
+    long sent_at = 0;
+    if (error == kOK
+        && sscanf(param.value.c_str(), "%ld:%ld", &seq, &sent_at) == 2) {
+        s_latency.Add(now - sent_at, 1);
+        ins_common::MutexLock lock(&s_mu);
+        s_delivered++;
+        if (seq < watcher->next_seq) {
+            s_duplicated++;
+        } else {
+            s_missed += (seq - watcher->next_seq) / watcher->step;
+            watcher->next_seq = seq + watcher->step;
+        }
+    } else if (error != kOK) {
+        ins_common::MutexLock lock(&s_mu);
+        s_errors++;
+    }
+    SDKError err;
+    if (error == kOK) { //chained, no put between the two is lost
+        watcher->sdk->Watch(watcher->key, param.mod_revision,
+                            on_watch, watcher, &err);
+    } else { //history is gone, watch from now and count the gap as missed
+        watcher->sdk->Watch(watcher->key, on_watch, watcher, &err);
+    }
+}
+
+static std::string KeyOf(const std::string& name, int64_t i) {
+    char buf[64] = {'\0'};
+    snprintf(buf, sizeof(buf), "/%s_%ld", name.c_str(), i);
+    return FLAGS_bench_prefix + buf;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> members;
+    InsSDK::ParseFlagFromArgs(argc, argv, &members);
+    bool same = (FLAGS_bench_mode == "same");
+    bool parent = (FLAGS_bench_mode == "parent");
+    if (!same && !parent && FLAGS_bench_mode != "distinct") {
+        fprintf(stderr, "./watch_bench --bench_mode=[same|distinct|parent]\n");
+        return 1;
+    }
+    if (FLAGS_bench_clients <= 0 || FLAGS_bench_watchers <= 0
+        || FLAGS_bench_writes <= 0 || FLAGS_bench_rate <= 0) {
+        fprintf(stderr, "clients, watchers, writes and rate must be positive\n");
+        return 1;
+    }
+    int64_t watcher_num = same ? FLAGS_bench_clients : FLAGS_bench_watchers;
+    std::vector<InsSDK*> clients;
+    for (int i = 0; i < FLAGS_bench_clients; i++) {
+        clients.push_back(new InsSDK(members));
+    }
+    std::vector<Watcher*> watchers;
+    for (int64_t i = 0; i < watcher_num; i++) {
+        Watcher* watcher = new Watcher();
+        watcher->sdk = clients[i % clients.size()];
+        watcher->key = same ? KeyOf("same", 0)
+                            : KeyOf(parent ? "dir" : "key", i);
+        watcher->next_seq = same ? 0 : i;
+        watcher->step = same ? 1 : watcher_num;
+        watchers.push_back(watcher);
+    }
+    for (size_t i = 0; i < watchers.size(); i++) {
+        SDKError err;
+        if (!watchers[i]->sdk->Watch(watchers[i]->key, on_watch,
+                                     watchers[i], &err)) {
+            fprintf(stderr, "watch %s failed: %d\n",
+                    watchers[i]->key.c_str(), static_cast<int>(err));
+            return 1;
+        }
+    }
+    sleep(1); //let the watches reach the servers
+    fprintf(stderr, "%ld watchers on %d clients, mode %s\n",
+            watcher_num, FLAGS_bench_clients, FLAGS_bench_mode.c_str());
+
+    InsSDK writer(members);
+    int64_t start = ins_common::timer::get_micros();
+    for (int64_t seq = 0; seq < FLAGS_bench_writes; seq++) {
+        int64_t due = start + seq * 1000000 / FLAGS_bench_rate;
+        int64_t now = ins_common::timer::get_micros();
+        if (due > now) {
+            usleep(due - now);
+        }
+        std::string key;
+        if (same) {
+            key = KeyOf("same", 0);
+        } else {
+            key = KeyOf(parent ? "dir" : "key", seq % watcher_num);
+            if (parent) {
+                key += "/child";
+            }
+        }
+        char value[64] = {'\0'};
+        snprintf(value, sizeof(value), "%ld:%ld",
+                 seq, ins_common::timer::get_micros());
+        SDKError err;
+        if (!writer.Put(key, value, &err) || err != kOK) {
+            fprintf(stderr, "put %s failed: %d\n",
+                    key.c_str(), static_cast<int>(err));
+            seq--; //the seq must reach its watchers, put it again
+            sleep(1);
+        }
+    }
+    double elapsed = (ins_common::timer::get_micros() - start) / 1000000.0;
+    usleep(FLAGS_bench_drain_ms * 1000);
+
+    int64_t expected = 0;
+    {
+        ins_common::MutexLock lock(&s_mu);
+        for (size_t i = 0; i < watchers.size(); i++) {
+            const Watcher* watcher = watchers[i];
+            int64_t first = same ? 0 : static_cast<int64_t>(i);
+            if (first < FLAGS_bench_writes) {
+                expected += (FLAGS_bench_writes - first - 1) / watcher->step + 1;
+            }
+            if (watcher->next_seq < FLAGS_bench_writes) { //never came
+                s_missed += (FLAGS_bench_writes - watcher->next_seq - 1)
+                            / watcher->step + 1;
+            }
+        }
+        printf("puts: %d in %.2f s, %.1f/s\n", FLAGS_bench_writes, elapsed,
+               FLAGS_bench_writes / elapsed);
+        printf("events: expected %ld, delivered %ld, missed %ld, "
+               "duplicated %ld, errors %ld\n",
+               expected, s_delivered, s_missed, s_duplicated, s_errors);
+    }
+    printf("put to callback us: p50 %ld, p90 %ld, p99 %ld, p999 %ld, max %ld\n",
+           s_latency.Percentile(50), s_latency.Percentile(90),
+           s_latency.Percentile(99), s_latency.Percentile(99.9),
+           s_latency.Max());
+    std::vector<ClusterNodeInfo> cluster_info;
+    writer.ShowCluster(&cluster_info);
+    for (size_t i = 0; i < cluster_info.size(); i++) {
+        const ClusterNodeInfo& node = cluster_info[i];
+        printf("%s commit to notify us: count %ld, p50 %ld, p99 %ld, "
+               "p999 %ld, max %ld\n",
+               node.server_id.c_str(), node.notify_count, node.notify_p50_us,
+               node.notify_p99_us, node.notify_p999_us, node.notify_max_us);
+    }
+    fflush(stdout);
+    _exit(0); //watches still parked in the sdk threads
+}
@@ -10,14 +10,47 @@ DEFINE_int32(replication_retry_timespan, 2000, "when replication fail, sleep a w
 DEFINE_int32(elect_timeout_min, 150, "mininum timeout to make a new election");
 DEFINE_int32(elect_timeout_max, 300, "maximum timeout to make a new election");
 DEFINE_int64(session_expire_timeout, 6000000, "timeout for session expiration, 6 seconds in default");
+DEFINE_string(ins_store_engine, "leveldb", "engine of the state machine store, leveldb or memory");
+DEFINE_int32(store_checkpoint_interval, 600, "seconds between two snapshots of the memory store");
+DEFINE_int64(read_cache_size, 268435456, "bytes of the hot value cache, 0 to disable");
+DEFINE_int32(read_cache_shards, 16, "shard number of the hot value cache");
+DEFINE_int64(blob_value_threshold, 65536, "put values from this size on are kept in blob files, 0 to disable");
+DEFINE_int64(blob_file_size, 67108864, "size of one blob file");
+DEFINE_int32(blob_rewrite_percent, 50, "cleaned blob files with less live data than this percent are rewritten, 0 to disable");
+DEFINE_string(ins_restore_from, "", "load the store from this backup file on first start");
+DEFINE_int32(apply_batch_max, 500, "maximum log entries applied to the store in one write");
+DEFINE_int64(delete_range_max_keys, 10000, "most keys one delete range removes, clients repeat it for the rest");
+DEFINE_int32(scan_cursor_max_num, 64, "maximum number of open scan cursors");
+DEFINE_int32(scan_cursor_timeout, 30000, "idle scan cursors are dropped after it(ms)");
+DEFINE_int32(backup_max_num, 4, "maximum number of backups running at once");
+DEFINE_int32(backup_timeout, 600000, "idle backups are dropped after it(ms)");
+DEFINE_int64(mvcc_retention, 0, "log entries of key history kept for as-of reads, 0 to disable");
+DEFINE_int32(mvcc_compact_interval, 60, "seconds between two compactions of old versions");
+DEFINE_int32(ttl_reap_interval, 500, "ms between two scans of the leader for expired ttl keys");
+DEFINE_int32(ttl_reap_batch, 1000, "maximum keys expired by one log entry");
+DEFINE_int32(watch_history_size, 100000, "latest changes kept for watches resuming from an index, 0 to disable");
+DEFINE_int64(watch_history_bytes, 67108864, "bytes of the watch history");
+DEFINE_int32(watch_stream_size, 10000, "changes queued per session for persistent watches before the oldest are dropped");
+DEFINE_int32(watch_poll_timeout, 60000, "ms a watch poll waits for changes before it comes back empty");
+DEFINE_int32(watch_shards, 8, "key watch shards, each delivering its changes on its own thread");
 
 //ins_cli only
 DEFINE_string(ins_cmd, "", "the command of inc shell");
 DEFINE_string(ins_key, "key", "");
 DEFINE_string(ins_start_key, "", "start key of scan");
 DEFINE_string(ins_end_key, "", "end key of scan (excluded)");
+DEFINE_string(ins_prefix, "", "only scan keys with this prefix");
+DEFINE_bool(ins_keys_only, false, "scan keys without values");
+DEFINE_bool(ins_skip_locks, false, "leave lock entries out of scan");
+DEFINE_int64(ins_scan_max_bytes, 0, "bytes per scan page, 0 for no limit");
 DEFINE_string(ins_value, "v123", "");
+DEFINE_string(ins_old_value, "", "the value cas expects to replace");
+DEFINE_int64(ins_delta, 1, "what incr adds to the counter");
+DEFINE_int64(ins_ttl_ms, 0, "put keys expire after it(ms), 0 for never");
 DEFINE_int64(ins_rm_binlog_index, 0, "end index of binlog clean operation");
 DEFINE_string(ins_rm_binlog_server_id, "", "servier id of binlog clean operation");
 DEFINE_int32(ins_watch_timeout, 120, "wath timeout(seconds)");
 DEFINE_int32(ins_backup_watch_timeout, 115, "backup watch timeout(seconds)");
+DEFINE_string(ins_backup_file, "ins.dump", "file written by the backup command");
+DEFINE_bool(ins_as_of, false, "get and scan read the history as of ins_as_of_index");
+DEFINE_int64(ins_as_of_index, -1, "log index of as-of reads, -1 for the latest applied");
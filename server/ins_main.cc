@@ -14,6 +14,7 @@
 DECLARE_string(cluster_members);
 DECLARE_int32(ins_port);
 DECLARE_int32(server_id);
+DECLARE_int32(watch_stream_size);
 
 static volatile bool s_quit = false;
 static void SignalIntHandler(int /*sig*/){
@@ -35,6 +36,10 @@ int main(int argc, char* argv[]) {
         LOG(FATAL, "bad server_id: %d", FLAGS_server_id);
         return -1;
     }
+    if (FLAGS_watch_stream_size < 1) { //a stream keeping nothing overflows forever
+        LOG(FATAL, "bad watch_stream_size: %d", FLAGS_watch_stream_size);
+        return -1;
+    }
     std::string server_id = members.at(FLAGS_server_id - 1); //offset -> real endpoint
     galaxy::ins::InsNodeImpl * ins_node = new galaxy::ins::InsNodeImpl(server_id, 
                                                                        members);
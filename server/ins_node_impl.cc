@@ -1,16 +1,33 @@
 #include "ins_node_impl.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <sys/utsname.h>
+#include <algorithm>
+#include <limits>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <gflags/gflags.h>
 #include "common/this_thread.h"
 #include "common/timer.h"
 #include "storage/meta.h"
 #include "storage/binlog.h"
+#include "storage/state_store.h"
+#include "storage/value_cache.h"
+#include "storage/children_index.h"
+#include "storage/expiry_index.h"
+#include "storage/watch_index.h"
+#include "storage/watch_history.h"
+#include "storage/session_ids.h"
+#include "storage/latency_histogram.h"
+#include "storage/blob_store.h"
+#include "storage/dump_file.h"
+#include "storage/history.h"
 
 DECLARE_string(ins_data_dir);
 DECLARE_string(ins_binlog_dir);
@@ -20,12 +37,160 @@ DECLARE_int32(replication_retry_timespan);
 DECLARE_int32(elect_timeout_min);
 DECLARE_int32(elect_timeout_max);
 DECLARE_int64(session_expire_timeout);
+DECLARE_string(ins_store_engine);
+DECLARE_int32(store_checkpoint_interval);
+DECLARE_int64(read_cache_size);
+DECLARE_int32(read_cache_shards);
+DECLARE_int32(scan_cursor_max_num);
+DECLARE_int32(scan_cursor_timeout);
+DECLARE_int32(backup_max_num);
+DECLARE_int32(backup_timeout);
+DECLARE_int32(apply_batch_max);
+DECLARE_int64(delete_range_max_keys);
+DECLARE_string(ins_restore_from);
+DECLARE_int64(blob_value_threshold);
+DECLARE_int64(blob_file_size);
+DECLARE_int32(blob_rewrite_percent);
+DECLARE_int64(mvcc_retention);
+DECLARE_int32(mvcc_compact_interval);
+DECLARE_int32(ttl_reap_interval);
+DECLARE_int32(ttl_reap_batch);
+DECLARE_int32(watch_history_size);
+DECLARE_int64(watch_history_bytes);
+DECLARE_int32(watch_stream_size);
+DECLARE_int32(watch_poll_timeout);
+DECLARE_int32(watch_shards);
 
+//where the applied index lived before the meta keyspace
 const std::string tag_last_applied_index = "#TAG_LAST_APPLIED_INDEX#";
 
 namespace galaxy {
 namespace ins {
 
+// a write at index keeps the create revision of a key that already exists,
+// but not its deadline or owner
+static ValueRevision NextRevision(bool exists, const std::string& old_value,
+                                  int64_t index) {
+    ValueRevision revision;
+    LogOperation op;
+    leveldb::Slice real_value;
+    if (exists) {
+        DecodeStoreValue(old_value, &op, &revision, &real_value);
+    } else {
+        revision.create = index;
+    }
+    revision.mod = index;
+    revision.expire_at = 0;
+    revision.owner.clear();
+    return revision;
+}
+
+// a ttl key stays in the store until the leader reaps it, reads hide it
+static bool PastDeadline(const ValueRevision& revision, int64_t now) {
+    return revision.expire_at > 0 && revision.expire_at <= now;
+}
+
+static void FillWatchResponse(const std::string& watch_key,
+                              const std::string& key,
+                              const std::string& value,
+                              bool deleted,
+                              const ValueRevision& revision,
+                              WatchResponse* response) {
+    response->set_watch_key(watch_key);
+    response->set_key(key);
+    response->set_value(value);
+    response->set_deleted(deleted);
+    response->set_create_revision(revision.create);
+    response->set_mod_revision(revision.mod);
+    response->set_success(true);
+    response->set_leader_id("");
+}
+
+// the index the watcher has seen up to, -1 for none
+static int64_t WatchStartIndex(const WatchRequest* request) {
+    if (request->has_from_index()) {
+        return request->from_index();
+    }
+    return request->has_after_revision() ? request->after_revision() : -1;
+}
+
+// the keys whose changes fire a watch, a key watch also hears its children
+static bool WatchCovers(const WatchRequest* request, const std::string& key) {
+    if (request->prefix()) {
+        return leveldb::Slice(key).starts_with(request->key());
+    }
+    if (request->has_end_key()) {
+        return key >= request->key()
+               && (request->end_key().empty() || key < request->end_key());
+    }
+    if (key == request->key()) {
+        return true;
+    }
+    std::string::size_type tail_index = key.rfind("/");
+    return tail_index != std::string::npos
+           && key.compare(0, tail_index, request->key()) == 0
+           && tail_index == request->key().size();
+}
+
+// a conditional entry carries [compare size][compare][value]
+static void EncodeConditionalValue(const Compare& compare,
+                                   const std::string& value,
+                                   std::string* log_value) {
+    std::string compare_buf;
+    compare.SerializeToString(&compare_buf);
+    int32_t compare_size = compare_buf.size();
+    log_value->assign(reinterpret_cast<const char*>(&compare_size),
+                      sizeof(int32_t));
+    log_value->append(compare_buf);
+    log_value->append(value);
+}
+
+// an ephemeral entry carries [session size][session][value]
+static void EncodeEphemeralValue(const std::string& session_id,
+                                 const std::string& value,
+                                 std::string* log_value) {
+    int32_t session_size = session_id.size();
+    log_value->assign(reinterpret_cast<const char*>(&session_size),
+                      sizeof(int32_t));
+    log_value->append(session_id);
+    log_value->append(value);
+}
+
+static bool DecodeEphemeralValue(const std::string& log_value,
+                                 std::string* session_id,
+                                 std::string* value) {
+    int32_t session_size = 0;
+    if (log_value.size() < sizeof(int32_t)) {
+        return false;
+    }
+    memcpy(&session_size, log_value.data(), sizeof(int32_t));
+    if (session_size <= 0
+        || log_value.size() - sizeof(int32_t) < static_cast<size_t>(session_size)) {
+        return false;
+    }
+    session_id->assign(log_value, sizeof(int32_t), session_size);
+    value->assign(log_value, sizeof(int32_t) + session_size, std::string::npos);
+    return true;
+}
+
+static bool DecodeConditionalValue(const std::string& log_value,
+                                   Compare* compare,
+                                   std::string* value) {
+    int32_t compare_size = 0;
+    if (log_value.size() < sizeof(int32_t)) {
+        return false;
+    }
+    memcpy(&compare_size, log_value.data(), sizeof(int32_t));
+    if (compare_size < 0
+        || log_value.size() - sizeof(int32_t) < static_cast<size_t>(compare_size)
+        || !compare->ParseFromArray(log_value.data() + sizeof(int32_t),
+                                    compare_size)) {
+        return false;
+    }
+    value->assign(log_value, sizeof(int32_t) + compare_size, std::string::npos);
+    return true;
+}
+
 InsNodeImpl::InsNodeImpl (std::string& server_id,
                           const std::vector<std::string>& members
                           ) : stop_(false),
@@ -39,9 +204,26 @@ InsNodeImpl::InsNodeImpl (std::string& server_id,
                               heartbeat_read_timestamp_(0),
                               in_safe_mode_(true),
                               server_start_timestamp_(0),
+                              leader_start_timestamp_(0),
+                              event_trigger_(1),
                               commit_index_(-1),
                               last_applied_index_(-1),
-                              single_node_mode_(false){
+                              watch_index_(NULL),
+                              watch_history_(NULL),
+                              stream_index_(NULL),
+                              session_ids_(NULL),
+                              notify_latency_(NULL),
+                              next_watch_id_(0),
+                              single_node_mode_(false),
+                              durable_applied_index_(-1),
+                              store_checkpointer_(1),
+                              read_cache_(NULL),
+                              children_index_(NULL),
+                              expiry_index_(NULL),
+                              reap_index_(-1),
+                              blob_store_(NULL),
+                              next_cursor_id_(0),
+                              history_floor_(-1) {
     srand(time(NULL));
     replication_cond_ = new CondVar(&mu_);
     commit_cond_ = new CondVar(&mu_);
@@ -73,24 +255,47 @@ InsNodeImpl::InsNodeImpl (std::string& server_id,
     boost::replace_all(sub_dir, ":", "_");
     
     meta_ = new Meta(FLAGS_ins_data_dir + "/" + sub_dir);
-    binlogger_ = new BinLogger(FLAGS_ins_binlog_dir + "/" + sub_dir);
+    blob_store_ = new BlobStore(FLAGS_ins_binlog_dir + "/" + sub_dir + "/blob",
+                                FLAGS_blob_value_threshold,
+                                FLAGS_blob_file_size,
+                                FLAGS_blob_rewrite_percent);
+    binlogger_ = new BinLogger(FLAGS_ins_binlog_dir + "/" + sub_dir,
+                               blob_store_);
     current_term_ = meta_->ReadCurrentTerm();
     meta_->ReadVotedFor(voted_for_);
     
     std::string data_store_path = FLAGS_ins_data_dir + "/" 
                                   + sub_dir + "/store" ;
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::Status status = leveldb::DB::Open(options, 
-                                               data_store_path, &data_store_);
-    assert(status.ok());
+    data_store_ = StateStore::Open(FLAGS_ins_store_engine, data_store_path);
+    MigrateMetaKeys();
+    if (!FLAGS_ins_restore_from.empty()) {
+        RestoreStore(FLAGS_ins_restore_from);
+    }
     std::string tag_value;
-    status = data_store_->Get(leveldb::ReadOptions(),
-                              tag_last_applied_index,
-                              &tag_value);
+    leveldb::Status status = data_store_->Get(meta_last_applied_index, &tag_value);
     if (status.ok()) {
         last_applied_index_ =  BinLogger::StringToInt(tag_value);
     }
+    durable_applied_index_ = last_applied_index_;
+    InitHistory();
+    CountBlobRefs();
+    watch_history_ = new WatchHistory(FLAGS_watch_history_size,
+                                      FLAGS_watch_history_bytes,
+                                      last_applied_index_);
+    if (FLAGS_read_cache_size > 0) {
+        read_cache_ = new ValueCache(FLAGS_read_cache_size,
+                                     FLAGS_read_cache_shards);
+    }
+    children_index_ = new ChildrenIndex();
+    expiry_index_ = new ExpiryIndex();
+    watch_index_ = new WatchIndex();
+    stream_index_ = new WatchIndex();
+    session_ids_ = new SessionIds();
+    notify_latency_ = new LatencyHistogram();
+    for (int32_t i = 0; i < std::max(FLAGS_watch_shards, 1); i++) {
+        watch_shards_.push_back(new WatchShard());
+    }
+    RebuildKeyIndexes();
     server_start_timestamp_ = ins_common::timer::get_micros();
     committer_.AddTask(boost::bind(&InsNodeImpl::CommitIndexObserv, this));
     MutexLock lock(&mu_);
@@ -98,6 +303,20 @@ InsNodeImpl::InsNodeImpl (std::string& server_id,
     session_checker_.AddTask( 
         boost::bind(&InsNodeImpl::RemoveExpiredSessions, this)
     );
+    store_checkpointer_.DelayTask(FLAGS_store_checkpoint_interval * 1000,
+        boost::bind(&InsNodeImpl::CheckpointStore, this)
+    );
+    session_checker_.DelayTask(1000,
+        boost::bind(&InsNodeImpl::RemoveExpiredCursors, this)
+    );
+    session_checker_.DelayTask(FLAGS_ttl_reap_interval,
+        boost::bind(&InsNodeImpl::ReapExpiredKeys, this)
+    );
+    if (FLAGS_mvcc_retention > 0) {
+        store_checkpointer_.DelayTask(FLAGS_mvcc_compact_interval * 1000,
+            boost::bind(&InsNodeImpl::CompactHistory, this)
+        );
+    }
 }
 
 InsNodeImpl::~InsNodeImpl() {
@@ -113,12 +332,45 @@ InsNodeImpl::~InsNodeImpl() {
     heart_beat_pool_.Stop(true);
     session_checker_.Stop(true);
     event_trigger_.Stop(true);
+    for (size_t i = 0; i < watch_shards_.size(); i++) {
+        watch_shards_[i]->lane.Stop(true);
+    }
     binlog_cleaner_.Stop(true);
+    store_checkpointer_.Stop(true);
+    {
+        MutexLock lock(&cursors_mu_);
+        std::map<int64_t, ScanCursor>::iterator it = scan_cursors_.begin();
+        for (; it != scan_cursors_.end(); it++) {
+            delete it->second.it;
+        }
+        scan_cursors_.clear();
+        for (it = backup_cursors_.begin(); it != backup_cursors_.end(); it++) {
+            delete it->second.it;
+        }
+        backup_cursors_.clear();
+    }
+    //the lanes stopped above, nothing touches these any more
+    for (size_t i = watch_shards_.size(); i > 0; i--) {
+        delete watch_shards_[i - 1];
+    }
+    watch_shards_.clear();
+    delete notify_latency_;
+    delete session_ids_;
+    delete stream_index_;
+    delete watch_index_;
+    delete expiry_index_;
+    delete children_index_;
+    delete read_cache_;
+    delete watch_history_;
+    delete data_store_;
     {
         MutexLock lock(&mu_);
-        delete meta_;
         delete binlogger_;
+        delete blob_store_;
+        delete meta_;
     }
+    delete commit_cond_;
+    delete replication_cond_;
 }
 
 int32_t InsNodeImpl::GetRandomTimeout() {
@@ -156,6 +408,20 @@ void InsNodeImpl::ShowStatus(::google::protobuf::RpcController* /*controller*/,
     response->set_last_log_term(last_log_term);
     response->set_commit_index(commit_index_);
     response->set_last_applied(last_applied_index_);
+    if (read_cache_) {
+        int64_t hits = 0;
+        int64_t misses = 0;
+        int64_t memory = 0;
+        read_cache_->GetStats(&hits, &misses, &memory);
+        response->set_cache_hits(hits);
+        response->set_cache_misses(misses);
+        response->set_cache_memory(memory);
+    }
+    response->set_notify_count(notify_latency_->Count());
+    response->set_notify_p50_us(notify_latency_->Percentile(50));
+    response->set_notify_p99_us(notify_latency_->Percentile(99));
+    response->set_notify_p999_us(notify_latency_->Percentile(99.9));
+    response->set_notify_max_us(notify_latency_->Max());
     done->Run();
 }
 
@@ -173,7 +439,8 @@ void InsNodeImpl::TransToFollower(const char* msg, int64_t new_term) {
 void InsNodeImpl::CommitIndexObserv() {
     MutexLock lock(&mu_);
     while (!stop_) {
-        while (!stop_ && commit_index_ <=  last_applied_index_) {
+        while (!stop_ && commit_index_ <=  last_applied_index_
+               && blob_moves_.empty()) {
             LOG(DEBUG, "commit_idx: %ld, last_applied_index: %ld",
                 commit_index_, last_applied_index_);
             commit_cond_->Wait();
@@ -182,104 +449,231 @@ void InsNodeImpl::CommitIndexObserv() {
             return;
         }
         int64_t from_idx = last_applied_index_;
-        int64_t to_idx = commit_index_;
+        //blob moves alone apply no entry
+        int64_t to_idx = std::max(from_idx,
+                                  std::min(commit_index_,
+                                           from_idx + FLAGS_apply_batch_max));
+        int64_t committed_at = ins_common::timer::get_micros();
         bool nop_committed = false;
+        std::vector<BlobMove> blob_moves;
+        blob_moves.swap(blob_moves_);
         mu_.Unlock();
+        StateBatch batch(data_store_);
+        StageBlobMoves(&batch, blob_moves);
+        std::vector<LogEntry> applied; //entries that changed the store
+        std::vector<ValueRevision> revisions; //one per applied entry
+        std::set<int64_t> compare_failed;
+        std::map<int64_t, int64_t> results; //counter of kIncr, count of kDelRange
+        int64_t applied_term = -1;
         for (int64_t i = from_idx + 1; i <= to_idx; i++) {
             LogEntry log_entry;
-            bool slot_ok = binlogger_->ReadSlot(i, &log_entry);
+            std::string blob_ref;
+            bool slot_ok = binlogger_->ReadSlotRef(i, &log_entry, &blob_ref);
             assert(slot_ok);
+            applied_term = log_entry.term;
             leveldb::Status s;
-            std::string type_and_value;
-            bool lock_succ = true;
+            ValueRevision revision;
+            if ((log_entry.op == kPutIf || log_entry.op == kDelIf)
+                && !ApplyCompare(&batch, &log_entry)) {
+                compare_failed.insert(i);
+                continue;
+            }
             switch(log_entry.op) {
                 case kPut:
                 case kLock:
-                    LOG(DEBUG, "add to data_store_, key: %s, value: %s",
-                        log_entry.key.c_str(), log_entry.value.c_str());
-                    type_and_value.append(1, static_cast<char>(log_entry.op));
-                    type_and_value.append(log_entry.value);
-                    s = data_store_->Put(leveldb::WriteOptions(),
-                                         log_entry.key,
-                                         type_and_value);
-                    event_trigger_.AddTask(
-                        boost::bind(&InsNodeImpl::TriggerEventWithParent,
-                                    this,
-                                    log_entry.key, log_entry.value, false)
-                    );
-                    if (log_entry.op == kLock) {
-                        MutexLock lock_sk(&session_locks_mu_);
-                        session_locks_[log_entry.value].insert(log_entry.key);
+                    if (!blob_ref.empty()) { //the store keeps the reference
+                        revision = StagePut(&batch, i, log_entry.op,
+                                            log_entry.key, blob_ref, true);
+                        slot_ok = blob_store_->Read(blob_ref, &log_entry.value);
+                        assert(slot_ok);
+                    } else {
+                        revision = StagePut(&batch, i, log_entry.op,
+                                            log_entry.key, log_entry.value,
+                                            false);
                     }
-                    assert(s.ok());
+                    LOG(DEBUG, "add to data_store_, key: %s, value size: %ld",
+                        log_entry.key.c_str(), log_entry.value.size());
+                    applied.push_back(log_entry);
+                    revisions.push_back(revision);
                     break;
                 case kDel:
                     LOG(INFO, "delete from data_store_, key: %s",
                         log_entry.key.c_str());
-                    s = data_store_->Delete(leveldb::WriteOptions(),
-                                             log_entry.key);
-                    assert(s.ok());
-                    event_trigger_.AddTask(
-                        boost::bind(&InsNodeImpl::TriggerEventWithParent,
-                                    this,
-                                    log_entry.key, log_entry.value, true)
-                    );
+                    revision = StageDelete(&batch, i, log_entry.key);
+                    applied.push_back(log_entry);
+                    revisions.push_back(revision);
+                    break;
+                case kTxn:
+                    if (!ApplyTxn(&batch, i, log_entry, &applied, &revisions)) {
+                        compare_failed.insert(i); //the else branch ran
+                    }
+                    break;
+                case kIncr:
+                    {
+                        int64_t counter = 0;
+                        if (ApplyIncr(&batch, i, &log_entry, &revision,
+                                      &counter)) {
+                            results[i] = counter;
+                            applied.push_back(log_entry);
+                            revisions.push_back(revision);
+                        }
+                    }
+                    break;
+                case kDelRange:
+                    results[i] = ApplyDeleteRange(&batch, i, log_entry,
+                                                  &applied, &revisions);
+                    break;
+                case kPutTtl:
+                    if (log_entry.value.size() < sizeof(int64_t)) {
+                        LOG(WARNING, "broken ttl entry at [%ld]", i);
+                        break;
+                    }
+                    {
+                        int64_t expire_at = BinLogger::StringToInt(
+                            log_entry.value.substr(0, sizeof(int64_t)));
+                        log_entry.op = kPut;
+                        log_entry.value.erase(0, sizeof(int64_t));
+                        revision = StagePut(&batch, i, kPut, log_entry.key,
+                                            log_entry.value, false,
+                                            expire_at);
+                        applied.push_back(log_entry);
+                        revisions.push_back(revision);
+                    }
+                    break;
+                case kExpire:
+                    ApplyExpire(&batch, i, log_entry, &applied, &revisions);
+                    break;
+                case kPutEphemeral:
+                    {
+                        std::string session_id;
+                        std::string value;
+                        if (!DecodeEphemeralValue(log_entry.value, &session_id,
+                                                  &value)) {
+                            LOG(WARNING, "broken ephemeral entry at [%ld]", i);
+                            break;
+                        }
+                        log_entry.op = kPut;
+                        log_entry.value.swap(value);
+                        revision = StagePut(&batch, i, kPut, log_entry.key,
+                                            log_entry.value, false, 0,
+                                            session_id);
+                        applied.push_back(log_entry);
+                        revisions.push_back(revision);
+                    }
+                    break;
+                case kDelEphemeral:
+                    ApplyDelEphemeral(&batch, i, log_entry, &applied,
+                                      &revisions);
                     break;
                 case kNop:
                     LOG(DEBUG, "kNop got, do nothing, key: %s", 
                               log_entry.key.c_str());
                     nop_committed = true;
                     break;
+                case kPutIf:
+                case kDelIf:
+                    break; //rewritten by ApplyCompare
                 case kUnLock:
                     {   
                         std::string key = log_entry.key;
                         std::string old_session = log_entry.value;
                         std::string value;
-                        s = data_store_->Get(leveldb::ReadOptions(), key, &value);
+                        s = batch.Get(key, &value);
                         if (s.ok()) {
-                            std::string cur_session;
+                            leveldb::Slice cur_session;
                             LogOperation op;
-                            ParseValue(value, op, cur_session);
+                            ParseValue(value, &op, &cur_session);
                             if (op == kLock && cur_session == old_session) { //DeleteIf
-                                s = data_store_->Delete(leveldb::WriteOptions(),
-                                                        key);
-                                assert(s.ok());
+                                revision = StageDelete(&batch, i, key);
+                                applied.push_back(log_entry);
+                                revisions.push_back(revision);
                                 LOG(INFO, "unlock on %s", key.c_str());
-                                event_trigger_.AddTask(
-                                  boost::bind(&InsNodeImpl::TriggerEventWithParent,
-                                              this,
-                                              key, old_session, true)
-                                );
                             }
                         }
                     }
                     break;
             }
-            mu_.Lock();
-            if (status_ == kLeader && nop_committed) {
-                in_safe_mode_ = false;
-                LOG(INFO, "Leave safe mode now");
+        }
+        //data and applied index reach the store together
+        batch.Put(meta_last_applied_index, BinLogger::IntToString(to_idx));
+        if (applied_term >= 0) { //a backup names it, the slot may be cleaned
+            batch.Put(meta_last_applied_term,
+                      BinLogger::IntToString(applied_term));
+        }
+        if (read_cache_) { //no reader mixes cached old and stored new values
+            for (size_t j = 0; j < applied.size(); j++) {
+                read_cache_->BeginWrite(applied[j].key);
+            }
+        }
+        leveldb::Status sb = batch.Commit();
+        assert(sb.ok());
+        UnrefBlobs(&blob_unrefs_);
+        std::vector<WatchHistory::Event> changes(applied.size());
+        for (size_t j = 0; j < applied.size(); j++) {
+            const LogEntry& log_entry = applied[j];
+            bool deleted = (log_entry.op == kDel || log_entry.op == kUnLock);
+            if (deleted) {
+                if (read_cache_) {
+                    read_cache_->Erase(log_entry.key);
+                }
+                children_index_->Remove(log_entry.key);
+                expiry_index_->Remove(log_entry.key);
+            } else {
+                if (read_cache_) {
+                    read_cache_->Update(log_entry.key, log_entry.op,
+                                        log_entry.value, revisions[j]);
+                }
+                children_index_->Add(log_entry.key);
+                expiry_index_->Set(log_entry.key, revisions[j].expire_at);
+            }
+            if (log_entry.op == kLock) {
+                MutexLock lock_sk(&session_locks_mu_);
+                session_locks_[log_entry.value].insert(log_entry.key);
             }
+            if (!deleted && !revisions[j].owner.empty()) {
+                MutexLock lock_sk(&session_locks_mu_);
+                session_ephemerals_[revisions[j].owner].insert(log_entry.key);
+            }
+            changes[j].key = log_entry.key;
+            changes[j].value = log_entry.value;
+            changes[j].deleted = deleted;
+            changes[j].revision = revisions[j];
+        }
+        //a stream registered now replays whole entries, see AddStreamWatch
+        watch_history_->AppendBatch(changes);
+        if (read_cache_) {
+            for (size_t j = 0; j < applied.size(); j++) {
+                read_cache_->EndWrite(applied[j].key);
+            }
+        }
+        DispatchWatchEvents(applied, revisions, committed_at);
+        mu_.Lock();
+        if (reap_index_ > from_idx && reap_index_ <= to_idx) {
+            reap_index_ = -1; //the next reap may go
+        }
+        if (status_ == kLeader && nop_committed) {
+            in_safe_mode_ = false;
+            LOG(INFO, "Leave safe mode now");
+        }
+        for (int64_t i = from_idx + 1; i <= to_idx; i++) {
             if (status_ == kLeader && client_ack_.find(i) != client_ack_.end()) {
                 ClientAck& ack = client_ack_[i];
+                bool failed = (compare_failed.find(i) != compare_failed.end());
                 if (ack.response) {
                     ack.response->set_success(true);
+                    ack.response->set_compare_failed(failed);
                     ack.response->set_leader_id("");
                     ack.done->Run(); //client put ok;
                 }
                 if (ack.del_response) {
                     ack.del_response->set_success(true);
+                    ack.del_response->set_compare_failed(failed);
                     ack.del_response->set_leader_id("");
                     ack.done->Run(); //client del ok;   
                 }
                 if (ack.lock_response) {
-                    if (lock_succ) {
-                        ack.lock_response->set_success(true);
-                        ack.lock_response->set_leader_id("");
-                    } else {
-                        ack.lock_response->set_success(false);
-                        ack.lock_response->set_leader_id("");
-                    }
+                    ack.lock_response->set_success(true);
+                    ack.lock_response->set_leader_id("");
                     ack.done->Run(); //client lock ok;   
                 }
                 if (ack.unlock_response) {
@@ -287,18 +681,400 @@ void InsNodeImpl::CommitIndexObserv() {
                     ack.unlock_response->set_leader_id("");
                     ack.done->Run(); //client unlock ok;
                 }
+                if (ack.txn_response) {
+                    ack.txn_response->set_success(true);
+                    ack.txn_response->set_guards_held(!failed);
+                    ack.txn_response->set_leader_id("");
+                    ack.done->Run(); //client txn ok;
+                }
+                if (ack.del_range_response) {
+                    ack.del_range_response->set_success(true);
+                    ack.del_range_response->set_deleted_count(results[i]);
+                    ack.del_range_response->set_leader_id("");
+                    ack.done->Run(); //client delete range ok;
+                }
+                if (ack.incr_response) {
+                    std::map<int64_t, int64_t>::iterator vt = results.find(i);
+                    ack.incr_response->set_success(true);
+                    if (vt != results.end()) {
+                        ack.incr_response->set_value(vt->second);
+                    } else {
+                        ack.incr_response->set_not_a_number(true);
+                    }
+                    ack.incr_response->set_leader_id("");
+                    ack.done->Run(); //client incr ok;
+                }
                 client_ack_.erase(i);
             }
-            last_applied_index_ += 1;
-            leveldb::Status sp = data_store_->Put(leveldb::WriteOptions(),
-                                                  tag_last_applied_index, 
-                                                  BinLogger::IntToString(
-                                                    last_applied_index_));
-            assert(sp.ok());
-            mu_.Unlock();
         }
-        mu_.Lock();
+        last_applied_index_ = to_idx;
+    }
+}
+
+ValueRevision InsNodeImpl::StagePut(StateBatch* batch, int64_t index,
+                                    LogOperation op, const std::string& key,
+                                    const std::string& value, bool is_blob,
+                                    int64_t expire_at,
+                                    const std::string& owner) {
+    std::string old_value;
+    leveldb::Status s = batch->Get(key, &old_value);
+    ValueRevision revision = NextRevision(s.ok(), old_value, index);
+    revision.expire_at = expire_at;
+    revision.owner = owner;
+    std::string type_and_value;
+    EncodeStoreValue(op, is_blob, revision, value, &type_and_value);
+    if (s.ok()) {
+        StageBlobUnref(old_value);
+        if (FLAGS_mvcc_retention > 0) {
+            SeedVersion(batch, key, old_value);
+        }
+    }
+    batch->Put(key, type_and_value);
+    if (is_blob) {
+        blob_store_->Ref(value);
+    }
+    if (FLAGS_mvcc_retention > 0) {
+        batch->Put(VersionKey(key, index), type_and_value);
+        if (is_blob) {
+            blob_store_->Ref(value);
+        }
+    }
+    return revision;
+}
+
+ValueRevision InsNodeImpl::StageDelete(StateBatch* batch, int64_t index,
+                                       const std::string& key) {
+    std::string old_value;
+    if (batch->Get(key, &old_value).ok()) {
+        StageBlobUnref(old_value);
+        if (FLAGS_mvcc_retention > 0) {
+            SeedVersion(batch, key, old_value);
+        }
+    }
+    batch->Delete(key);
+    if (FLAGS_mvcc_retention > 0) { //a tombstone hides older versions
+        batch->Put(VersionKey(key, index), std::string(1, static_cast<char>(kDel)));
+    }
+    ValueRevision revision;
+    revision.mod = index;
+    return revision;
+}
+
+void InsNodeImpl::SeedVersion(StateBatch* batch, const std::string& key,
+                              const std::string& old_value) {
+    LogOperation op;
+    ValueRevision revision;
+    leveldb::Slice real_value;
+    DecodeStoreValue(old_value, &op, &revision, &real_value);
+    {
+        MutexLock lock(&history_mu_);
+        if (revision.mod > history_floor_) { //written with mvcc on, versioned
+            return;
+        }
+    }
+    std::string version_key = VersionKey(key, revision.mod);
+    std::string version_value;
+    if (batch->Get(version_key, &version_value).ok()) { //kept by compaction
+        return;
+    }
+    batch->Put(version_key, old_value);
+    if (BlobStore::IsBlobValue(old_value)) {
+        blob_store_->Ref(real_value);
+    }
+}
+
+void InsNodeImpl::StageBlobUnref(const std::string& old_value) {
+    if (BlobStore::IsBlobValue(old_value)) {
+        leveldb::Slice ref(old_value);
+        ref.remove_prefix(StoreValueHeaderSize(ref));
+        blob_unrefs_.push_back(ref.ToString());
+    }
+}
+
+void InsNodeImpl::UnrefBlobs(std::vector<std::string>* refs) {
+    for (size_t i = 0; i < refs->size(); i++) {
+        blob_store_->Unref((*refs)[i]);
+    }
+    refs->clear();
+}
+
+void InsNodeImpl::StageBlobMoves(StateBatch* batch,
+                                 const std::vector<BlobMove>& moves) {
+    for (size_t i = 0; i < moves.size(); i++) {
+        const BlobMove& move = moves[i];
+        std::string cur_value;
+        leveldb::Slice new_ref(move.new_value);
+        new_ref.remove_prefix(StoreValueHeaderSize(new_ref));
+        if (batch->Get(move.key, &cur_value).ok()
+            && cur_value == move.old_value) {
+            batch->Put(move.key, move.new_value);
+            StageBlobUnref(move.old_value);
+        } else { //overwritten meanwhile, the copy is garbage
+            blob_store_->Unref(new_ref);
+        }
+    }
+}
+
+bool InsNodeImpl::CompareHolds(StateBatch* batch, const std::string& key,
+                               const Compare& compare) {
+    //only the store decides, replicas must agree without session state
+    std::string raw_value;
+    bool exists = batch->Get(key, &raw_value).ok();
+    LogOperation op;
+    ValueRevision revision;
+    leveldb::Slice real_value;
+    ParseValue(raw_value, &op, &real_value, &revision);
+    bool holds = false;
+    switch (compare.target()) {
+        case kCompareExists:
+            holds = (exists == compare.exists());
+            break;
+        case kCompareModRevision:
+            holds = ((exists ? revision.mod : -1) == compare.mod_revision());
+            break;
+        case kCompareValue:
+            if (exists && BlobStore::IsBlobValue(raw_value)) {
+                std::string blob_value;
+                holds = blob_store_->Read(real_value, &blob_value)
+                        && blob_value == compare.value();
+            } else {
+                holds = exists && real_value == leveldb::Slice(compare.value());
+            }
+            break;
+    }
+    return holds;
+}
+
+bool InsNodeImpl::ApplyCompare(StateBatch* batch, LogEntry* log_entry) {
+    Compare compare;
+    std::string value;
+    if (!DecodeConditionalValue(log_entry->value, &compare, &value)) {
+        LOG(WARNING, "broken conditional entry on %s", log_entry->key.c_str());
+        return false;
+    }
+    bool holds = CompareHolds(batch, log_entry->key, compare);
+    if (holds) {
+        log_entry->op = (log_entry->op == kPutIf) ? kPut : kDel;
+        log_entry->value.swap(value);
+    }
+    return holds;
+}
+
+bool InsNodeImpl::ApplyIncr(StateBatch* batch, int64_t index,
+                            LogEntry* log_entry, ValueRevision* revision,
+                            int64_t* counter) {
+    if (log_entry->value.size() != sizeof(int64_t)) {
+        LOG(WARNING, "broken incr entry at [%ld]", index);
+        return false;
+    }
+    int64_t delta = BinLogger::StringToInt(log_entry->value);
+    std::string raw_value;
+    int64_t old_counter = 0; //a missing key counts from 0
+    ValueRevision old_revision;
+    if (batch->Get(log_entry->key, &raw_value).ok()) {
+        LogOperation op;
+        std::string real_value = raw_value;
+        ParseValue(&real_value, &op, &old_revision);
+        if (op != kPut || BlobStore::IsBlobValue(raw_value)
+            || real_value.empty()) {
+            return false;
+        }
+        char* end = NULL;
+        errno = 0;
+        old_counter = strtoll(real_value.c_str(), &end, 10);
+        if (errno != 0 || *end != '\0') {
+            return false;
+        }
+    }
+    if ((delta > 0 && old_counter > std::numeric_limits<int64_t>::max() - delta)
+        || (delta < 0
+            && old_counter < std::numeric_limits<int64_t>::min() - delta)) {
+        return false; //overflow
+    }
+    *counter = old_counter + delta;
+    char buf[32] = {'\0'};
+    snprintf(buf, sizeof(buf), "%ld", *counter);
+    log_entry->op = kPut;
+    log_entry->value = buf; //kept as text, Get and Put work on it
+    //the counter keeps its ttl and its owner session
+    *revision = StagePut(batch, index, kPut, log_entry->key,
+                         log_entry->value, false,
+                         old_revision.expire_at, old_revision.owner);
+    return true;
+}
+
+int64_t InsNodeImpl::ApplyDeleteRange(StateBatch* batch, int64_t index,
+                                      const LogEntry& log_entry,
+                                      std::vector<LogEntry>* applied,
+                                      std::vector<ValueRevision>* revisions) {
+    DeleteRangeRequest range;
+    if (!range.ParseFromString(log_entry.value)) {
+        LOG(WARNING, "broken delete range entry at [%ld]", index);
+        return 0;
+    }
+    std::vector<std::string> keys;
+    batch->ListKeys(range.start_key(), range.end_key(), range.prefix(),
+                    range.limit(), &keys);
+    for (size_t j = 0; j < keys.size(); j++) {
+        std::string raw_value;
+        if (batch->Get(keys[j], &raw_value).ok()) {
+            ForgetSessionKey(keys[j], raw_value);
+        }
+        LogEntry del_entry;
+        del_entry.op = kDel;
+        del_entry.key = keys[j];
+        del_entry.term = log_entry.term;
+        revisions->push_back(StageDelete(batch, index, keys[j]));
+        applied->push_back(del_entry); //each key fires its own watches
+    }
+    LOG(INFO, "delete range at [%ld], [%s, %s) prefix %s, %ld keys", index,
+        range.start_key().c_str(), range.end_key().c_str(),
+        range.prefix().c_str(), keys.size());
+    return keys.size();
+}
+
+void InsNodeImpl::ForgetSessionKey(const std::string& key,
+                                   const std::string& raw_value) {
+    LogOperation op;
+    ValueRevision revision;
+    leveldb::Slice real_value;
+    DecodeStoreValue(raw_value, &op, &revision, &real_value);
+    MutexLock lock_sk(&session_locks_mu_);
+    std::map<std::string, std::set<std::string> >::iterator it;
+    if (op == kLock) {
+        it = session_locks_.find(real_value.ToString());
+        if (it != session_locks_.end()) {
+            it->second.erase(key);
+            if (it->second.empty()) {
+                session_locks_.erase(it);
+            }
+        }
+    }
+    if (!revision.owner.empty()) {
+        it = session_ephemerals_.find(revision.owner);
+        if (it != session_ephemerals_.end()) {
+            it->second.erase(key);
+            if (it->second.empty()) {
+                session_ephemerals_.erase(it);
+            }
+        }
+    }
+}
+
+void InsNodeImpl::ApplyExpire(StateBatch* batch, int64_t index,
+                              const LogEntry& log_entry,
+                              std::vector<LogEntry>* applied,
+                              std::vector<ValueRevision>* revisions) {
+    ExpireEntry expire;
+    if (!expire.ParseFromString(log_entry.value)) {
+        LOG(WARNING, "broken expire entry at [%ld]", index);
+        return;
+    }
+    for (int j = 0; j < expire.keys_size(); j++) {
+        const ExpiredKey& expired = expire.keys(j);
+        std::string raw_value;
+        if (!batch->Get(expired.key(), &raw_value).ok()) {
+            continue;
+        }
+        LogOperation op;
+        ValueRevision revision;
+        leveldb::Slice real_value;
+        DecodeStoreValue(raw_value, &op, &revision, &real_value);
+        if (revision.expire_at != expired.expire_at()) {
+            continue; //put again after the leader saw it expire
+        }
+        LogEntry del_entry;
+        del_entry.op = kDel;
+        del_entry.key = expired.key();
+        del_entry.term = log_entry.term;
+        revisions->push_back(StageDelete(batch, index, expired.key()));
+        applied->push_back(del_entry);
+        LOG(INFO, "key expired: %s", expired.key().c_str());
+    }
+}
+
+void InsNodeImpl::ApplyDelEphemeral(StateBatch* batch, int64_t index,
+                                    const LogEntry& log_entry,
+                                    std::vector<LogEntry>* applied,
+                                    std::vector<ValueRevision>* revisions) {
+    EphemeralEntry ephemeral;
+    if (!ephemeral.ParseFromString(log_entry.value)) {
+        LOG(WARNING, "broken ephemeral delete entry at [%ld]", index);
+        return;
+    }
+    int64_t count = 0;
+    for (int j = 0; j < ephemeral.keys_size(); j++) {
+        const std::string& key = ephemeral.keys(j);
+        std::string raw_value;
+        if (!batch->Get(key, &raw_value).ok()) {
+            continue;
+        }
+        LogOperation op;
+        ValueRevision revision;
+        leveldb::Slice real_value;
+        DecodeStoreValue(raw_value, &op, &revision, &real_value);
+        if (revision.owner != ephemeral.session_id()) {
+            continue; //put again by someone else
+        }
+        LogEntry del_entry;
+        del_entry.op = kDel;
+        del_entry.key = key;
+        del_entry.term = log_entry.term;
+        revisions->push_back(StageDelete(batch, index, key));
+        applied->push_back(del_entry);
+        count++;
+    }
+    {
+        MutexLock lock_sk(&session_locks_mu_);
+        ephemeral_reaps_.erase(ephemeral.session_id());
+        std::map<std::string, std::set<std::string> >::iterator it =
+            session_ephemerals_.find(ephemeral.session_id());
+        if (it != session_ephemerals_.end()) {
+            for (int j = 0; j < ephemeral.keys_size(); j++) {
+                it->second.erase(ephemeral.keys(j));
+            }
+            if (it->second.empty()) {
+                session_ephemerals_.erase(it);
+            }
+        }
+    }
+    LOG(INFO, "session %s gone at [%ld], %ld ephemeral keys deleted",
+        ephemeral.session_id().c_str(), index, count);
+}
+
+bool InsNodeImpl::ApplyTxn(StateBatch* batch, int64_t index,
+                           const LogEntry& log_entry,
+                           std::vector<LogEntry>* applied,
+                           std::vector<ValueRevision>* revisions) {
+    TxnRequest txn;
+    if (!txn.ParseFromString(log_entry.value)) {
+        LOG(WARNING, "broken txn entry at [%ld]", index);
+        return false;
+    }
+    bool guards_held = true;
+    for (int j = 0; guards_held && j < txn.guards_size(); j++) {
+        guards_held = CompareHolds(batch, txn.guards(j).key(),
+                                   txn.guards(j).compare());
     }
+    const ::google::protobuf::RepeatedPtrField<TxnOp>& ops =
+        guards_held ? txn.then_ops() : txn.else_ops();
+    for (int j = 0; j < ops.size(); j++) {
+        LogEntry op_entry;
+        op_entry.op = ops.Get(j).op();
+        op_entry.key = ops.Get(j).key();
+        op_entry.value = ops.Get(j).value();
+        op_entry.term = log_entry.term;
+        if (op_entry.op == kPut) {
+            revisions->push_back(StagePut(batch, index, kPut, op_entry.key,
+                                          op_entry.value, false));
+        } else {
+            revisions->push_back(StageDelete(batch, index, op_entry.key));
+        }
+        applied->push_back(op_entry);
+    }
+    LOG(DEBUG, "txn at [%ld], guards %s, %d ops", index,
+        guards_held ? "held" : "failed", ops.size());
+    return guards_held;
 }
 
 void InsNodeImpl::ForwardKeepAliveCallback(
@@ -371,38 +1147,9 @@ void InsNodeImpl::HeartBeatForReadCallback(
         context->err_count += 1;
     }
     if (context->succ_count > members_.size() / 2) {
-        std::string key = context->request->key();
-        LOG(DEBUG, "client get key: %s", key.c_str());
-        leveldb::Status s;
-        std::string value;
-        s = data_store_->Get(leveldb::ReadOptions(), key, &value);
-        std::string real_value;
-        LogOperation op;
-        ParseValue(value, op, real_value);
-        if (s.ok()) {
-            if (op == kLock) {
-                if (IsExpiredSession(real_value)) {
-                    context->response->set_hit(false);
-                    context->response->set_success(true);
-                    context->response->set_leader_id("");
-                } else{
-                    context->response->set_hit(true);
-                    context->response->set_success(true);
-                    context->response->set_value(real_value);
-                    context->response->set_leader_id("");
-                }
-            } else{
-                context->response->set_hit(true);
-                context->response->set_success(true);
-                //LOG(INFO, "get value: %s", real_value.c_str());
-                context->response->set_value(real_value);
-                context->response->set_leader_id("");
-            }
-        } else {
-            context->response->set_hit(false);
-            context->response->set_success(true);
-            context->response->set_leader_id("");
-        }
+        LOG(DEBUG, "client get key: %s", context->request->key().c_str());
+        FillGetResponse(context->request, last_applied_index_,
+                        context->response);
         context->done->Run();
         context->triggered = true;
         heartbeat_read_timestamp_ = ins_common::timer::get_micros();
@@ -483,6 +1230,8 @@ void InsNodeImpl::TransToLeader() {
     in_safe_mode_ = true;
     status_ = kLeader;
     current_leader_ = self_id_;
+    leader_start_timestamp_ = ins_common::timer::get_micros();
+    reap_index_ = -1; //a reap of an older term may have been dropped
     LOG(INFO, "I win the election, term:%d", current_term_);
     heart_beat_pool_.AddTask(
         boost::bind(&InsNodeImpl::BroadCastHeartBeat, this));
@@ -519,7 +1268,9 @@ void InsNodeImpl::GetLastLogIndexAndTerm(int64_t* last_log_index,
     *last_log_term = -1;
     if (*last_log_index >= 0) {
         LogEntry log_entry;
-        bool slot_ok = binlogger_->ReadSlot(*last_log_index, &log_entry);
+        std::string blob_ref; //only the term is needed
+        bool slot_ok = binlogger_->ReadSlotRef(*last_log_index, &log_entry,
+                                               &blob_ref);
         assert(slot_ok);
         *last_log_term = log_entry.term;
     }
@@ -531,7 +1282,10 @@ void InsNodeImpl::TryToBeLeader() {
         status_ = kLeader;
         current_leader_ =  self_id_;
         in_safe_mode_ = false;
-        commit_index_ = last_applied_index_;
+        //entries behind the last store checkpoint are replayed
+        commit_index_ = std::max(last_applied_index_,
+                                 binlogger_->GetLength() - 1);
+        commit_cond_->Signal();
         current_term_++;
         meta_->WriteCurrentTerm(current_term_);
         return;
@@ -614,8 +1368,10 @@ void InsNodeImpl::AppendEntries(::google::protobuf::RpcController* /*controller*
             int64_t prev_log_term = -1;
             if (request->prev_log_index() >= 0) {
                 LogEntry prev_log_entry;
-                bool slot_ok = binlogger_->ReadSlot(request->prev_log_index(),
-                                                    &prev_log_entry);
+                std::string blob_ref;
+                bool slot_ok = binlogger_->ReadSlotRef(request->prev_log_index(),
+                                                       &prev_log_entry,
+                                                       &blob_ref);
                 assert(slot_ok);
                 prev_log_term = prev_log_entry.term;
             }
@@ -637,7 +1393,15 @@ void InsNodeImpl::AppendEntries(::google::protobuf::RpcController* /*controller*
                     "length: %ld,%ld", 
                     old_length, request->prev_log_index());
             }
-            binlogger_->AppendEntryList(request->entries());
+            if (!binlogger_->AppendEntryList(request->entries())) {
+                response->set_current_term(current_term_);
+                response->set_success(false);
+                response->set_log_length(binlogger_->GetLength());
+                LOG(WARNING, "[AppendEntries] bad entry checksum, "
+                    "prev_log_index: %ld", request->prev_log_index());
+                done->Run();
+                return;
+            }
         }
         int64_t old_commit_index = commit_index_;
         commit_index_ = std::min(binlogger_->GetLength() - 1,
@@ -751,7 +1515,9 @@ void InsNodeImpl::ReplicateLog(std::string follower_id) {
         std::string leader_id = self_id_;
         LogEntry prev_log_entry;
         if (prev_index > -1) {
-            bool slot_ok = binlogger_->ReadSlot(prev_index, &prev_log_entry);
+            std::string blob_ref;
+            bool slot_ok = binlogger_->ReadSlotRef(prev_index, &prev_log_entry,
+                                                   &blob_ref);
             if (!slot_ok) {
                 LOG(FATAL, "bad slot [%ld], can't replicate on %s ", 
                     prev_index, follower_id.c_str());
@@ -785,6 +1551,7 @@ void InsNodeImpl::ReplicateLog(std::string follower_id) {
             entry->set_key(log_entry.key);
             entry->set_value(log_entry.value);
             entry->set_op(log_entry.op);
+            entry->set_checksum(BinLogger::EntryChecksum(log_entry));
             max_term = std::max(max_term, log_entry.term);
         }
         if (has_bad_slot) {
@@ -835,30 +1602,182 @@ void InsNodeImpl::ReplicateLog(std::string follower_id) {
     replicating_.erase(follower_id);
 }
 
-void InsNodeImpl::Get(::google::protobuf::RpcController* /*controller*/,
-                      const ::galaxy::ins::GetRequest* request,
-                      ::galaxy::ins::GetResponse* response,
+void InsNodeImpl::Txn(::google::protobuf::RpcController* /*controller*/,
+                      const ::galaxy::ins::TxnRequest* request,
+                      ::galaxy::ins::TxnResponse* response,
                       ::google::protobuf::Closure* done) {
     MutexLock lock(&mu_);
     if (status_ == kFollower) {
-        response->set_hit(false);
-        response->set_leader_id(current_leader_);
         response->set_success(false);
+        response->set_leader_id(current_leader_);
         done->Run();
         return;
     }
 
     if (status_ == kCandidate) {
-        response->set_hit(false);
-        response->set_leader_id("");
         response->set_success(false);
+        response->set_leader_id("");
         done->Run();
         return;
     }
 
-    if (status_ == kLeader && in_safe_mode_) {
-        LOG(INFO, "leader is still in safe mode");
-        response->set_hit(false);
+    for (int i = 0; i < request->guards_size(); i++) {
+        if (IsReservedKey(request->guards(i).key())) {
+            LOG(WARNING, "reserved key: %s", request->guards(i).key().c_str());
+            response->set_success(false);
+            response->set_leader_id("");
+            done->Run();
+            return;
+        }
+    }
+    for (int branch = 0; branch < 2; branch++) {
+        const ::google::protobuf::RepeatedPtrField<TxnOp>& ops =
+            branch == 0 ? request->then_ops() : request->else_ops();
+        for (int i = 0; i < ops.size(); i++) {
+            if (IsReservedKey(ops.Get(i).key())
+                || (ops.Get(i).op() != kPut && ops.Get(i).op() != kDel)) {
+                LOG(WARNING, "bad txn op on key: %s", ops.Get(i).key().c_str());
+                response->set_success(false);
+                response->set_leader_id("");
+                done->Run();
+                return;
+            }
+        }
+    }
+    LOG(DEBUG, "client want txn, %d guards", request->guards_size());
+    LogEntry log_entry;
+    log_entry.key = "";
+    request->SerializeToString(&log_entry.value); //decided when applied
+    log_entry.term = current_term_;
+    log_entry.op = kTxn;
+    binlogger_->AppendEntry(log_entry);
+    int64_t cur_index = binlogger_->GetLength() - 1;
+    ClientAck& ack = client_ack_[cur_index];
+    ack.done = done;
+    ack.txn_response = response;
+    replication_cond_->Broadcast();
+    if (single_node_mode_) { //single node cluster
+        UpdateCommitIndex(binlogger_->GetLength() - 1);
+    }
+    return;
+}
+
+void InsNodeImpl::DeleteRange(::google::protobuf::RpcController* /*controller*/,
+                              const ::galaxy::ins::DeleteRangeRequest* request,
+                              ::galaxy::ins::DeleteRangeResponse* response,
+                              ::google::protobuf::Closure* done) {
+    MutexLock lock(&mu_);
+    if (request->start_key().empty() && request->end_key().empty()
+        && request->prefix().empty()) {
+        LOG(WARNING, "refuse to delete the whole keyspace");
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
+    if (status_ == kFollower) {
+        response->set_success(false);
+        response->set_leader_id(current_leader_);
+        done->Run();
+        return;
+    }
+
+    if (status_ == kCandidate) {
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
+
+    LOG(INFO, "client want delete range [%s, %s), prefix: %s",
+        request->start_key().c_str(), request->end_key().c_str(),
+        request->prefix().c_str());
+    LogEntry log_entry;
+    log_entry.key = request->start_key();
+    DeleteRangeRequest range(*request);
+    range.set_limit(FLAGS_delete_range_max_keys); //all replicas stop alike
+    range.SerializeToString(&log_entry.value); //keys listed when applied
+    log_entry.term = current_term_;
+    log_entry.op = kDelRange;
+    binlogger_->AppendEntry(log_entry);
+    int64_t cur_index = binlogger_->GetLength() - 1;
+    ClientAck& ack = client_ack_[cur_index];
+    ack.done = done;
+    ack.del_range_response = response;
+    replication_cond_->Broadcast();
+    if (single_node_mode_) { //single node cluster
+        UpdateCommitIndex(binlogger_->GetLength() - 1);
+    }
+    return;
+}
+
+void InsNodeImpl::Incr(::google::protobuf::RpcController* /*controller*/,
+                       const ::galaxy::ins::IncrRequest* request,
+                       ::galaxy::ins::IncrResponse* response,
+                       ::google::protobuf::Closure* done) {
+    MutexLock lock(&mu_);
+    if (IsReservedKey(request->key())) {
+        LOG(WARNING, "reserved key: %s", request->key().c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
+    if (status_ == kFollower) {
+        response->set_success(false);
+        response->set_leader_id(current_leader_);
+        done->Run();
+        return;
+    }
+
+    if (status_ == kCandidate) {
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
+
+    LogEntry log_entry;
+    log_entry.key = request->key();
+    log_entry.value = BinLogger::IntToString(request->delta());
+    log_entry.term = current_term_;
+    log_entry.op = kIncr;
+    binlogger_->AppendEntry(log_entry);
+    int64_t cur_index = binlogger_->GetLength() - 1;
+    ClientAck& ack = client_ack_[cur_index];
+    ack.done = done;
+    ack.incr_response = response;
+    replication_cond_->Broadcast();
+    if (single_node_mode_) { //single node cluster
+        UpdateCommitIndex(binlogger_->GetLength() - 1);
+    }
+    return;
+}
+
+void InsNodeImpl::Get(::google::protobuf::RpcController* /*controller*/,
+                      const ::galaxy::ins::GetRequest* request,
+                      ::galaxy::ins::GetResponse* response,
+                      ::google::protobuf::Closure* done) {
+    MutexLock lock(&mu_);
+    if (status_ == kFollower) {
+        response->set_hit(false);
+        response->set_leader_id(current_leader_);
+        response->set_success(false);
+        done->Run();
+        return;
+    }
+
+    if (status_ == kCandidate) {
+        response->set_hit(false);
+        response->set_leader_id("");
+        response->set_success(false);
+        done->Run();
+        return;
+    }
+
+    if (status_ == kLeader && in_safe_mode_) {
+        LOG(INFO, "leader is still in safe mode");
+        response->set_hit(false);
         response->set_leader_id("");
         response->set_success(false);
         done->Run();
@@ -899,38 +1818,9 @@ void InsNodeImpl::Get(::google::protobuf::RpcController* /*controller*/,
                                      request, response, callback, 2, 1);
         }
     } else {
+        int64_t applied_index = last_applied_index_;
         mu_.Unlock();
-        std::string key = request->key();
-        leveldb::Status s;
-        std::string value;
-        s = data_store_->Get(leveldb::ReadOptions(), key, &value);
-        std::string real_value;
-        LogOperation op;
-        ParseValue(value, op, real_value);
-        if (s.ok()) {
-            if (op == kLock) {
-                if (IsExpiredSession(real_value)) {
-                    response->set_hit(false);
-                    response->set_success(true);
-                    response->set_leader_id("");
-                } else {
-                    response->set_hit(true);
-                    response->set_success(true);
-                    response->set_value(real_value);
-                    response->set_leader_id("");
-                }
-            } else {
-                response->set_hit(true);
-                response->set_success(true);
-                response->set_value(real_value);
-                //LOG(INFO, "get value: %s", real_value.c_str());
-                response->set_leader_id("");
-            }
-        } else {
-            response->set_hit(false);
-            response->set_success(true);
-            response->set_leader_id("");
-        }
+        FillGetResponse(request, applied_index, response);
         done->Run();
         mu_.Lock();
     }
@@ -941,6 +1831,13 @@ void InsNodeImpl::Delete(::google::protobuf::RpcController* /*controller*/,
                         ::galaxy::ins::DelResponse* response,
                         ::google::protobuf::Closure* done) {
     MutexLock lock(&mu_);
+    if (IsReservedKey(request->key())) {
+        LOG(WARNING, "reserved key: %s", request->key().c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
     if (status_ == kFollower) {
         response->set_success(false);
         response->set_leader_id(current_leader_);
@@ -962,6 +1859,10 @@ void InsNodeImpl::Delete(::google::protobuf::RpcController* /*controller*/,
     log_entry.value = "";
     log_entry.term = current_term_;
     log_entry.op = kDel;
+    if (request->has_compare()) {
+        log_entry.op = kDelIf;
+        EncodeConditionalValue(request->compare(), "", &log_entry.value);
+    }
     binlogger_->AppendEntry(log_entry);
     int64_t cur_index = binlogger_->GetLength() - 1;
     ClientAck& ack = client_ack_[cur_index];
@@ -979,6 +1880,13 @@ void InsNodeImpl::Put(::google::protobuf::RpcController* /*controller*/,
                       ::galaxy::ins::PutResponse* response,
                       ::google::protobuf::Closure* done) {
     MutexLock lock(&mu_);
+    if (IsReservedKey(request->key())) {
+        LOG(WARNING, "reserved key: %s", request->key().c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
     if (status_ == kFollower) {
         response->set_success(false);
         response->set_leader_id(current_leader_);
@@ -995,12 +1903,50 @@ void InsNodeImpl::Put(::google::protobuf::RpcController* /*controller*/,
 
     const std::string& key = request->key();
     const std::string& value = request->value();
+    int kinds = (request->has_compare() ? 1 : 0) + (request->ephemeral() ? 1 : 0)
+                + (request->ttl_ms() > 0 ? 1 : 0);
+    if (kinds > 1) { //one entry carries one of them, none is dropped silently
+        LOG(WARNING, "put of %s mixes compare, ephemeral and ttl", key.c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
     LOG(DEBUG, "client want put key :%s", key.c_str());
     LogEntry log_entry;
     log_entry.key = key;
-    log_entry.value = value;
     log_entry.term = current_term_;
-    log_entry.op = kPut;
+    if (request->has_compare()) { //decided when applied
+        log_entry.op = kPutIf;
+        EncodeConditionalValue(request->compare(), value, &log_entry.value);
+    } else if (request->ephemeral()) {
+        if (request->session_id().empty()) {
+            LOG(WARNING, "ephemeral put of %s without session", key.c_str());
+            response->set_success(false);
+            response->set_leader_id("");
+            done->Run();
+            return;
+        }
+        if (IsExpiredSession(request->session_id())) {
+            //only a heartbeat makes a session live, the client retries
+            LOG(WARNING, "ephemeral put of %s by unknown session %s",
+                key.c_str(), request->session_id().c_str());
+            response->set_success(false);
+            response->set_leader_id("");
+            done->Run();
+            return;
+        }
+        log_entry.op = kPutEphemeral;
+        EncodeEphemeralValue(request->session_id(), value, &log_entry.value);
+    } else if (request->ttl_ms() > 0) { //the deadline is the leader's clock
+        log_entry.op = kPutTtl;
+        log_entry.value = BinLogger::IntToString(
+            ins_common::timer::get_micros() + request->ttl_ms() * 1000);
+        log_entry.value.append(value);
+    } else {
+        log_entry.op = kPut;
+        log_entry.value = value;
+    }
     binlogger_->AppendEntry(log_entry);
     int64_t cur_index = binlogger_->GetLength() - 1;
     ClientAck& ack = client_ack_[cur_index];
@@ -1016,11 +1962,12 @@ void InsNodeImpl::Put(::google::protobuf::RpcController* /*controller*/,
 bool InsNodeImpl::LockIsAvailable(const std::string& key,
                                  const std::string& session_id) {
     leveldb::Status s;
-    std::string old_locker_session;
     std::string value;
     LogOperation op;
-    s = data_store_->Get(leveldb::ReadOptions(), key, &value);
-    ParseValue(value, op, old_locker_session);
+    leveldb::Slice real_value;
+    s = data_store_->Get(key, &value);
+    ParseValue(value, &op, &real_value);
+    std::string old_locker_session = real_value.ToString();
     bool lock_is_available = false;
     if (!s.ok()) {
         MutexLock lock(&sessions_mu_);
@@ -1052,6 +1999,13 @@ void InsNodeImpl::Lock(::google::protobuf::RpcController* controller,
                        ::google::protobuf::Closure* done) {
     (void) controller;
     MutexLock lock(&mu_);
+    if (IsReservedKey(request->key())) {
+        LOG(WARNING, "reserved key: %s", request->key().c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
     if (status_ == kFollower) {
         response->set_success(false);
         response->set_leader_id(current_leader_);
@@ -1097,12 +2051,29 @@ void InsNodeImpl::Lock(::google::protobuf::RpcController* controller,
         LOG(INFO, "lock key :%s, session:%s",
                    key.c_str(),
                    session_id.c_str());
+        std::string old_value;
+        leveldb::Status st = data_store_->Get(key, &old_value);
+        //same revision the applier gives this entry later
+        ValueRevision revision = NextRevision(st.ok(), old_value,
+                                              binlogger_->GetLength());
         std::string type_and_value;
-        type_and_value.append(1, static_cast<char>(kLock));
-        type_and_value.append(session_id);
-        leveldb::Status st = data_store_->Put(leveldb::WriteOptions(),
-                                              key, type_and_value);
+        EncodeStoreValue(kLock, false, revision, session_id, &type_and_value);
+        StateBatch batch(data_store_);
+        if (st.ok() && FLAGS_mvcc_retention > 0) {
+            SeedVersion(&batch, key, old_value);
+        }
+        batch.Put(key, type_and_value);
+        st = batch.Commit();
         assert(st.ok());
+        if (BlobStore::IsBlobValue(old_value)) { //the applier sees the lock
+            leveldb::Slice ref(old_value);
+            ref.remove_prefix(StoreValueHeaderSize(ref));
+            blob_store_->Unref(ref);
+        }
+        if (read_cache_) {
+            read_cache_->Update(key, kLock, session_id, revision);
+        }
+        children_index_->Add(key);
         binlogger_->AppendEntry(log_entry);
         int64_t cur_index = binlogger_->GetLength() - 1;
         ClientAck& ack = client_ack_[cur_index];
@@ -1127,6 +2098,7 @@ void InsNodeImpl::Scan(::google::protobuf::RpcController* controller,
                        ::galaxy::ins::ScanResponse* response,
                        ::google::protobuf::Closure* done) {
     (void) controller;
+    int64_t applied_index = -1;
     {
         MutexLock lock(&mu_);
         if (status_ == kFollower) {
@@ -1160,48 +2132,294 @@ void InsNodeImpl::Scan(::google::protobuf::RpcController* controller,
             done->Run();
             return;
         }
+        applied_index = last_applied_index_;
+    }
+    if (request->has_as_of_index()) {
+        ScanHistory(request, applied_index, response);
+        done->Run();
+        return;
     }
 
-    std::string start_key = request->start_key();
-    std::string end_key = request->end_key();
+    const std::string& start_key = request->start_key();
+    leveldb::Slice end_key(request->end_key());
+    if (end_key.empty() || end_key.compare(meta_key_prefix) > 0) {
+        end_key = meta_key_prefix; //never reach the server's own keys
+    }
+    leveldb::Slice prefix(request->prefix());
     int32_t size_limit = request->size_limit();
-    leveldb::Iterator* it = data_store_->NewIterator(leveldb::ReadOptions());
+    int64_t max_bytes = request->max_bytes();
+    bool keys_only = request->keys_only();
+    bool count_only = request->count_only();
+    bool use_cursor = request->use_cursor() && !count_only;
+    leveldb::Iterator* it = NULL;
+    if (use_cursor && request->has_cursor_id()) {
+        it = TakeScanCursor(&scan_cursors_, request->cursor_id(), start_key,
+                            request->end_key());
+    }
+    if (it == NULL) { //new scan, or the cursor is gone: seek again
+        //a page never straddles an apply round, nor a txn in it
+        it = data_store_->NewSnapshotIterator();
+        if (prefix.compare(start_key) > 0) {
+            it->Seek(prefix);
+        } else {
+            it->Seek(start_key);
+        }
+    }
     bool has_more = false;
     int32_t count = 0;
-    for (it->Seek(start_key);
-         it->Valid() && (it->key().ToString() < end_key || end_key.empty());
+    int64_t bytes = 0;
+    int64_t now = ins_common::timer::get_micros();
+    for (;
+         it->Valid() && it->key().compare(end_key) < 0;
          it->Next()) {
-        if (count > size_limit) {
+        if (!count_only && count > size_limit) {
             has_more = true;
             break;
         }
-        if (it->key().ToString() == tag_last_applied_index) {
-            continue;
+        leveldb::Slice key = it->key();
+        if (!key.starts_with(prefix)) { //keys are sorted, no more matches
+            break;
         }
-        std::string value = it->value().ToString();
-        std::string real_value;
+        leveldb::Slice raw_value = it->value();
+        leveldb::Slice real_value;
         LogOperation op;
-        ParseValue(value, op, real_value);
+        ValueRevision revision;
+        ParseValue(raw_value, &op, &real_value, &revision);
+        if (request->skip_locks() && op == kLock) {
+            continue;
+        }
+        if (PastDeadline(revision, now)) {
+            continue;
+        }
+        std::string blob_value;
+        if (BlobStore::IsBlobValue(raw_value) && !count_only && !keys_only) {
+            if (!blob_store_->Read(real_value, &blob_value)) {
+                LOG(WARNING, "blob of %s is gone", key.ToString().c_str());
+                continue;
+            }
+            real_value = blob_value;
+        }
         if (op == kLock) {
-            if (IsExpiredSession(real_value)) {
-                LOG(INFO, "expired value: %s", real_value.c_str());
+            if (IsExpiredSession(real_value.ToString())) {
+                LOG(INFO, "expired value: %s", real_value.ToString().c_str());
                 continue;
             }
         }
+        if (count_only) {
+            count ++;
+            continue;
+        }
+        if (keys_only) {
+            real_value.clear();
+        }
+        int64_t item_bytes = key.size() + real_value.size();
+        if (max_bytes > 0 && count > 0 && bytes + item_bytes > max_bytes) {
+            has_more = true; //at least one item per page
+            break;
+        }
         galaxy::ins::ScanItem* item = response->add_items();
-        item->set_key(it->key().ToString());
-        item->set_value(real_value);
+        item->set_key(key.data(), key.size());
+        item->set_value(real_value.data(), real_value.size());
+        item->set_create_revision(revision.create);
+        item->set_mod_revision(revision.mod);
+        bytes += item_bytes;
         count ++;
     }
 
     assert(it->status().ok());
-    delete it;
+    if (use_cursor && has_more && response->items_size() > 0) {
+        std::string next_key = response->items(response->items_size() - 1).key();
+        next_key.append(1, '\0');
+        response->set_cursor_id(PutScanCursor(&scan_cursors_,
+                                              FLAGS_scan_cursor_max_num,
+                                              it, next_key,
+                                              request->end_key()));
+    } else {
+        delete it;
+    }
     response->set_has_more(has_more);
+    response->set_count(count);
     response->set_success(true);
     done->Run();
     return;
 }
 
+void InsNodeImpl::Backup(::google::protobuf::RpcController* controller,
+                         const ::galaxy::ins::BackupRequest* request,
+                         ::galaxy::ins::BackupResponse* response,
+                         ::google::protobuf::Closure* done) {
+    (void) controller;
+    leveldb::Iterator* it = NULL;
+    if (request->backup_id() > 0) {
+        it = TakeScanCursor(&backup_cursors_, request->backup_id(),
+                            request->start_key(), "");
+        if (it == NULL) {
+            LOG(WARNING, "backup %ld is gone", request->backup_id());
+            response->set_success(false);
+            done->Run();
+            return;
+        }
+    } else {
+        {
+            //a running backup is never pushed out by scans or other backups
+            MutexLock lock(&cursors_mu_);
+            if (backup_cursors_.size()
+                >= static_cast<size_t>(FLAGS_backup_max_num)) {
+                LOG(WARNING, "too many backups running, refuse a new one");
+                response->set_success(false);
+                done->Run();
+                return;
+            }
+        }
+        //the applied index is in the same snapshot as the data
+        it = data_store_->NewSnapshotIterator();
+        int64_t applied_index = -1;
+        it->Seek(meta_last_applied_index);
+        if (it->Valid() && it->key() == meta_last_applied_index) {
+            applied_index = BinLogger::StringToInt(it->value().ToString());
+        }
+        int64_t applied_term = -1;
+        it->Seek(meta_last_applied_term);
+        if (it->Valid() && it->key() == meta_last_applied_term) {
+            applied_term = BinLogger::StringToInt(it->value().ToString());
+        }
+        LogEntry log_entry;
+        std::string blob_ref;
+        if (applied_term >= 0) {
+            response->set_term(applied_term);
+        } else if (applied_index >= 0 //a store from before the term was kept
+            && binlogger_->ReadSlotRef(applied_index, &log_entry, &blob_ref)) {
+            response->set_term(log_entry.term);
+        } else {
+            MutexLock lock(&mu_);
+            response->set_term(current_term_);
+        }
+        response->set_applied_index(applied_index);
+        LOG(INFO, "start backup at [%ld]", applied_index);
+        it->Seek(request->start_key());
+    }
+    int64_t chunk_size = request->chunk_size() > 0 ? request->chunk_size() : 1;
+    leveldb::Slice meta_start(meta_key_prefix);
+    std::string raw;
+    std::string last_key;
+    int64_t record_count = 0;
+    bool has_more = false;
+    for (; it->Valid() && it->key().compare(meta_start) < 0; it->Next()) {
+        if (static_cast<int64_t>(raw.size()) >= chunk_size) {
+            has_more = true;
+            break;
+        }
+        leveldb::Slice value = it->value();
+        std::string inline_value;
+        if (BlobStore::IsBlobValue(value)) { //blob files are local to a node
+            leveldb::Slice blob_ref;
+            LogOperation op;
+            ValueRevision revision;
+            ParseValue(value, &op, &blob_ref, &revision);
+            std::string blob_value;
+            if (!blob_store_->Read(blob_ref, &blob_value)) {
+                //a dump missing a key would still pass its trailer check
+                LOG(FATAL, "blob of %s is gone, backup aborted",
+                    it->key().ToString().c_str());
+                delete it;
+                response->set_success(false);
+                done->Run();
+                return;
+            }
+            EncodeStoreValue(op, false, revision, blob_value, &inline_value);
+            value = inline_value;
+        }
+        DumpFile::EncodeRecord(it->key(), value, &raw);
+        record_count++;
+        last_key.assign(it->key().data(), it->key().size());
+    }
+    assert(it->status().ok());
+    uint32_t checksum = 0;
+    bool ok = DumpFile::CompressChunk(raw, response->mutable_chunk(), &checksum);
+    assert(ok);
+    response->set_raw_size(raw.size());
+    response->set_checksum(checksum);
+    response->set_record_count(record_count);
+    if (has_more) {
+        std::string next_key = last_key;
+        next_key.append(1, '\0');
+        response->set_next_key(next_key);
+        response->set_backup_id(PutScanCursor(&backup_cursors_,
+                                              FLAGS_backup_max_num,
+                                              it, next_key, ""));
+    } else {
+        delete it;
+    }
+    response->set_has_more(has_more);
+    response->set_success(true);
+    done->Run();
+}
+
+void InsNodeImpl::ListChildren(::google::protobuf::RpcController* controller,
+                               const ::galaxy::ins::ListChildrenRequest* request,
+                               ::galaxy::ins::ListChildrenResponse* response,
+                               ::google::protobuf::Closure* done) {
+    (void) controller;
+    {
+        MutexLock lock(&mu_);
+        if (status_ == kFollower) {
+            response->set_leader_id(current_leader_);
+            response->set_success(false);
+            done->Run();
+            return;
+        }
+
+        if (status_ == kCandidate) {
+            response->set_leader_id("");
+            response->set_success(false);
+            done->Run();
+            return;
+        }
+
+        if (status_ == kLeader && in_safe_mode_) {
+            LOG(INFO, "leader is still in safe mode");
+            response->set_leader_id("");
+            response->set_success(false);
+            done->Run();
+            return;
+        }
+
+        int64_t tm_now = ins_common::timer::get_micros();
+        if (status_ == kLeader &&
+                (tm_now - server_start_timestamp_) < FLAGS_session_expire_timeout) {
+            LOG(INFO, "leader is still in safe mode for list children");
+            response->set_leader_id("");
+            response->set_success(false);
+            done->Run();
+            return;
+        }
+    }
+
+    const std::string& parent = request->parent();
+    std::vector<std::string> names;
+    bool has_more = false;
+    children_index_->List(parent, request->start_after(),
+                          request->size_limit(), &names, &has_more);
+    int64_t now = ins_common::timer::get_micros();
+    for (size_t i = 0; i < names.size(); i++) {
+        galaxy::ins::ChildItem* child = response->add_children();
+        child->set_name(names[i]);
+        if (request->with_values()) {
+            LogOperation op;
+            ValueRevision revision;
+            if (ReadValue(parent + "/" + names[i], &op,
+                          child->mutable_value(), &revision)
+                && ((op == kLock && IsExpiredSession(child->value()))
+                    || PastDeadline(revision, now))) {
+                child->clear_value();
+            }
+        }
+    }
+    response->set_has_more(has_more);
+    response->set_success(true);
+    done->Run();
+}
+
 void InsNodeImpl::KeepAlive(::google::protobuf::RpcController* controller,
                             const ::galaxy::ins::KeepAliveRequest* request,
                             ::galaxy::ins::KeepAliveResponse* response,
@@ -1295,6 +2513,7 @@ void InsNodeImpl::ForwardKeepAlive(const ::galaxy::ins::KeepAliveRequest * reque
 void InsNodeImpl::RemoveExpiredSessions() {
     int64_t cur_term;
     NodeStatus cur_status;
+    int64_t leader_since;
     {
         MutexLock lock(&mu_);
         cur_term = current_term_;
@@ -1302,6 +2521,7 @@ void InsNodeImpl::RemoveExpiredSessions() {
             return;
         }
         cur_status = status_;
+        leader_since = leader_start_timestamp_;
     }
 
     std::vector<std::string> expired_sessions;
@@ -1330,7 +2550,9 @@ void InsNodeImpl::RemoveExpiredSessions() {
         std::vector<std::string>::iterator it = expired_sessions.begin();
         for ( ; it != expired_sessions.end(); it++){
             RemoveEventBySession(*it);
+            session_ids_->Forget(*it);
         }
+        RemoveIdleStreams();
     }
 
     std::vector<std::pair<std::string, std::string> > unlock_keys;
@@ -1351,7 +2573,45 @@ void InsNodeImpl::RemoveExpiredSessions() {
         }      
     }
 
+    //owners no heartbeat vouches for, also the ones of sessions that
+    //expired before this node took over; every node forgets them when
+    //the entry applies, an entry lost with its term is proposed again
+    std::vector<EphemeralEntry> gone_sessions;
+    if (cur_status == kLeader
+        && ins_common::timer::get_micros() - leader_since
+           > FLAGS_session_expire_timeout) {
+        MutexLock lock_sk(&session_locks_mu_);
+        std::map<std::string, std::set<std::string> >::iterator it =
+            session_ephemerals_.begin();
+        while (it != session_ephemerals_.end()) {
+            std::map<std::string, int64_t>::iterator reap =
+                ephemeral_reaps_.find(it->first);
+            if (!IsExpiredSession(it->first)
+                || (reap != ephemeral_reaps_.end()
+                    && reap->second == cur_term)) {
+                it++;
+                continue;
+            }
+            ephemeral_reaps_[it->first] = cur_term;
+            EphemeralEntry ephemeral;
+            ephemeral.set_session_id(it->first);
+            std::set<std::string>::iterator jt = it->second.begin();
+            for (; jt != it->second.end(); jt++) {
+                ephemeral.add_keys(*jt);
+            }
+            gone_sessions.push_back(ephemeral);
+            it++;
+        }
+    }
+
     if (cur_status == kLeader) {
+        for (size_t i = 0; i < gone_sessions.size(); i++) {
+            LogEntry log_entry;
+            log_entry.op = kDelEphemeral;
+            log_entry.term = cur_term;
+            gone_sessions[i].SerializeToString(&log_entry.value);
+            binlogger_->AppendEntry(log_entry);
+        }
         for (size_t i = 0; i < unlock_keys.size(); i++){
             std::string key = unlock_keys[i].first;
             std::string session_id = unlock_keys[i].second;
@@ -1372,19 +2632,517 @@ void InsNodeImpl::RemoveExpiredSessions() {
     );
 }
 
-void InsNodeImpl::ParseValue(const std::string& value,
-                LogOperation& op, 
-                std::string& real_value) {
-    if (value.size() >= 1) {
-        op = static_cast<LogOperation>(value[0]);
-        real_value = value.substr(1);
-    }
-}
-
-bool InsNodeImpl::IsExpiredSession(const std::string& session_id) {
-    bool expired_session = false;
+void InsNodeImpl::ReapExpiredKeys() {
+    std::vector<std::pair<std::string, int64_t> > keys;
     {
-        MutexLock lock(&sessions_mu_);
+        MutexLock lock(&mu_);
+        if (status_ == kLeader && !in_safe_mode_ && reap_index_ < 0) {
+            expiry_index_->Expired(ins_common::timer::get_micros(),
+                                   FLAGS_ttl_reap_batch, &keys);
+        }
+        if (!keys.empty()) {
+            ExpireEntry expire;
+            for (size_t i = 0; i < keys.size(); i++) {
+                ExpiredKey* expired = expire.add_keys();
+                expired->set_key(keys[i].first);
+                expired->set_expire_at(keys[i].second);
+            }
+            LogEntry log_entry;
+            log_entry.op = kExpire;
+            log_entry.term = current_term_;
+            expire.SerializeToString(&log_entry.value);
+            binlogger_->AppendEntry(log_entry);
+            reap_index_ = binlogger_->GetLength() - 1;
+            LOG(INFO, "propose expiring %ld keys at [%ld]",
+                keys.size(), reap_index_);
+            replication_cond_->Broadcast();
+            if (single_node_mode_) { //single node cluster
+                UpdateCommitIndex(binlogger_->GetLength() - 1);
+            }
+        }
+    }
+    session_checker_.DelayTask(FLAGS_ttl_reap_interval,
+        boost::bind(&InsNodeImpl::ReapExpiredKeys, this)
+    );
+}
+
+leveldb::Iterator* InsNodeImpl::TakeScanCursor(
+                        std::map<int64_t, ScanCursor>* cursors,
+                        int64_t cursor_id,
+                        const std::string& start_key,
+                        const std::string& end_key) {
+    MutexLock lock(&cursors_mu_);
+    std::map<int64_t, ScanCursor>::iterator it = cursors->find(cursor_id);
+    if (it == cursors->end()) {
+        return NULL;
+    }
+    if (it->second.next_key != start_key || it->second.end_key != end_key) {
+        LOG(WARNING, "cursor %ld does not match the request", cursor_id);
+        return NULL;
+    }
+    leveldb::Iterator* db_it = it->second.it;
+    cursors->erase(it); //owned by this request until the page is done
+    return db_it;
+}
+
+int64_t InsNodeImpl::PutScanCursor(std::map<int64_t, ScanCursor>* cursors,
+                                   int32_t max_num,
+                                   leveldb::Iterator* it,
+                                   const std::string& next_key,
+                                   const std::string& end_key) {
+    MutexLock lock(&cursors_mu_);
+    if (cursors->size() >= static_cast<size_t>(max_num)
+        && !cursors->empty()) {
+        std::map<int64_t, ScanCursor>::iterator oldest = cursors->begin();
+        std::map<int64_t, ScanCursor>::iterator jt = cursors->begin();
+        for (; jt != cursors->end(); jt++) {
+            if (jt->second.last_access < oldest->second.last_access) {
+                oldest = jt;
+            }
+        }
+        LOG(INFO, "too many cursors, drop cursor %ld", oldest->first);
+        delete oldest->second.it;
+        cursors->erase(oldest);
+    }
+    int64_t cursor_id = ++next_cursor_id_;
+    ScanCursor& cursor = (*cursors)[cursor_id];
+    cursor.it = it;
+    cursor.next_key = next_key;
+    cursor.end_key = end_key;
+    cursor.last_access = ins_common::timer::get_micros();
+    return cursor_id;
+}
+
+static void DropIdleCursors(std::map<int64_t, ScanCursor>* cursors,
+                            int64_t expire_before) {
+    std::map<int64_t, ScanCursor>::iterator it = cursors->begin();
+    while (it != cursors->end()) {
+        if (it->second.last_access < expire_before) {
+            LOG(INFO, "cursor %ld expired", it->first);
+            delete it->second.it;
+            cursors->erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+void InsNodeImpl::RemoveExpiredCursors() {
+    int64_t now = ins_common::timer::get_micros();
+    {
+        MutexLock lock(&cursors_mu_);
+        DropIdleCursors(&scan_cursors_,
+                        now - FLAGS_scan_cursor_timeout * 1000L);
+        DropIdleCursors(&backup_cursors_,
+                        now - FLAGS_backup_timeout * 1000L);
+    }
+    session_checker_.DelayTask(1000,
+        boost::bind(&InsNodeImpl::RemoveExpiredCursors, this)
+    );
+}
+
+void InsNodeImpl::MigrateMetaKeys() {
+    std::string tag_value;
+    leveldb::Status s = data_store_->Get(tag_last_applied_index, &tag_value);
+    if (!s.ok()) {
+        return;
+    }
+    LOG(INFO, "move applied index %s into the meta keyspace",
+        tag_value.c_str());
+    leveldb::WriteBatch batch;
+    batch.Put(meta_last_applied_index, tag_value);
+    batch.Delete(tag_last_applied_index);
+    s = data_store_->Write(&batch);
+    assert(s.ok());
+}
+
+void InsNodeImpl::RestoreStore(const std::string& dump_file) {
+    std::string tag_value;
+    if (binlogger_->GetLength() > 0
+        || data_store_->Get(meta_last_applied_index, &tag_value).ok()) {
+        LOG(FATAL, "refuse to restore %s over existing data", dump_file.c_str());
+        exit(-1);
+    }
+    int64_t start = ins_common::timer::get_micros();
+    DumpReader reader;
+    int64_t applied_index = -1;
+    int64_t term = 0;
+    if (!reader.Open(dump_file, &applied_index, &term)) {
+        LOG(FATAL, "failed to open backup file %s", dump_file.c_str());
+        exit(-1);
+    }
+    int64_t key_count = 0;
+    int64_t raw_bytes = 0;
+    std::string raw;
+    while (reader.NextChunk(&raw)) {
+        leveldb::WriteBatch batch;
+        leveldb::Slice input(raw);
+        leveldb::Slice key;
+        leveldb::Slice value;
+        while (!input.empty()) {
+            if (!DumpFile::DecodeRecord(&input, &key, &value)) {
+                LOG(FATAL, "broken record in %s", dump_file.c_str());
+                exit(-1);
+            }
+            batch.Put(key, value);
+            key_count++;
+        }
+        leveldb::Status s = data_store_->Write(&batch);
+        assert(s.ok());
+        raw_bytes += raw.size();
+    }
+    if (reader.Corrupted()) {
+        LOG(FATAL, "%s is broken or cut off after %ld keys",
+            dump_file.c_str(), key_count);
+        exit(-1);
+    }
+    if (key_count != reader.RecordCount()) {
+        LOG(FATAL, "%s holds %ld keys, its trailer says %ld",
+            dump_file.c_str(), key_count, reader.RecordCount());
+        exit(-1);
+    }
+    //the log goes on right after the restored entry
+    LogEntry log_entry;
+    log_entry.op = kNop;
+    log_entry.term = term;
+    binlogger_->Reset(applied_index, log_entry);
+    leveldb::WriteBatch applied_batch;
+    applied_batch.Put(meta_last_applied_index,
+                      BinLogger::IntToString(applied_index));
+    applied_batch.Put(meta_last_applied_term, BinLogger::IntToString(term));
+    leveldb::Status s = data_store_->Write(&applied_batch);
+    assert(s.ok());
+    bool ok = data_store_->Checkpoint();
+    assert(ok);
+    if (term > current_term_) {
+        current_term_ = term;
+        meta_->WriteCurrentTerm(current_term_);
+    }
+    LOG(INFO, "restore %ld keys(%ld bytes) at [%ld] term %ld, cost %ld ms",
+        key_count, raw_bytes, applied_index, term,
+        (ins_common::timer::get_micros() - start) / 1000);
+}
+
+void InsNodeImpl::RebuildKeyIndexes() {
+    int64_t start = ins_common::timer::get_micros();
+    children_index_->Clear();
+    expiry_index_->Clear();
+    leveldb::Iterator* it = data_store_->NewIterator();
+    leveldb::Slice meta_start(meta_key_prefix);
+    for (it->SeekToFirst();
+         it->Valid() && it->key().compare(meta_start) < 0;
+         it->Next()) {
+        std::string key = it->key().ToString();
+        children_index_->Add(key);
+        LogOperation op;
+        ValueRevision revision;
+        leveldb::Slice real_value;
+        DecodeStoreValue(it->value(), &op, &revision, &real_value);
+        expiry_index_->Set(key, revision.expire_at);
+        if (!revision.owner.empty()) {
+            MutexLock lock_sk(&session_locks_mu_);
+            session_ephemerals_[revision.owner].insert(key);
+        }
+    }
+    assert(it->status().ok());
+    delete it;
+    LOG(INFO, "key indexes rebuilt, %ld keys, %ld with ttl, cost %ld ms",
+        children_index_->Size(), expiry_index_->Size(),
+        (ins_common::timer::get_micros() - start) / 1000);
+}
+
+void InsNodeImpl::InitHistory() {
+    std::string floor_value;
+    bool has_history = data_store_->Get(meta_history_floor, &floor_value).ok();
+    leveldb::WriteBatch batch;
+    int64_t key_count = 0;
+    leveldb::Iterator* it = data_store_->NewIterator();
+    if (FLAGS_mvcc_retention <= 0) {
+        if (has_history) { //stale once writes went on without it
+            for (it->Seek(history_key_prefix);
+                 it->Valid() && it->key().starts_with(history_key_prefix);
+                 it->Next()) {
+                batch.Delete(it->key());
+                key_count++;
+            }
+            batch.Delete(meta_history_floor);
+            LOG(INFO, "mvcc is off, drop %ld versions", key_count);
+        }
+    } else if (has_history) {
+        history_floor_ = BinLogger::StringToInt(floor_value);
+        LOG(INFO, "mvcc history starts at [%ld]", history_floor_);
+    } else { //the store is the first version, seeded on a key's first write
+        int64_t seed_index = last_applied_index_ >= 0 ? last_applied_index_ : 0;
+        batch.Put(meta_history_floor, BinLogger::IntToString(seed_index));
+        history_floor_ = seed_index;
+        LOG(INFO, "mvcc history starts at [%ld]", seed_index);
+    }
+    assert(it->status().ok());
+    delete it;
+    leveldb::Status s = data_store_->Write(&batch);
+    assert(s.ok());
+}
+
+void InsNodeImpl::ParseValue(const leveldb::Slice& value,
+                             LogOperation* op,
+                             leveldb::Slice* real_value,
+                             ValueRevision* revision) {
+    ValueRevision unused;
+    DecodeStoreValue(value, op, revision ? revision : &unused, real_value);
+}
+
+void InsNodeImpl::ParseValue(std::string* value, LogOperation* op,
+                             ValueRevision* revision) {
+    leveldb::Slice real_value;
+    ValueRevision unused;
+    DecodeStoreValue(*value, op, revision ? revision : &unused, &real_value);
+    value->erase(0, value->size() - real_value.size()); //in place
+}
+
+bool InsNodeImpl::ReadValue(const std::string& key,
+                            LogOperation* op,
+                            std::string* real_value,
+                            ValueRevision* revision) {
+    ValueRevision unused;
+    if (!revision) {
+        revision = &unused;
+    }
+    if (read_cache_ && read_cache_->Lookup(key, op, real_value, revision)) {
+        return true;
+    }
+    uint64_t ticket = 0;
+    if (read_cache_) {
+        ticket = read_cache_->BeginFill(key);
+    }
+    leveldb::Status s = data_store_->Get(key, real_value);
+    if (!s.ok()) {
+        return false;
+    }
+    bool is_blob = BlobStore::IsBlobValue(*real_value);
+    ParseValue(real_value, op, revision);
+    if (is_blob) {
+        std::string blob_ref;
+        blob_ref.swap(*real_value);
+        if (!blob_store_->Read(blob_ref, real_value)) {
+            return false;
+        }
+    }
+    if (read_cache_) {
+        read_cache_->Fill(key, ticket, *op, *real_value, *revision);
+    }
+    return true;
+}
+
+void InsNodeImpl::FillGetResponse(const GetRequest* request,
+                                  int64_t applied_index,
+                                  GetResponse* response) {
+    const std::string& key = request->key();
+    LogOperation op;
+    std::string* value = response->mutable_value(); //read straight into it
+    ValueRevision revision;
+    bool hit = false;
+    if (request->has_as_of_index()) {
+        int64_t as_of_index = request->as_of_index() < 0 ? applied_index
+                                                         : request->as_of_index();
+        response->set_as_of_index(as_of_index);
+        if (HistoryAvailable(as_of_index, applied_index)) {
+            //the deadline is judged now, not at as_of_index, so skip it
+            hit = !IsReservedKey(key)
+                  && ReadVersion(key, as_of_index, &op, value, &revision);
+        }
+        if (!HistoryAvailable(as_of_index, applied_index)) {
+            hit = false; //never there, or compacted while reading
+            response->set_history_unavailable(true);
+        }
+    } else {
+        hit = !IsReservedKey(key) && ReadValue(key, &op, value, &revision);
+        if (hit && op == kLock && IsExpiredSession(*value)) {
+            hit = false;
+        }
+        if (hit && PastDeadline(revision, ins_common::timer::get_micros())) {
+            hit = false;
+        }
+    }
+    if (!hit) {
+        response->clear_value();
+    } else {
+        response->set_create_revision(revision.create);
+        response->set_mod_revision(revision.mod);
+    }
+    response->set_hit(hit);
+    response->set_read_index(applied_index);
+    response->set_success(true);
+    response->set_leader_id("");
+}
+
+bool InsNodeImpl::HistoryAvailable(int64_t index, int64_t applied_index) {
+    if (FLAGS_mvcc_retention <= 0 || index > applied_index) {
+        return false;
+    }
+    MutexLock lock(&history_mu_);
+    return history_floor_ >= 0 && index >= history_floor_;
+}
+
+bool InsNodeImpl::ReadAsOf(leveldb::Iterator* it, const std::string& key,
+                           int64_t index, std::string* raw_value) {
+    it->Seek(VersionKey(key, index)); //the newest version not after index
+    if (it->Valid() && it->key().compare(VersionKeyLimit(key)) < 0) {
+        raw_value->assign(it->value().data(), it->value().size());
+        return true;
+    }
+    //no version yet, the store value is the one from before the history
+    it->Seek(key);
+    if (!it->Valid() || it->key() != key) {
+        return false;
+    }
+    LogOperation op;
+    ValueRevision revision;
+    leveldb::Slice real_value;
+    DecodeStoreValue(it->value(), &op, &revision, &real_value);
+    if (revision.mod > index) {
+        return false;
+    }
+    raw_value->assign(it->value().data(), it->value().size());
+    return true;
+}
+
+bool InsNodeImpl::ReadVersion(const std::string& key, int64_t index,
+                              LogOperation* op, std::string* real_value,
+                              ValueRevision* revision) {
+    leveldb::Iterator* it = data_store_->NewSnapshotIterator();
+    bool found = ReadAsOf(it, key, index, real_value);
+    assert(it->status().ok());
+    delete it;
+    if (!found) {
+        return false;
+    }
+    bool is_blob = BlobStore::IsBlobValue(*real_value);
+    ParseValue(real_value, op, revision);
+    if (*op == kDel) {
+        return false;
+    }
+    if (is_blob) {
+        std::string blob_ref;
+        blob_ref.swap(*real_value);
+        if (!blob_store_->Read(blob_ref, real_value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void InsNodeImpl::ScanHistory(const ScanRequest* request,
+                              int64_t applied_index,
+                              ScanResponse* response) {
+    int64_t as_of_index = request->as_of_index() < 0 ? applied_index
+                                                     : request->as_of_index();
+    response->set_as_of_index(as_of_index);
+    response->set_success(true);
+    if (!HistoryAvailable(as_of_index, applied_index)) {
+        response->set_history_unavailable(true);
+        return;
+    }
+    leveldb::Slice end_key(request->end_key());
+    if (end_key.empty() || end_key.compare(meta_key_prefix) > 0) {
+        end_key = meta_key_prefix;
+    }
+    leveldb::Slice prefix(request->prefix());
+    std::string start_key = request->start_key();
+    if (prefix.compare(start_key) > 0) {
+        start_key = prefix.ToString();
+    }
+    int32_t size_limit = request->size_limit();
+    int64_t max_bytes = request->max_bytes();
+    bool keys_only = request->keys_only();
+    bool count_only = request->count_only();
+    bool has_more = false;
+    int32_t count = 0;
+    int64_t bytes = 0;
+    std::string next_key = start_key;
+    leveldb::Iterator* it = data_store_->NewSnapshotIterator();
+    while (true) {
+        //keys never written since the floor are only in the store
+        std::string key;
+        bool has_key = false;
+        it->Seek(next_key);
+        if (it->Valid() && it->key().compare(end_key) < 0) {
+            key = it->key().ToString();
+            has_key = true;
+        }
+        std::string version_of;
+        int64_t index = 0;
+        it->Seek(VersionKey(next_key, std::numeric_limits<int64_t>::max()));
+        if (it->Valid() && ParseVersionKey(it->key(), &version_of, &index)
+            && leveldb::Slice(version_of).compare(end_key) < 0
+            && (!has_key || version_of < key)) {
+            key = version_of;
+            has_key = true;
+        }
+        if (!has_key || !leveldb::Slice(key).starts_with(prefix)) {
+            break;
+        }
+        next_key = key;
+        next_key.append(1, '\0');
+        std::string raw;
+        if (!ReadAsOf(it, key, as_of_index, &raw)) {
+            continue;
+        }
+        leveldb::Slice raw_value(raw);
+        leveldb::Slice real_value;
+        LogOperation op;
+        ValueRevision revision;
+        ParseValue(raw_value, &op, &real_value, &revision);
+        //no ttl filter, a key live at as_of_index may have expired since
+        bool skip = (op == kDel) || (request->skip_locks() && op == kLock);
+        if (!skip && !count_only && count > size_limit) {
+            has_more = true;
+            break;
+        }
+        std::string blob_value;
+        if (!skip && BlobStore::IsBlobValue(raw_value)
+            && !count_only && !keys_only) {
+            if (blob_store_->Read(real_value, &blob_value)) {
+                real_value = blob_value;
+            } else {
+                LOG(WARNING, "blob of %s is gone", key.c_str());
+                skip = true;
+            }
+        }
+        if (!skip && count_only) {
+            count++;
+        } else if (!skip) {
+            if (keys_only) {
+                real_value.clear();
+            }
+            int64_t item_bytes = key.size() + real_value.size();
+            if (max_bytes > 0 && count > 0 && bytes + item_bytes > max_bytes) {
+                has_more = true;
+                break;
+            }
+            galaxy::ins::ScanItem* item = response->add_items();
+            item->set_key(key);
+            item->set_value(real_value.data(), real_value.size());
+            item->set_create_revision(revision.create);
+            item->set_mod_revision(revision.mod);
+            bytes += item_bytes;
+            count++;
+        }
+    }
+    assert(it->status().ok());
+    delete it;
+    if (!HistoryAvailable(as_of_index, applied_index)) { //compacted meanwhile
+        response->clear_items();
+        response->set_history_unavailable(true);
+        return;
+    }
+    response->set_has_more(has_more);
+    response->set_count(count);
+}
+
+bool InsNodeImpl::IsExpiredSession(const std::string& session_id) {
+    bool expired_session = false;
+    {
+        MutexLock lock(&sessions_mu_);
         SessionIDIndex& id_index = sessions_.get<0>();
         SessionIDIndex::iterator old_it = id_index.find(session_id);
         if (old_it == sessions_.end()) { 
@@ -1394,68 +3152,140 @@ bool InsNodeImpl::IsExpiredSession(const std::string& session_id) {
     return expired_session;
 }
 
-void InsNodeImpl::TriggerEventWithParent(const std::string& key,
-                                         const std::string& value,
-                                         bool deleted) {
-    std::string::size_type tail_index = key.rfind("/");
-    std::string parent_key = "";
-    if (tail_index != std::string::npos) {
-        parent_key = key.substr(0, tail_index);
+WatchShard* InsNodeImpl::GetWatchShard(const std::string& watch_key) {
+    size_t h = boost::hash<std::string>()(watch_key);
+    return watch_shards_[h % watch_shards_.size()];
+}
+
+void InsNodeImpl::DispatchWatchEvents(const std::vector<LogEntry>& applied,
+                                      const std::vector<ValueRevision>& revisions,
+                                      int64_t committed_at) {
+    if (applied.empty()) {
+        return;
     }
-    TriggerEvent(key, key, value, deleted);
-    if (!parent_key.empty()) {
-        TriggerEvent(parent_key, key, value, deleted);
+    std::vector<boost::shared_ptr<WatchedChanges> > shard_changes(
+        watch_shards_.size());
+    boost::shared_ptr<WatchedChanges> range_changes(new WatchedChanges());
+    range_changes->reserve(applied.size());
+    for (size_t j = 0; j < applied.size(); j++) {
+        const LogEntry& log_entry = applied[j];
+        WatchedChange change;
+        change.key = log_entry.key;
+        change.value = log_entry.value;
+        change.deleted = (log_entry.op == kDel || log_entry.op == kUnLock);
+        change.revision = revisions[j];
+        change.committed_at = committed_at;
+        std::string::size_type tail_index = log_entry.key.rfind("/");
+        for (int i = 0; i < 2; i++) { //the key itself, then its parent
+            if (i == 0) {
+                change.watch_key = log_entry.key;
+            } else if (tail_index != std::string::npos && tail_index > 0) {
+                change.watch_key = log_entry.key.substr(0, tail_index);
+            } else {
+                break;
+            }
+            size_t h = boost::hash<std::string>()(change.watch_key)
+                       % watch_shards_.size();
+            if (!shard_changes[h]) {
+                shard_changes[h].reset(new WatchedChanges());
+            }
+            shard_changes[h]->push_back(change);
+        }
+        range_changes->push_back(change);
     }
+    for (size_t h = 0; h < shard_changes.size(); h++) {
+        if (shard_changes[h]) {
+            watch_shards_[h]->lane.AddTask(
+                boost::bind(&InsNodeImpl::TriggerShardEvents, this,
+                            watch_shards_[h], shard_changes[h])
+            );
+        }
+    }
+    event_trigger_.AddTask(
+        boost::bind(&InsNodeImpl::TriggerRangeEvents, this, range_changes)
+    );
 }
 
-void InsNodeImpl::TriggerEvent(const std::string& watch_key,
-                               const std::string& key,
-                               const std::string& value,
-                               bool deleted) {
-    MutexLock lock(&watch_mu_);
-    WatchEventKeyIndex& key_idx = watch_events_.get<0>();
-    WatchEventKeyIndex::iterator it_start = key_idx.lower_bound(watch_key);
-    if (it_start != key_idx.end() 
-        && it_start->key == watch_key) {
-        WatchEventKeyIndex::iterator it_end = key_idx.upper_bound(watch_key);
-        int event_count = 0;
-        for (WatchEventKeyIndex::iterator it = it_start;
-             it != it_end; it++) {
-            it->ack->response->set_watch_key(watch_key);
-            it->ack->response->set_key(key);
-            it->ack->response->set_value(value);
-            it->ack->response->set_deleted(deleted);
-            it->ack->response->set_success(true);
-            it->ack->response->set_leader_id("");
-            event_count++;
+void InsNodeImpl::TriggerShardEvents(WatchShard* shard,
+                                     boost::shared_ptr<WatchedChanges> changes) {
+    MutexLock lock(&shard->mu);
+    if (shard->events.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < changes->size(); i++) {
+        const WatchedChange& change = (*changes)[i];
+        int answered = TriggerEvent(change.watch_key, change.key, change.value,
+                                    change.deleted, change.revision);
+        if (answered > 0) {
+            notify_latency_->Add(ins_common::timer::get_micros()
+                                 - change.committed_at, answered);
         }
-        key_idx.erase(it_start, it_end);
-        LOG(INFO, "trigger #%d watch event: %s",
-                  event_count, key.c_str());
-    } else {
+    }
+}
+
+void InsNodeImpl::TriggerRangeEvents(boost::shared_ptr<WatchedChanges> changes) {
+    for (size_t i = 0; i < changes->size(); i++) {
+        const WatchedChange& change = (*changes)[i];
+        int answered = TriggerRangeWatches(change.key, change.value,
+                                           change.deleted, change.revision);
+        if (answered > 0) {
+            notify_latency_->Add(ins_common::timer::get_micros()
+                                 - change.committed_at, answered);
+        }
+        TriggerStreamWatches(change.key, change.value, change.deleted,
+                             change.revision);
+    }
+}
+
+int InsNodeImpl::TriggerEvent(const std::string& watch_key,
+                              const std::string& key,
+                              const std::string& value,
+                              bool deleted,
+                              const ValueRevision& revision) {
+    WatchShard* shard = GetWatchShard(watch_key);
+    shard->mu.AssertHeld();
+    WatchEventKeyIndex& key_idx = shard->events.get<0>();
+    std::pair<WatchEventKeyIndex::iterator,
+              WatchEventKeyIndex::iterator> range =
+        key_idx.equal_range(watch_key);
+    if (range.first == range.second) {
         LOG(DEBUG, "watch list: no such key : %s", key.c_str());
+        return 0;
+    }
+    int event_count = 0;
+    for (WatchEventKeyIndex::iterator it = range.first;
+         it != range.second; ) {
+        if (it->after_index >= revision.mod) { //a follower catching up
+            it++;
+            continue;
+        }
+        FillWatchResponse(watch_key, key, value, deleted, revision,
+                          it->ack->response);
+        event_count++;
+        it = key_idx.erase(it);
     }
+    LOG(INFO, "trigger #%d watch event: %s",
+              event_count, key.c_str());
+    return event_count;
 }
 
-void InsNodeImpl::RemoveEventBySessionAndKey(const std::string& session_id,
+void InsNodeImpl::RemoveEventBySessionAndKey(uint32_t session,
                                              const std::string& key) {
-    watch_mu_.AssertHeld();
-    WatchEventSessionIndex& session_idx = watch_events_.get<1>();
-    WatchEventSessionIndex::iterator it_start = session_idx.lower_bound(session_id);
-    if (it_start != session_idx.end() 
-        && it_start->session_id == session_id) {
-        WatchEventSessionIndex::iterator it_end = 
-              session_idx.upper_bound(session_id);
-        for (WatchEventSessionIndex::iterator it = it_start;
-             it != it_end; ) {
-            if (it->key == key) {
-                 LOG(DEBUG, "remove watch event: %s on %s",
-                     it->key.c_str(), it->session_id.c_str());
-                it->ack->response->set_canceled(true);
-                it = session_idx.erase(it);
-            } else {
-                it++;
-            }
+    WatchShard* shard = GetWatchShard(key);
+    shard->mu.AssertHeld();
+    WatchEventSessionIndex& session_idx = shard->events.get<1>();
+    std::pair<WatchEventSessionIndex::iterator,
+              WatchEventSessionIndex::iterator> range =
+        session_idx.equal_range(session);
+    for (WatchEventSessionIndex::iterator it = range.first;
+         it != range.second; ) {
+        if (it->key == key) {
+            LOG(DEBUG, "remove watch event: %s on #%u",
+                it->key.c_str(), it->session);
+            it->ack->response->set_canceled(true);
+            it = session_idx.erase(it);
+        } else {
+            it++;
         }
     }
 }
@@ -1464,48 +3294,415 @@ void InsNodeImpl::RemoveEventBySessionAndKey(const std::string& session_id,
 void InsNodeImpl::TriggerEventBySessionAndKey(const std::string& session_id,
                                               const std::string& key,
                                               const std::string& value,
-                                              bool deleted) {
-    MutexLock lock(&watch_mu_);
-    WatchEventSessionIndex& session_idx = watch_events_.get<1>();
-    WatchEventSessionIndex::iterator it_start = session_idx.lower_bound(session_id);
-    if (it_start != session_idx.end() 
-        && it_start->session_id == session_id) {
-        WatchEventSessionIndex::iterator it_end = 
-              session_idx.upper_bound(session_id);
-        for (WatchEventSessionIndex::iterator it = it_start;
-             it != it_end; ) {
-            if (it->key == key) {
-                LOG(INFO, "trigger watch event: %s on %s",
-                           it->key.c_str(), it->session_id.c_str());
-                it->ack->response->set_watch_key(key);
-                it->ack->response->set_key(key);
-                it->ack->response->set_value(value);
-                it->ack->response->set_deleted(deleted);
-                it->ack->response->set_success(true);
-                it->ack->response->set_leader_id("");
-                it = session_idx.erase(it);
-            } else {
-                it++;
-            }
+                                              bool deleted,
+                                              const ValueRevision& revision) {
+    uint32_t session = 0;
+    if (!session_ids_->Find(session_id, &session)) {
+        return;
+    }
+    WatchShard* shard = GetWatchShard(key);
+    MutexLock lock(&shard->mu);
+    WatchEventSessionIndex& session_idx = shard->events.get<1>();
+    std::pair<WatchEventSessionIndex::iterator,
+              WatchEventSessionIndex::iterator> range =
+        session_idx.equal_range(session);
+    for (WatchEventSessionIndex::iterator it = range.first;
+         it != range.second; ) {
+        if (it->key == key) {
+            LOG(INFO, "trigger watch event: %s on %s",
+                       it->key.c_str(), session_id.c_str());
+            FillWatchResponse(key, key, value, deleted, revision,
+                              it->ack->response);
+            it = session_idx.erase(it);
+        } else {
+            it++;
         }
     }
 }
 
 void InsNodeImpl::RemoveEventBySession(const std::string& session_id) {
     watch_mu_.AssertHeld();
-    WatchEventSessionIndex& session_idx = watch_events_.get<1>();
-    WatchEventSessionIndex::iterator it_start = session_idx.lower_bound(session_id);
-    if (it_start != session_idx.end() 
-        && it_start->session_id == session_id) {
-        WatchEventSessionIndex::iterator it_end = 
-              session_idx.upper_bound(session_id);
-        for (WatchEventSessionIndex::iterator it = it_start;
-             it != it_end; it++) {
+    uint32_t session = 0;
+    if (!session_ids_->Find(session_id, &session)) {
+        return; //never watched anything
+    }
+    for (size_t i = 0; i < watch_shards_.size(); i++) {
+        MutexLock lock(&watch_shards_[i]->mu);
+        WatchEventSessionIndex& session_idx = watch_shards_[i]->events.get<1>();
+        std::pair<WatchEventSessionIndex::iterator,
+                  WatchEventSessionIndex::iterator> range =
+            session_idx.equal_range(session);
+        for (WatchEventSessionIndex::iterator it = range.first;
+             it != range.second; it++) {
             LOG(DEBUG, "remove watch event: %s on %s",
-                it->key.c_str(), it->session_id.c_str());
+                it->key.c_str(), session_id.c_str());
         }
-        session_idx.erase(it_start, it_end);
+        session_idx.erase(range.first, range.second);
+    }
+    RangeWatchSessionIndex& range_idx = range_watches_.get<1>();
+    std::pair<RangeWatchSessionIndex::iterator,
+              RangeWatchSessionIndex::iterator> range =
+        range_idx.equal_range(session);
+    for (RangeWatchSessionIndex::iterator it = range.first;
+         it != range.second; it++) {
+        watch_index_->Remove(it->id);
     }
+    range_idx.erase(range.first, range.second);
+    RemoveStreamBySession(session);
+}
+
+void InsNodeImpl::AddKeyWatch(const WatchRequest* request,
+                              WatchAck::Ptr ack) {
+    WatchShard* shard = GetWatchShard(request->key());
+    shard->mu.AssertHeld();
+    WatchEvent watch_event;
+    watch_event.key = request->key();
+    watch_event.ack = ack;
+    watch_event.after_index = WatchStartIndex(request);
+    watch_event.session = session_ids_->Intern(request->session_id());
+    RemoveEventBySessionAndKey(watch_event.session, watch_event.key);
+    shard->events.insert(watch_event);
+}
+
+int64_t InsNodeImpl::AddRangeWatch(const WatchRequest* request,
+                                   WatchAck::Ptr ack) {
+    watch_mu_.AssertHeld();
+    uint32_t session = session_ids_->Intern(request->session_id());
+    RangeWatchSessionIndex& session_idx = range_watches_.get<1>();
+    std::pair<RangeWatchSessionIndex::iterator,
+              RangeWatchSessionIndex::iterator> range =
+        session_idx.equal_range(session);
+    for (RangeWatchSessionIndex::iterator it = range.first;
+         it != range.second; ) {
+        if (it->key == request->key() && it->end_key == request->end_key()
+            && it->prefix == request->prefix()) {
+            LOG(DEBUG, "remove range watch: %s on %s",
+                it->key.c_str(), request->session_id().c_str());
+            it->ack->response->set_canceled(true);
+            watch_index_->Remove(it->id);
+            it = session_idx.erase(it);
+        } else {
+            it++;
+        }
+    }
+    RangeWatch watch;
+    watch.id = ++next_watch_id_;
+    watch.key = request->key();
+    watch.end_key = request->end_key();
+    watch.prefix = request->prefix();
+    watch.session = session;
+    watch.after_index = WatchStartIndex(request);
+    watch.ack = ack;
+    range_watches_.insert(watch);
+    if (watch.prefix) {
+        watch_index_->AddPrefix(watch.key, watch.id);
+    } else {
+        watch_index_->AddRange(watch.key, watch.end_key, watch.id);
+    }
+    return watch.id;
+}
+
+bool InsNodeImpl::TriggerRangeWatch(int64_t id,
+                                    const std::string& key,
+                                    const std::string& value,
+                                    bool deleted,
+                                    const ValueRevision& revision) {
+    watch_mu_.AssertHeld();
+    RangeWatchIDIndex& id_idx = range_watches_.get<0>();
+    RangeWatchIDIndex::iterator it = id_idx.find(id);
+    if (it == id_idx.end() || it->after_index >= revision.mod) {
+        return false;
+    }
+    FillWatchResponse(it->key, key, value, deleted, revision,
+                      it->ack->response);
+    watch_index_->Remove(id);
+    id_idx.erase(it);
+    return true;
+}
+
+int InsNodeImpl::TriggerRangeWatches(const std::string& key,
+                                     const std::string& value,
+                                     bool deleted,
+                                     const ValueRevision& revision) {
+    MutexLock lock(&watch_mu_);
+    if (range_watches_.empty()) {
+        return 0;
+    }
+    std::vector<int64_t> ids;
+    watch_index_->Match(key, &ids);
+    int event_count = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (TriggerRangeWatch(ids[i], key, value, deleted, revision)) {
+            event_count++;
+        }
+    }
+    if (event_count > 0) {
+        LOG(INFO, "trigger #%d range watch event: %s", event_count, key.c_str());
+    }
+    return event_count;
+}
+
+void InsNodeImpl::AddStreamWatch(const WatchRequest* request,
+                                 WatchResponse* response) {
+    watch_mu_.AssertHeld();
+    RemoveStreamWatch(request);
+    StreamWatch watch;
+    watch.id = ++next_watch_id_;
+    watch.key = request->key();
+    watch.end_key = request->end_key();
+    watch.prefix = request->prefix();
+    watch.ranged = request->prefix() || request->has_end_key();
+    watch.session = session_ids_->Intern(request->session_id());
+    watch.after_index = WatchStartIndex(request);
+    std::vector<WatchHistory::Event> events;
+    bool compacted = false;
+    if (request->has_from_index()) {
+        WatchHistory::FindResult found = watch_history_->Collect(
+            request->from_index(), boost::bind(&WatchCovers, request, _1),
+            &events);
+        compacted = (found == WatchHistory::kCompacted);
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        //recorded but maybe not dispatched yet, the dispatch skips them;
+        //an entry is recorded whole, so none of its keys is lost
+        watch.after_index = std::max(watch.after_index,
+                                     events[i].revision.mod);
+    }
+    stream_watches_.insert(watch);
+    if (watch.prefix) {
+        stream_index_->AddPrefix(watch.key, watch.id);
+    } else if (watch.ranged) {
+        stream_index_->AddRange(watch.key, watch.end_key, watch.id);
+    }
+    WatchStream& stream = watch_streams_[watch.session];
+    if (stream.id == 0) { //a new stream
+        stream.id = ins_common::timer::get_micros();
+        stream.first_seq = 1;
+        stream.acked_seq = 0;
+        stream.lost_seq = 0;
+        stream.polls = 0;
+        stream.last_poll = ins_common::timer::get_micros();
+    }
+    response->set_success(true);
+    response->set_leader_id("");
+    if (compacted) {
+        LOG(INFO, "watch history of %s trimmed after %ld",
+            request->key().c_str(), request->from_index());
+        response->set_compacted(true);
+        return;
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        QueueStreamEvent(&stream, events[i].key, events[i].value,
+                         events[i].deleted, events[i].revision);
+    }
+}
+
+void InsNodeImpl::RemoveStreamWatch(const WatchRequest* request) {
+    watch_mu_.AssertHeld();
+    uint32_t session = 0;
+    if (!session_ids_->Find(request->session_id(), &session)) {
+        return;
+    }
+    StreamWatchSessionIndex& session_idx = stream_watches_.get<1>();
+    std::pair<StreamWatchSessionIndex::iterator,
+              StreamWatchSessionIndex::iterator> range =
+        session_idx.equal_range(session);
+    for (StreamWatchSessionIndex::iterator it = range.first;
+         it != range.second; ) {
+        if (it->key == request->key() && it->end_key == request->end_key()
+            && it->prefix == request->prefix()) {
+            LOG(DEBUG, "remove persistent watch: %s on %s",
+                it->key.c_str(), request->session_id().c_str());
+            if (it->ranged) {
+                stream_index_->Remove(it->id);
+            }
+            it = session_idx.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void InsNodeImpl::RemoveStreamBySession(uint32_t session) {
+    watch_mu_.AssertHeld();
+    StreamWatchSessionIndex& session_idx = stream_watches_.get<1>();
+    std::pair<StreamWatchSessionIndex::iterator,
+              StreamWatchSessionIndex::iterator> range =
+        session_idx.equal_range(session);
+    for (StreamWatchSessionIndex::iterator it = range.first;
+         it != range.second; it++) {
+        if (it->ranged) {
+            stream_index_->Remove(it->id);
+        }
+    }
+    session_idx.erase(range.first, range.second);
+    std::map<uint32_t, WatchStream>::iterator st = watch_streams_.find(session);
+    if (st != watch_streams_.end()) {
+        if (st->second.poll) { //tell the poller to register again
+            st->second.poll->response->set_reset(true);
+            st->second.poll->response->set_success(true);
+        }
+        watch_streams_.erase(st);
+    }
+}
+
+void InsNodeImpl::RemoveIdleStreams() {
+    watch_mu_.AssertHeld();
+    //the session went on polling another member
+    int64_t idle_line = ins_common::timer::get_micros()
+                        - FLAGS_session_expire_timeout;
+    std::vector<uint32_t> idle_sessions;
+    std::map<uint32_t, WatchStream>::iterator it = watch_streams_.begin();
+    for (; it != watch_streams_.end(); it++) {
+        if (!it->second.poll && it->second.last_poll < idle_line) {
+            idle_sessions.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < idle_sessions.size(); i++) {
+        LOG(INFO, "drop idle watch stream of #%u", idle_sessions[i]);
+        RemoveStreamBySession(idle_sessions[i]);
+    }
+}
+
+void InsNodeImpl::QueueStreamEvent(WatchStream* stream,
+                                   const std::string& key,
+                                   const std::string& value,
+                                   bool deleted,
+                                   const ValueRevision& revision) {
+    watch_mu_.AssertHeld();
+    while (!stream->events.empty()
+           && stream->events.size() >= (size_t)FLAGS_watch_stream_size) {
+        stream->lost_seq = stream->first_seq;
+        stream->events.pop_front();
+        stream->first_seq++;
+    }
+    stream->events.push_back(WatchResponse());
+    FillWatchResponse(key, key, value, deleted, revision,
+                      &stream->events.back());
+    if (stream->poll) {
+        AnswerPoll(stream);
+    }
+}
+
+void InsNodeImpl::AnswerPoll(WatchStream* stream) {
+    watch_mu_.AssertHeld();
+    PollWatchResponse* response = stream->poll->response;
+    response->set_stream_id(stream->id);
+    response->set_first_seq(stream->first_seq);
+    size_t count = std::min(stream->events.size(),
+                            (size_t)std::max(stream->poll->max_events, 1));
+    for (size_t i = 0; i < count; i++) {
+        response->add_events()->CopyFrom(stream->events[i]);
+    }
+    response->set_overflowed(stream->lost_seq > stream->acked_seq);
+    response->set_success(true);
+    response->set_leader_id("");
+    stream->poll.reset(); //sent when the last reference goes
+}
+
+void InsNodeImpl::TriggerStreamWatches(const std::string& key,
+                                       const std::string& value,
+                                       bool deleted,
+                                       const ValueRevision& revision) {
+    MutexLock lock(&watch_mu_);
+    if (stream_watches_.empty()) {
+        return;
+    }
+    std::set<uint32_t> sessions; //one event per session, not per watch
+    StreamWatchKeyIndex& key_idx = stream_watches_.get<2>();
+    std::string parent_key;
+    std::string::size_type tail_index = key.rfind("/");
+    if (tail_index != std::string::npos) {
+        parent_key = key.substr(0, tail_index);
+    }
+    for (int i = 0; i < 2; i++) {
+        const std::string& watch_key = (i == 0 ? key : parent_key);
+        if (watch_key.empty()) {
+            continue;
+        }
+        std::pair<StreamWatchKeyIndex::iterator,
+                  StreamWatchKeyIndex::iterator> range =
+            key_idx.equal_range(watch_key);
+        for (StreamWatchKeyIndex::iterator it = range.first;
+             it != range.second; it++) {
+            if (!it->ranged && it->after_index < revision.mod) {
+                sessions.insert(it->session);
+            }
+        }
+    }
+    std::vector<int64_t> ids;
+    stream_index_->Match(key, &ids);
+    StreamWatchIDIndex& id_idx = stream_watches_.get<0>();
+    for (size_t i = 0; i < ids.size(); i++) {
+        StreamWatchIDIndex::iterator it = id_idx.find(ids[i]);
+        if (it != id_idx.end() && it->after_index < revision.mod) {
+            sessions.insert(it->session);
+        }
+    }
+    std::set<uint32_t>::iterator it = sessions.begin();
+    for (; it != sessions.end(); it++) {
+        std::map<uint32_t, WatchStream>::iterator st = watch_streams_.find(*it);
+        if (st != watch_streams_.end()) {
+            QueueStreamEvent(&st->second, key, value, deleted, revision);
+        }
+    }
+    if (!sessions.empty()) {
+        LOG(DEBUG, "queue %s on #%ld watch streams",
+            key.c_str(), sessions.size());
+    }
+}
+
+void InsNodeImpl::PollWatch(::google::protobuf::RpcController* controller,
+                            const ::galaxy::ins::PollWatchRequest* request,
+                            ::galaxy::ins::PollWatchResponse* response,
+                            ::google::protobuf::Closure* done) {
+    (void) controller;
+    //any member serves the streams registered on it
+    PollAck::Ptr ack = boost::make_shared<PollAck>(response, done,
+                                                   request->max_events());
+    MutexLock lock(&watch_mu_);
+    uint32_t session = 0;
+    std::map<uint32_t, WatchStream>::iterator st = watch_streams_.end();
+    if (session_ids_->Find(request->session_id(), &session)) {
+        st = watch_streams_.find(session);
+    }
+    if (st == watch_streams_.end()) { //unknown here, register again
+        response->set_reset(true);
+        response->set_success(true);
+        return;
+    }
+    WatchStream& stream = st->second;
+    stream.last_poll = ins_common::timer::get_micros();
+    if (request->stream_id() == stream.id) {
+        stream.acked_seq = std::max(stream.acked_seq, request->ack_seq());
+        while (!stream.events.empty()
+               && stream.first_seq <= stream.acked_seq) {
+            stream.events.pop_front();
+            stream.first_seq++;
+        }
+    }
+    if (stream.poll) { //a poll the client gave up on
+        AnswerPoll(&stream);
+    }
+    stream.poll = ack;
+    if (!stream.events.empty() || stream.lost_seq > stream.acked_seq) {
+        AnswerPoll(&stream);
+        return;
+    }
+    stream.polls++;
+    event_trigger_.DelayTask(FLAGS_watch_poll_timeout,
+        boost::bind(&InsNodeImpl::ExpirePoll, this, session, stream.polls)
+    );
+}
+
+void InsNodeImpl::ExpirePoll(uint32_t session, int64_t poll_no) {
+    MutexLock lock(&watch_mu_);
+    std::map<uint32_t, WatchStream>::iterator st = watch_streams_.find(session);
+    if (st == watch_streams_.end() || !st->second.poll
+        || st->second.polls != poll_no) {
+        return;
+    }
+    AnswerPoll(&st->second);
 }
 
 void InsNodeImpl::Watch(::google::protobuf::RpcController* controller,
@@ -1513,55 +3710,127 @@ void InsNodeImpl::Watch(::google::protobuf::RpcController* controller,
                         ::galaxy::ins::WatchResponse* response,
                         ::google::protobuf::Closure* done) {
     (void) controller;
+    //a follower serves a watch that tells where it starts from, out of its
+    //own applied state; comparing an old value needs the leader's
+    bool needs_leader = !request->has_after_revision()
+                        && !request->has_from_index()
+                        && !request->persistent()
+                        && !request->prefix() && !request->has_end_key();
+    int64_t applied_index = -1;
     {
         MutexLock lock(&mu_);
-        if (status_ == kFollower) {
+        if (status_ == kFollower && needs_leader) {
             response->set_success(false);
             response->set_leader_id(current_leader_);
             done->Run();
             return;
         }
 
-        if (status_ == kCandidate) {
+        if (status_ == kCandidate && needs_leader) {
             response->set_success(false);
             response->set_leader_id("");
             done->Run();
             return;
         } 
+        applied_index = last_applied_index_;
     }
     
-    WatchAck::Ptr ack_obj(new WatchAck(response, done));
+    if (request->persistent()) { //answered at once, changes go to the stream
+        MutexLock lock(&watch_mu_);
+        if (request->cancel()) {
+            RemoveStreamWatch(request);
+            response->set_success(true);
+        } else {
+            AddStreamWatch(request, response);
+        }
+        done->Run();
+        return;
+    }
+    WatchAck::Ptr ack_obj = boost::make_shared<WatchAck>(response, done);
+    bool is_range = request->prefix() || request->has_end_key();
+    //answered by the history, no store read; a range catches up this way
+    //too, a scan of it would cost its size and miss the deletes
+    if (request->has_from_index()
+        || (is_range && request->has_after_revision())) {
+        MutexLock lock(is_range ? &watch_mu_
+                                : &GetWatchShard(request->key())->mu);
+        int64_t start_index = WatchStartIndex(request);
+        WatchHistory::Event event;
+        WatchHistory::FindResult found = watch_history_->Find(
+            start_index, boost::bind(&WatchCovers, request, _1), &event);
+        if (found == WatchHistory::kFound) {
+            FillWatchResponse(request->key(), event.key, event.value,
+                              event.deleted, event.revision, response);
+        } else if (found == WatchHistory::kCompacted) {
+            LOG(INFO, "watch history of %s trimmed after %ld",
+                request->key().c_str(), start_index);
+            response->set_compacted(true);
+            response->set_success(true);
+            response->set_leader_id("");
+        } else if (is_range) {
+            AddRangeWatch(request, ack_obj);
+        } else {
+            AddKeyWatch(request, ack_obj);
+        }
+        return;
+    }
+    if (is_range) { //starts from now
+        MutexLock lock(&watch_mu_);
+        AddRangeWatch(request, ack_obj);
+        return;
+    }
     
     std::string key = request->key();
     {
-        MutexLock lock(&watch_mu_);
-        WatchEvent watch_event;
-        watch_event.key = key;
-        watch_event.session_id = request->session_id();
-        watch_event.ack = ack_obj;
-        RemoveEventBySessionAndKey(watch_event.session_id, watch_event.key);
-        watch_events_.insert(watch_event);
+        MutexLock lock(&GetWatchShard(key)->mu);
+        AddKeyWatch(request, ack_obj);
     }
     int64_t tm_now = ins_common::timer::get_micros(); 
-    if (tm_now - server_start_timestamp_ > FLAGS_session_expire_timeout) {
+    //behind after_revision, the changes still to apply fire the watch
+    bool lagging = request->has_after_revision()
+                   && applied_index < request->after_revision();
+    if (tm_now - server_start_timestamp_ > FLAGS_session_expire_timeout
+        && !lagging) {
         leveldb::Status s;
         std::string raw_value;
-        s = data_store_->Get(leveldb::ReadOptions(), key, &raw_value);
+        s = data_store_->Get(key, &raw_value);
         bool key_exist = s.ok();
-        std::string real_value;
+        leveldb::Slice real_value;
         LogOperation op;
-        ParseValue(raw_value, op, real_value);
-        if (real_value != request->old_value() || 
-            key_exist != request->key_exist()) {
-            LOG(INFO, "key:%s, new_v: %s, old_v:%s", 
-                key.c_str(), real_value.c_str(), request->old_value().c_str());
+        ValueRevision revision;
+        ParseValue(raw_value, &op, &real_value, &revision);
+        if (key_exist && PastDeadline(revision, tm_now)) { //gets miss it too
+            key_exist = false;
+            raw_value.clear();
+            real_value.clear();
+            revision = ValueRevision();
+        }
+        std::string blob_value;
+        if (BlobStore::IsBlobValue(raw_value)
+            && blob_store_->Read(real_value, &blob_value)) {
+            real_value = blob_value;
+        }
+        bool changed = false;
+        if (request->has_after_revision()) { //no need to ship the old value
+            changed = (key_exist != request->key_exist())
+                      || (key_exist && revision.mod > request->after_revision());
+        } else {
+            changed = (real_value != leveldb::Slice(request->old_value())
+                       || key_exist != request->key_exist());
+        }
+        if (changed) {
+            LOG(INFO, "key:%s, new_v: %s, old_v:%s, mod_revision: %ld",
+                key.c_str(), real_value.ToString().c_str(),
+                request->old_value().c_str(), revision.mod);
             TriggerEventBySessionAndKey(request->session_id(),
-                                        key, real_value, s.IsNotFound());
-        } else if (op == kLock && IsExpiredSession(real_value)) {
+                                        key, real_value.ToString(),
+                                        !key_exist, revision);
+        } else if (op == kLock && IsExpiredSession(real_value.ToString())) {
             LOG(INFO, "key(lock):%s, new_v: %s, old_v:%s", 
-                key.c_str(), real_value.c_str(), request->old_value().c_str());
+                key.c_str(), real_value.ToString().c_str(),
+                request->old_value().c_str());
             TriggerEventBySessionAndKey(request->session_id(),
-                                        key, "", true);
+                                        key, "", true, revision);
         }
     }
 }
@@ -1571,6 +3840,13 @@ void InsNodeImpl::UnLock(::google::protobuf::RpcController* /*controller*/,
                          ::galaxy::ins::UnLockResponse* response,
                          ::google::protobuf::Closure* done) {
     MutexLock lock(&mu_);
+    if (IsReservedKey(request->key())) {
+        LOG(WARNING, "reserved key: %s", request->key().c_str());
+        response->set_success(false);
+        response->set_leader_id("");
+        done->Run();
+        return;
+    }
     if (status_ == kFollower) {
         response->set_success(false);
         response->set_leader_id(current_leader_);
@@ -1625,6 +3901,8 @@ void InsNodeImpl::CleanBinlog(::google::protobuf::RpcController* controller,
                               ::google::protobuf::Closure* done) {
     (void)controller;
     int64_t del_end_index = request->end_index();
+    int64_t applied_index = 0;
+    bool need_checkpoint = false;
     {
         MutexLock lock(&mu_);
         if (last_applied_index_ < del_end_index) {
@@ -1634,14 +3912,216 @@ void InsNodeImpl::CleanBinlog(::google::protobuf::RpcController* controller,
             done->Run();
             return;
         }
+        applied_index = last_applied_index_;
+        need_checkpoint = (durable_applied_index_ < del_end_index);
+    }
+    if (need_checkpoint) { //the store must not depend on these slots
+        if (!data_store_->Checkpoint()) {
+            response->set_success(false);
+            LOG(FATAL, "del log %ld failed, can't checkpoint the store",
+                del_end_index);
+            done->Run();
+            return;
+        }
+        MutexLock lock(&mu_);
+        durable_applied_index_ = std::max(durable_applied_index_, applied_index);
     }
     binlog_cleaner_.AddTask(
         boost::bind(&InsNodeImpl::DelBinlog, this, del_end_index -1 )
     );
+    binlog_cleaner_.AddTask(
+        boost::bind(&InsNodeImpl::CollectBlobGarbage, this, del_end_index -1 )
+    );
     response->set_success(true);
     done->Run();
 }
 
+//the keys whose values may hold a blob reference: user keys, then old
+//versions which keep their blobs too
+static bool InBlobRange(leveldb::Iterator* it) {
+    if (!it->Valid()) {
+        return false;
+    }
+    if (it->key().compare(meta_key_prefix) < 0) {
+        return true;
+    }
+    if (it->key().compare(history_key_prefix) < 0) {
+        it->Seek(history_key_prefix);
+    }
+    return it->Valid() && it->key().starts_with(history_key_prefix);
+}
+
+void InsNodeImpl::CollectBlobGarbage(int64_t cleaned_index) {
+    std::set<int64_t> sparse_files;
+    blob_store_->CollectGarbage(cleaned_index, &sparse_files);
+    if (sparse_files.empty()) {
+        return;
+    }
+    //copy the live blobs out, the files go once the applier moved every key
+    int64_t start = ins_common::timer::get_micros();
+    std::vector<BlobMove> moves;
+    std::map<std::string, std::string> copied; //old ref -> new ref
+    leveldb::Iterator* it = data_store_->NewIterator();
+    for (it->SeekToFirst(); InBlobRange(it); it->Next()) {
+        leveldb::Slice value = it->value();
+        if (BlobStore::IsBlobValue(value)) {
+            size_t header_size = StoreValueHeaderSize(value);
+            leveldb::Slice ref(value.data() + header_size,
+                               value.size() - header_size);
+            if (sparse_files.find(BlobStore::FileNumber(ref))
+                != sparse_files.end()) {
+                std::string old_ref = ref.ToString();
+                std::map<std::string, std::string>::iterator ct =
+                    copied.find(old_ref);
+                bool ok = true;
+                if (ct == copied.end()) {
+                    std::string new_ref;
+                    ok = blob_store_->Relocate(ref, &new_ref);
+                    if (ok) {
+                        ct = copied.insert(std::make_pair(old_ref, new_ref)).first;
+                    }
+                } else {
+                    blob_store_->Ref(ct->second); //one per move
+                }
+                if (ok) {
+                    BlobMove move;
+                    move.key = it->key().ToString();
+                    move.old_value = value.ToString();
+                    move.new_value = move.old_value.substr(0, header_size)
+                                     + ct->second;
+                    moves.push_back(move);
+                }
+            }
+        }
+    }
+    assert(it->status().ok());
+    delete it;
+    LOG(INFO, "%ld blobs of %ld sparse files copied for %ld keys, cost %ld ms",
+        copied.size(), sparse_files.size(), moves.size(),
+        (ins_common::timer::get_micros() - start) / 1000);
+    if (moves.empty()) {
+        return;
+    }
+    MutexLock lock(&mu_);
+    blob_moves_.insert(blob_moves_.end(), moves.begin(), moves.end());
+    commit_cond_->Signal();
+}
+
+void InsNodeImpl::CountBlobRefs() {
+    int64_t start = ins_common::timer::get_micros();
+    int64_t ref_count = 0;
+    leveldb::Iterator* it = data_store_->NewIterator();
+    for (it->SeekToFirst(); InBlobRange(it); it->Next()) {
+        leveldb::Slice value = it->value();
+        if (BlobStore::IsBlobValue(value)) {
+            value.remove_prefix(StoreValueHeaderSize(value));
+            blob_store_->Ref(value);
+            ref_count++;
+        }
+    }
+    assert(it->status().ok());
+    delete it;
+    LOG(INFO, "%ld blob references counted, cost %ld ms", ref_count,
+        (ins_common::timer::get_micros() - start) / 1000);
+}
+
+void InsNodeImpl::CheckpointStore() {
+    int64_t applied_index = 0;
+    {
+        MutexLock lock(&mu_);
+        if (stop_) {
+            return;
+        }
+        applied_index = last_applied_index_;
+    }
+    if (data_store_->Checkpoint()) {
+        MutexLock lock(&mu_);
+        durable_applied_index_ = std::max(durable_applied_index_, applied_index);
+    } else {
+        LOG(FATAL, "failed to checkpoint the store at [%ld]", applied_index);
+    }
+    store_checkpointer_.DelayTask(FLAGS_store_checkpoint_interval * 1000,
+        boost::bind(&InsNodeImpl::CheckpointStore, this)
+    );
+}
+
+void InsNodeImpl::CompactHistory() {
+    int64_t applied_index = 0;
+    {
+        MutexLock lock(&mu_);
+        if (stop_) {
+            return;
+        }
+        applied_index = last_applied_index_;
+    }
+    int64_t new_floor = applied_index - FLAGS_mvcc_retention;
+    int64_t old_floor = 0;
+    {
+        MutexLock lock(&history_mu_);
+        old_floor = history_floor_;
+    }
+    if (new_floor > old_floor) {
+        int64_t start = ins_common::timer::get_micros();
+        //raise the floor first, reads below it fail from now on
+        leveldb::Status s = data_store_->Put(meta_history_floor,
+                                             BinLogger::IntToString(new_floor));
+        assert(s.ok());
+        {
+            MutexLock lock(&history_mu_);
+            history_floor_ = new_floor;
+        }
+        //per key, the newest version not after the floor is its value at
+        //the floor and stays unless it is a delete, older ones go
+        const std::string tombstone(1, static_cast<char>(kDel));
+        leveldb::WriteBatch batch;
+        std::vector<std::string> dropped_blobs;
+        int64_t removed = 0;
+        std::string cur_key;
+        bool has_cur_key = false;
+        std::string key;
+        int64_t index = 0;
+        leveldb::Iterator* it = data_store_->NewIterator();
+        for (it->Seek(history_key_prefix);
+             it->Valid() && ParseVersionKey(it->key(), &key, &index);
+             it->Next()) {
+            if (index > new_floor) {
+                continue;
+            }
+            if (!has_cur_key || key != cur_key) {
+                cur_key = key;
+                has_cur_key = true;
+                if (it->value() != tombstone) {
+                    continue;
+                }
+            }
+            batch.Delete(it->key());
+            if (BlobStore::IsBlobValue(it->value())) {
+                leveldb::Slice ref = it->value();
+                ref.remove_prefix(StoreValueHeaderSize(ref));
+                dropped_blobs.push_back(ref.ToString());
+            }
+            removed++;
+            if (removed % 1000 == 0) {
+                s = data_store_->Write(&batch);
+                assert(s.ok());
+                batch.Clear();
+                UnrefBlobs(&dropped_blobs);
+            }
+        }
+        assert(it->status().ok());
+        delete it;
+        s = data_store_->Write(&batch);
+        assert(s.ok());
+        UnrefBlobs(&dropped_blobs);
+        LOG(INFO, "mvcc history floor moves to [%ld], %ld versions removed, "
+            "cost %ld ms", new_floor, removed,
+            (ins_common::timer::get_micros() - start) / 1000);
+    }
+    store_checkpointer_.DelayTask(FLAGS_mvcc_compact_interval * 1000,
+        boost::bind(&InsNodeImpl::CompactHistory, this)
+    );
+}
+
 } //namespace ins
 } //namespace galaxy
 
@@ -7,6 +7,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <boost/shared_ptr.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -16,7 +17,9 @@
 #include "common/mutex.h"
 #include "common/thread_pool.h"
 #include "rpc/rpc_client.h"
-#include "leveldb/db.h"
+#include "leveldb/iterator.h"
+#include "leveldb/slice.h"
+#include "storage/store_value.h"
 
 using namespace boost::multi_index;
 
@@ -25,17 +28,34 @@ namespace ins {
 
 class Meta;
 class BinLogger;
+class StateStore;
+class StateBatch;
+struct LogEntry;
+class ValueCache;
+class ChildrenIndex;
+class ExpiryIndex;
+class WatchIndex;
+class WatchHistory;
+class SessionIds;
+class LatencyHistogram;
+class BlobStore;
 
 struct ClientAck {
     galaxy::ins::PutResponse* response;
     galaxy::ins::DelResponse* del_response;
     galaxy::ins::LockResponse* lock_response;
     galaxy::ins::UnLockResponse* unlock_response;
+    galaxy::ins::TxnResponse* txn_response;
+    galaxy::ins::IncrResponse* incr_response;
+    galaxy::ins::DeleteRangeResponse* del_range_response;
     google::protobuf::Closure* done;
     ClientAck() : response(NULL),
                   del_response(NULL),
                   lock_response(NULL),
                   unlock_response(NULL),
+                  txn_response(NULL),
+                  incr_response(NULL),
+                  del_range_response(NULL),
                   done(NULL) {
     }
 };
@@ -100,20 +120,26 @@ struct WatchAck {
     typedef boost::shared_ptr<WatchAck> Ptr;
 };
 
+// A pending key watch. On 64 bits the record is 64 bytes, a node of the
+// two hashed indexes adds 32 and their buckets about 16, the ack shares
+// one allocation with its count, and a key past 15 bytes is allocated
+// apart; watch_mem_bench measures about 230 bytes a watch for 17 byte
+// keys, beside what the rpc layer keeps for the open call
 struct WatchEvent {
     std::string key;
-    std::string session_id;
     WatchAck::Ptr ack;
+    int64_t after_index; //changes up to it are known to the watcher
+    uint32_t session; //numbered by SessionIds
 };
 
 typedef multi_index_container<
     WatchEvent,
     indexed_by<
-        ordered_non_unique<
+        hashed_non_unique<
             member<WatchEvent, std::string, &WatchEvent::key> 
         >,
-        ordered_non_unique<
-            member<WatchEvent, std::string, &WatchEvent::session_id> 
+        hashed_non_unique<
+            member<WatchEvent, uint32_t, &WatchEvent::session> 
         >
     >
 > WatchEventContainer;
@@ -121,6 +147,135 @@ typedef multi_index_container<
 typedef WatchEventContainer::nth_index<0>::type WatchEventKeyIndex;
 typedef WatchEventContainer::nth_index<1>::type WatchEventSessionIndex;
 
+// A change as a watch on watch_key sees it, the key itself or a child
+struct WatchedChange {
+    std::string watch_key;
+    std::string key;
+    std::string value;
+    bool deleted;
+    ValueRevision revision;
+    int64_t committed_at; //micros, when the applier took it
+};
+
+typedef std::vector<WatchedChange> WatchedChanges;
+
+// The key watches whose key hashes here; the lane is one thread, so
+// each watch key sees its changes in log order
+struct WatchShard {
+    Mutex mu;
+    WatchEventContainer events;
+    ThreadPool lane;
+    WatchShard() : lane(1) {
+    }
+};
+
+// A watch on every key under a prefix or in [key, end_key),
+// WatchIndex finds it by id
+struct RangeWatch {
+    int64_t id;
+    std::string key;
+    std::string end_key;
+    bool prefix;
+    uint32_t session;
+    int64_t after_index;
+    WatchAck::Ptr ack;
+};
+
+typedef multi_index_container<
+    RangeWatch,
+    indexed_by<
+        hashed_unique<
+            member<RangeWatch, int64_t, &RangeWatch::id>
+        >,
+        hashed_non_unique<
+            member<RangeWatch, uint32_t, &RangeWatch::session>
+        >
+    >
+> RangeWatchContainer;
+
+typedef RangeWatchContainer::nth_index<0>::type RangeWatchIDIndex;
+typedef RangeWatchContainer::nth_index<1>::type RangeWatchSessionIndex;
+
+// A watch that stays after it fires, its changes queue on the stream of
+// its session until the session polls them
+struct StreamWatch {
+    int64_t id;
+    std::string key;
+    std::string end_key;
+    bool prefix;
+    bool ranged; //prefix or range, stream_index_ finds it by id
+    uint32_t session;
+    int64_t after_index;
+};
+
+typedef multi_index_container<
+    StreamWatch,
+    indexed_by<
+        hashed_unique<
+            member<StreamWatch, int64_t, &StreamWatch::id>
+        >,
+        hashed_non_unique<
+            member<StreamWatch, uint32_t, &StreamWatch::session>
+        >,
+        hashed_non_unique<
+            member<StreamWatch, std::string, &StreamWatch::key>
+        >
+    >
+> StreamWatchContainer;
+
+typedef StreamWatchContainer::nth_index<0>::type StreamWatchIDIndex;
+typedef StreamWatchContainer::nth_index<1>::type StreamWatchSessionIndex;
+typedef StreamWatchContainer::nth_index<2>::type StreamWatchKeyIndex;
+
+struct PollAck {
+    PollWatchResponse* response;
+    google::protobuf::Closure* done;
+    int32_t max_events;
+    PollAck(PollWatchResponse* rsps,
+            google::protobuf::Closure* dn,
+            int32_t max) : response(rsps),
+                           done(dn),
+                           max_events(max) {
+    }
+    ~PollAck() {
+        if (done) {
+            done->Run();
+        }
+    }
+    typedef boost::shared_ptr<PollAck> Ptr;
+};
+
+// Changes of one session not acked yet, events[i] is numbered
+// first_seq + i; a poll parks here while there is nothing to send
+struct WatchStream {
+    int64_t id;
+    int64_t first_seq;
+    int64_t acked_seq;
+    int64_t lost_seq; //the last change dropped for want of room
+    int64_t last_poll; //a stream nobody polls is dropped after a while
+    std::deque<WatchResponse> events;
+    PollAck::Ptr poll;
+    int64_t polls; //numbers the parked poll for its timeout
+};
+
+// An open multi-page scan, the iterator stays where the last page ended
+struct ScanCursor {
+    leveldb::Iterator* it;
+    std::string next_key; //start key of the owner's next page
+    std::string end_key;
+    int64_t last_access;
+    ScanCursor() : it(NULL), last_access(0) {
+    }
+};
+
+// a blob copied out of a sparse file, the applier swaps the reference in if
+// the key still holds old_value
+struct BlobMove {
+    std::string key;
+    std::string old_value;
+    std::string new_value;
+};
+
 class InsNodeImpl : public InsNode {
 public:
    
@@ -138,6 +293,18 @@ public:
              const ::galaxy::ins::PutRequest* request,
              ::galaxy::ins::PutResponse* response,
              ::google::protobuf::Closure* done);
+    void DeleteRange(::google::protobuf::RpcController* controller,
+                     const ::galaxy::ins::DeleteRangeRequest* request,
+                     ::galaxy::ins::DeleteRangeResponse* response,
+                     ::google::protobuf::Closure* done);
+    void Incr(::google::protobuf::RpcController* controller,
+              const ::galaxy::ins::IncrRequest* request,
+              ::galaxy::ins::IncrResponse* response,
+              ::google::protobuf::Closure* done);
+    void Txn(::google::protobuf::RpcController* controller,
+             const ::galaxy::ins::TxnRequest* request,
+             ::galaxy::ins::TxnResponse* response,
+             ::google::protobuf::Closure* done);
     void Get(::google::protobuf::RpcController* controller,
              const ::galaxy::ins::GetRequest* request,
              ::galaxy::ins::GetResponse* response,
@@ -154,6 +321,14 @@ public:
               const ::galaxy::ins::ScanRequest* request,
               ::galaxy::ins::ScanResponse* response,
               ::google::protobuf::Closure* done);
+    void Backup(::google::protobuf::RpcController* controller,
+                const ::galaxy::ins::BackupRequest* request,
+                ::galaxy::ins::BackupResponse* response,
+                ::google::protobuf::Closure* done);
+    void ListChildren(::google::protobuf::RpcController* controller,
+                      const ::galaxy::ins::ListChildrenRequest* request,
+                      ::galaxy::ins::ListChildrenResponse* response,
+                      ::google::protobuf::Closure* done);
     void KeepAlive(::google::protobuf::RpcController* controller,
                    const ::galaxy::ins::KeepAliveRequest* request,
                    ::galaxy::ins::KeepAliveResponse* response,
@@ -170,6 +345,10 @@ public:
                const ::galaxy::ins::WatchRequest* request,
                ::galaxy::ins::WatchResponse* response,
                ::google::protobuf::Closure* done);
+    void PollWatch(::google::protobuf::RpcController* controller,
+                   const ::galaxy::ins::PollWatchRequest* request,
+                   ::galaxy::ins::PollWatchResponse* response,
+                   ::google::protobuf::Closure* done);
     void CleanBinlog(::google::protobuf::RpcController* controller,
                      const ::galaxy::ins::CleanBinlogRequest* request,
                      ::galaxy::ins::CleanBinlogResponse* response,
@@ -200,31 +379,164 @@ private:
                                 int64_t* last_log_term);
     void UpdateCommitIndex(int64_t a_index);
     void CommitIndexObserv();
+    // stage one write of the entry at index, with its history version
+    ValueRevision StagePut(StateBatch* batch, int64_t index,
+                           LogOperation op, const std::string& key,
+                           const std::string& value, bool is_blob,
+                           int64_t expire_at = 0,
+                           const std::string& owner = "");
+    ValueRevision StageDelete(StateBatch* batch, int64_t index,
+                              const std::string& key);
+    // the blob reference of old_value goes once the batch is written
+    // the first write of a key since the floor keeps its old value
+    void SeedVersion(StateBatch* batch, const std::string& key,
+                     const std::string& old_value);
+    void StageBlobUnref(const std::string& old_value);
+    void UnrefBlobs(std::vector<std::string>* refs);
+    void StageBlobMoves(StateBatch* batch, const std::vector<BlobMove>& moves);
+    bool CompareHolds(StateBatch* batch, const std::string& key,
+                      const Compare& compare);
+    // decides a kPutIf/kDelIf entry, rewrites it to kPut/kDel if it holds
+    bool ApplyCompare(StateBatch* batch, LogEntry* log_entry);
+    // adds the delta of a kIncr entry to the decimal counter at its key,
+    // false if the value is not a number or would overflow
+    bool ApplyIncr(StateBatch* batch, int64_t index,
+                   LogEntry* log_entry, ValueRevision* revision,
+                   int64_t* counter);
+    // stages a kDel for every key in the range of a kDelRange entry,
+    // returns how many keys went away
+    int64_t ApplyDeleteRange(StateBatch* batch, int64_t index,
+                             const LogEntry& log_entry,
+                             std::vector<LogEntry>* applied,
+                             std::vector<ValueRevision>* revisions);
+    // drops a deleted key from the lock and ephemeral sets of its session
+    void ForgetSessionKey(const std::string& key, const std::string& raw_value);
+    // stages a kDel for every key of a kExpire entry whose deadline is
+    // still the logged one, a key put again meanwhile stays
+    void ApplyExpire(StateBatch* batch, int64_t index,
+                     const LogEntry& log_entry,
+                     std::vector<LogEntry>* applied,
+                     std::vector<ValueRevision>* revisions);
+    // stages a kDel for every key of a kDelEphemeral entry still owned by
+    // its session
+    void ApplyDelEphemeral(StateBatch* batch, int64_t index,
+                           const LogEntry& log_entry,
+                           std::vector<LogEntry>* applied,
+                           std::vector<ValueRevision>* revisions);
+    // stages the then or else ops of a kTxn entry, true if guards held;
+    // they reach the store in the round's one write, and the read cache
+    // hides their keys until then, so one Get or Scan page sees all of
+    // them or none
+    bool ApplyTxn(StateBatch* batch, int64_t index,
+                  const LogEntry& log_entry,
+                  std::vector<LogEntry>* applied,
+                  std::vector<ValueRevision>* revisions);
     void TransToLeader();
     void RemoveExpiredSessions();
-    void ParseValue(const std::string& value,
-                    LogOperation& op, 
-                    std::string& real_value);
+    // the leader proposes one kExpire entry for keys past their deadline
+    void ReapExpiredKeys();
+    void ParseValue(const leveldb::Slice& value,
+                    LogOperation* op,
+                    leveldb::Slice* real_value,
+                    ValueRevision* revision = NULL);
+    void ParseValue(std::string* value, LogOperation* op,
+                    ValueRevision* revision = NULL);
+    bool ReadValue(const std::string& key,
+                   LogOperation* op,
+                   std::string* real_value,
+                   ValueRevision* revision = NULL);
+    // applied_index: last_applied_index_ when the read was admitted
+    void FillGetResponse(const GetRequest* request,
+                         int64_t applied_index,
+                         GetResponse* response);
+    // versions as of index, false if the history does not reach it
+    bool HistoryAvailable(int64_t index, int64_t applied_index);
+    // the raw value of key as of index, it is positioned by seeks
+    bool ReadAsOf(leveldb::Iterator* it, const std::string& key,
+                  int64_t index, std::string* raw_value);
+    bool ReadVersion(const std::string& key, int64_t index,
+                     LogOperation* op, std::string* real_value,
+                     ValueRevision* revision);
+    void ScanHistory(const ScanRequest* request,
+                     int64_t applied_index,
+                     ScanResponse* response);
+    void InitHistory();
+    void CompactHistory();
     bool IsExpiredSession(const std::string& session_id);
     void RemoveEventBySession(const std::string& session_id);
-    void TriggerEvent(const std::string& watch_key,
-                      const std::string& key,
-                      const std::string& value,
-                      bool deleted);
-    void TriggerEventWithParent(const std::string& key,
-                                const std::string& value,
-                                bool deleted);
+    // returns how many watches it answered
+    int TriggerEvent(const std::string& watch_key,
+                     const std::string& key,
+                     const std::string& value,
+                     bool deleted,
+                     const ValueRevision& revision);
+    // hands the changes of an applied batch to the watch lanes, one task
+    // per shard they touch and one for range and persistent watches
+    void DispatchWatchEvents(const std::vector<LogEntry>& applied,
+                             const std::vector<ValueRevision>& revisions,
+                             int64_t committed_at);
+    void TriggerShardEvents(WatchShard* shard,
+                            boost::shared_ptr<WatchedChanges> changes);
+    void TriggerRangeEvents(boost::shared_ptr<WatchedChanges> changes);
+    WatchShard* GetWatchShard(const std::string& watch_key);
     void TriggerEventBySessionAndKey(const std::string& session_id,
                                      const std::string& key,
                                      const std::string& value,
-                                     bool deleted);
-    void RemoveEventBySessionAndKey(const std::string& session_id,
+                                     bool deleted,
+                                     const ValueRevision& revision);
+    void RemoveEventBySessionAndKey(uint32_t session,
                                     const std::string& key);
+    // register a watch under the mutex of its shard, or watch_mu_ for a
+    // range watch, replacing the same one of the session; a range watch
+    // gets an id
+    void AddKeyWatch(const WatchRequest* request, WatchAck::Ptr ack);
+    int64_t AddRangeWatch(const WatchRequest* request, WatchAck::Ptr ack);
+    // fires one range watch by id if it is still there
+    bool TriggerRangeWatch(int64_t id,
+                           const std::string& key,
+                           const std::string& value,
+                           bool deleted,
+                           const ValueRevision& revision);
+    int TriggerRangeWatches(const std::string& key,
+                            const std::string& value,
+                            bool deleted,
+                            const ValueRevision& revision);
+    // persistent watches, all under watch_mu_
+    void AddStreamWatch(const WatchRequest* request, WatchResponse* response);
+    void RemoveStreamWatch(const WatchRequest* request);
+    void RemoveStreamBySession(uint32_t session);
+    void RemoveIdleStreams();
+    void QueueStreamEvent(WatchStream* stream, const std::string& key,
+                          const std::string& value, bool deleted,
+                          const ValueRevision& revision);
+    void AnswerPoll(WatchStream* stream);
+    // sends the parked poll back empty if it is still the same one
+    void ExpirePoll(uint32_t session, int64_t poll_no);
+    void TriggerStreamWatches(const std::string& key,
+                              const std::string& value,
+                              bool deleted,
+                              const ValueRevision& revision);
     void DelBinlog(int64_t index);
     bool LockIsAvailable(const std::string& key,
                         const std::string& session_id);
     void ForwardKeepAlive(const ::galaxy::ins::KeepAliveRequest * request,
                           ::galaxy::ins::KeepAliveResponse * response);
+    void CheckpointStore();
+    void CollectBlobGarbage(int64_t cleaned_index);
+    void CountBlobRefs();
+    leveldb::Iterator* TakeScanCursor(std::map<int64_t, ScanCursor>* cursors,
+                                      int64_t cursor_id,
+                                      const std::string& start_key,
+                                      const std::string& end_key);
+    int64_t PutScanCursor(std::map<int64_t, ScanCursor>* cursors,
+                          int32_t max_num,
+                          leveldb::Iterator* it,
+                          const std::string& next_key,
+                          const std::string& end_key);
+    void RemoveExpiredCursors();
+    void MigrateMetaKeys();
+    void RestoreStore(const std::string& dump_file);
+    void RebuildKeyIndexes();
 public:
     std::vector<std::string> members_;
 private:
@@ -245,7 +557,7 @@ private:
     Meta * meta_;
     BinLogger* binlogger_;
     //for leaders
-    leveldb::DB* data_store_;
+    StateStore* data_store_;
     ThreadPool replicatter_;
     ThreadPool committer_;
     std::map<std::string, int64_t> next_index_;
@@ -256,7 +568,8 @@ private:
     int64_t heartbeat_read_timestamp_;
     bool in_safe_mode_;
     int64_t server_start_timestamp_;
-    ThreadPool event_trigger_;
+    int64_t leader_start_timestamp_; //ephemeral owners are reaped a grace after it
+    ThreadPool event_trigger_; //the lane of range and persistent watches
     // for all servers
     SessionContainer sessions_;
     Mutex sessions_mu_;
@@ -264,12 +577,40 @@ private:
     int64_t commit_index_;
     int64_t last_applied_index_;
     CondVar* commit_cond_;
-    WatchEventContainer watch_events_;
-    Mutex watch_mu_;
+    std::vector<WatchShard*> watch_shards_;
+    RangeWatchContainer range_watches_;
+    WatchIndex* watch_index_;
+    WatchHistory* watch_history_;
+    StreamWatchContainer stream_watches_;
+    WatchIndex* stream_index_;
+    std::map<uint32_t, WatchStream> watch_streams_;
+    SessionIds* session_ids_;
+    LatencyHistogram* notify_latency_; //commit to answer of a watch
+    int64_t next_watch_id_;
+    Mutex watch_mu_; //range and persistent watches, key watches lock a shard
     std::map<std::string, std::set<std::string> > session_locks_;
+    //ephemeral keys by owner, may keep keys deleted or put again since
+    std::map<std::string, std::set<std::string> > session_ephemerals_;
+    //owners with a kDelEphemeral in flight, by the term that proposed it
+    std::map<std::string, int64_t> ephemeral_reaps_;
     Mutex session_locks_mu_;
     ThreadPool binlog_cleaner_;
     bool single_node_mode_;
+    int64_t durable_applied_index_;
+    ThreadPool store_checkpointer_;
+    ValueCache* read_cache_;
+    ChildrenIndex* children_index_;
+    ExpiryIndex* expiry_index_;
+    int64_t reap_index_; //kExpire entry of the leader not applied yet
+    BlobStore* blob_store_;
+    std::vector<std::string> blob_unrefs_; //owned by the applier
+    std::vector<BlobMove> blob_moves_; //guarded by mu_
+    std::map<int64_t, ScanCursor> scan_cursors_;
+    std::map<int64_t, ScanCursor> backup_cursors_; //apart, scans never evict them
+    int64_t next_cursor_id_;
+    Mutex cursors_mu_;
+    int64_t history_floor_; //oldest index as-of reads may ask for
+    Mutex history_mu_;
 };
 
 } //namespace ins
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <gflags/gflags.h>
+#include "ins_node_impl.h"
+#include "storage/session_ids.h"
+
+DEFINE_int32(bench_watches, 1000000, "key watches to register");
+DEFINE_int32(bench_sessions, 200000, "sessions the watches belong to");
+DEFINE_int32(bench_lookups, 1000000, "key lookups to time");
+
+using namespace galaxy::ins;
+
+static int64_t HeapInUse() {
+    struct mallinfo2 info = mallinfo2();
+    return (int64_t)info.uordblks + info.hblkhd;
+}
+
+static int64_t NowMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Fills a WatchEventContainer the way the server does and reports what
+// each watch costs, so changes to the record can be measured
+int main(int argc, char* argv[]) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_bench_watches <= 0 || FLAGS_bench_sessions <= 0) {
+        fprintf(stderr, "bench_watches and bench_sessions must be positive\n");
+        return 1;
+    }
+    std::vector<std::string> session_names;
+    for (int i = 0; i < FLAGS_bench_sessions; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "host%05d.example.com#%08x-bench", i, i);
+        session_names.push_back(name);
+    }
+    SessionIds session_ids;
+    int64_t heap_start = HeapInUse();
+    for (int i = 0; i < FLAGS_bench_sessions; i++) {
+        session_ids.Intern(session_names[i]);
+    }
+    int64_t heap_sessions = HeapInUse();
+
+    WatchEventContainer watches;
+    for (int i = 0; i < FLAGS_bench_watches; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "/jobs/task%07d", i);
+        WatchEvent watch;
+        watch.key = key;
+        watch.session = session_ids.Intern(
+            session_names[i % FLAGS_bench_sessions]);
+        watch.after_index = -1;
+        watch.ack = boost::make_shared<WatchAck>(
+            static_cast<WatchResponse*>(NULL),
+            static_cast<google::protobuf::Closure*>(NULL));
+        watches.insert(watch);
+    }
+    int64_t heap_watches = HeapInUse();
+
+    const WatchEventContainer::nth_index<0>::type& key_index = watches.get<0>();
+    int64_t found = 0;
+    int64_t start = NowMicros();
+    for (int i = 0; i < FLAGS_bench_lookups; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "/jobs/task%07d", i % FLAGS_bench_watches);
+        std::pair<WatchEventContainer::nth_index<0>::type::const_iterator,
+                  WatchEventContainer::nth_index<0>::type::const_iterator>
+            range = key_index.equal_range(key);
+        for (; range.first != range.second; ++range.first) {
+            found++;
+        }
+    }
+    int64_t elapsed = NowMicros() - start;
+
+    printf("sessions: %d, %.1f bytes each\n", FLAGS_bench_sessions,
+           (double)(heap_sessions - heap_start) / FLAGS_bench_sessions);
+    printf("watches: %d, %.1f bytes each\n", FLAGS_bench_watches,
+           (double)(heap_watches - heap_sessions) / FLAGS_bench_watches);
+    printf("lookups: %d, found %ld, %.3f us each\n", FLAGS_bench_lookups,
+           found, (double)elapsed / (FLAGS_bench_lookups > 0 ?
+                                     FLAGS_bench_lookups : 1));
+    return 0;
+}
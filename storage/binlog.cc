@@ -1,9 +1,12 @@
 #include "binlog.h"
 
 #include <assert.h>
+#include <vector>
 #include "common/asm_atomic.h"
 #include "common/logging.h"
 #include "leveldb/write_batch.h"
+#include "blob_store.h"
+#include "crc32c.h"
 #include "utils.h"
 
 namespace galaxy {
@@ -12,8 +15,10 @@ namespace ins {
 const std::string log_dbname = "binlog";
 const std::string length_tag = "#BINLOG_LEN#";
 
-BinLogger::BinLogger(const std::string& data_dir) : db_(NULL),
-                                                    length_(0) {
+BinLogger::BinLogger(const std::string& data_dir,
+                     BlobStore* blob_store) : db_(NULL),
+                                              blob_store_(blob_store),
+                                              length_(0) {
     bool ok = ins_common::Mkdirs(data_dir.c_str());
     if (!ok) {
         LOG(FATAL, "failed to create dir :%s", data_dir.c_str());
@@ -70,11 +75,32 @@ bool BinLogger::RemoveSlot(int64_t slot_index) {
 }
 
 bool BinLogger::ReadSlot(int64_t slot_index, LogEntry* log_entry) {
+    std::string blob_ref;
+    if (!ReadSlotRef(slot_index, log_entry, &blob_ref)) {
+        return false;
+    }
+    if (!blob_ref.empty()) {
+        assert(blob_store_);
+        return blob_store_->Read(blob_ref, &log_entry->value);
+    }
+    return true;
+}
+
+bool BinLogger::ReadSlotRef(int64_t slot_index, LogEntry* log_entry,
+                            std::string* blob_ref) {
     std::string value;
     std::string key = IntToString(slot_index);
+    blob_ref->clear();
     leveldb::Status status = db_->Get(leveldb::ReadOptions(), key, &value);
     if (status.ok()) {
-        LoadLogEntry(value, log_entry);
+        if (!LoadLogEntry(value, log_entry)) {
+            LOG(FATAL, "corrupted binlog slot: %ld", slot_index);
+            abort();
+        }
+        if (IsBlobRecord(value)) {
+            blob_ref->swap(log_entry->value);
+            log_entry->value.clear();
+        }
         return true;
     } else if (status.IsNotFound()) {
         return false;
@@ -83,22 +109,68 @@ bool BinLogger::ReadSlot(int64_t slot_index, LogEntry* log_entry) {
     }
 }
 
-void BinLogger::AppendEntryList(
+bool BinLogger::IsBlobRecord(const std::string& buf) {
+    return !buf.empty() && (static_cast<uint8_t>(buf[0]) & kBlobFlag);
+}
+
+void BinLogger::DumpSlot(int64_t slot_index, const LogEntry& log_entry,
+                         std::string* buf) {
+    if (blob_store_ == NULL || log_entry.op != kPut
+        || !blob_store_->ShouldStore(log_entry.value)) {
+        DumpLogEntry(log_entry, buf);
+        return;
+    }
+    LogEntry ref_entry;
+    ref_entry.op = log_entry.op;
+    ref_entry.key = log_entry.key;
+    ref_entry.term = log_entry.term;
+    bool ok = blob_store_->Append(slot_index, log_entry.value, &ref_entry.value);
+    assert(ok);
+    DumpLogEntry(ref_entry, buf);
+    (*buf)[0] = static_cast<char>(static_cast<uint8_t>((*buf)[0]) | kBlobFlag);
+    SealRecord(buf);
+}
+
+uint32_t BinLogger::EntryChecksum(const LogEntry& log_entry) {
+    uint8_t opcode = static_cast<uint8_t>(log_entry.op);
+    int32_t key_size = log_entry.key.size();
+    int32_t value_size = log_entry.value.size();
+    uint32_t crc = crc32c::Value(reinterpret_cast<const char*>(&opcode),
+                                 sizeof(uint8_t));
+    crc = crc32c::Extend(crc, reinterpret_cast<const char*>(&key_size),
+                         sizeof(int32_t));
+    crc = crc32c::Extend(crc, log_entry.key.data(), log_entry.key.size());
+    crc = crc32c::Extend(crc, reinterpret_cast<const char*>(&value_size),
+                         sizeof(int32_t));
+    crc = crc32c::Extend(crc, log_entry.value.data(), log_entry.value.size());
+    return crc32c::Extend(crc, reinterpret_cast<const char*>(&log_entry.term),
+                          sizeof(int64_t));
+}
+
+bool BinLogger::AppendEntryList(
     const ::google::protobuf::RepeatedPtrField< ::galaxy::ins::Entry >& entries
 ) {
+    std::vector<LogEntry> log_entries(entries.size());
+    for (int i = 0; i < entries.size(); i++) {
+        LogEntry& log_entry = log_entries[i];
+        log_entry.op = entries.Get(i).op();
+        log_entry.key = entries.Get(i).key();
+        log_entry.value = entries.Get(i).value();
+        log_entry.term = entries.Get(i).term();
+        if (entries.Get(i).has_checksum()
+            && entries.Get(i).checksum() != EntryChecksum(log_entry)) {
+            LOG(WARNING, "entry %d of the batch fails its checksum", i);
+            return false;
+        }
+    }
     leveldb::WriteBatch batch;
     {
         MutexLock lock(&mu_);
         int64_t cur_index = length_;
         std::string next_index = IntToString(length_ + entries.size());
-        for(int i = 0; i < entries.size(); i++) {
-            LogEntry log_entry;
+        for (size_t i = 0; i < log_entries.size(); i++) {
             std::string buf;
-            log_entry.op = entries.Get(i).op();
-            log_entry.key = entries.Get(i).key();
-            log_entry.value = entries.Get(i).value();
-            log_entry.term = entries.Get(i).term();
-            DumpLogEntry(log_entry, &buf);
+            DumpSlot(cur_index + i, log_entries[i], &buf);
             batch.Put(IntToString(cur_index + i), buf);
         }
         batch.Put(length_tag, next_index);
@@ -106,15 +178,16 @@ void BinLogger::AppendEntryList(
         assert(status.ok());
         length_ += entries.size();
     }
+    return true;
 }
 
 void BinLogger::AppendEntry(const LogEntry& log_entry) {
     std::string buf;
-    DumpLogEntry(log_entry, &buf);
     std::string cur_index;
     std::string next_index;
     {
         MutexLock lock(&mu_);
+        DumpSlot(length_, log_entry, &buf);
         cur_index = IntToString(length_);
         next_index = IntToString(length_ + 1);
         leveldb::WriteBatch batch;
@@ -140,17 +213,29 @@ void BinLogger::Truncate(int64_t trunk_slot_index) {
     }
 }
 
+void BinLogger::Reset(int64_t slot_index, const LogEntry& log_entry) {
+    std::string buf;
+    DumpLogEntry(log_entry, &buf);
+    MutexLock lock(&mu_);
+    leveldb::WriteBatch batch;
+    batch.Put(IntToString(slot_index), buf);
+    batch.Put(length_tag, IntToString(slot_index + 1));
+    leveldb::Status status = db_->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
+    length_ = slot_index + 1;
+}
+
 void BinLogger::DumpLogEntry(const LogEntry& log_entry, std::string* buf) {
     assert(buf);
     int32_t total_len = sizeof(uint8_t) 
                         + sizeof(int32_t) + log_entry.key.size()
                         + sizeof(int32_t) + log_entry.value.size()
-                        + sizeof(int64_t);
+                        + sizeof(int64_t) + sizeof(uint32_t);
     buf->resize(total_len);
     int32_t key_size = log_entry.key.size();
     int32_t value_size = log_entry.value.size();
     char* p = reinterpret_cast<char*>(& ((*buf)[0]));
-    p[0] = static_cast<uint8_t>(log_entry.op);
+    p[0] = static_cast<uint8_t>(log_entry.op) | kChecksumFlag;
     p += sizeof(uint8_t);
     memcpy(p, static_cast<const void*>(&key_size), sizeof(int32_t));
     p += sizeof(int32_t);
@@ -161,28 +246,59 @@ void BinLogger::DumpLogEntry(const LogEntry& log_entry, std::string* buf) {
     memcpy(p, static_cast<const void*>(log_entry.value.data()), log_entry.value.size());
     p += log_entry.value.size();
     memcpy(p, static_cast<const void*>(&log_entry.term), sizeof(int64_t));
+    SealRecord(buf);
+}
+
+void BinLogger::SealRecord(std::string* buf) {
+    size_t body_size = buf->size() - sizeof(uint32_t);
+    uint32_t crc = crc32c::Value(buf->data(), body_size);
+    memcpy(&(*buf)[body_size], static_cast<const void*>(&crc), sizeof(uint32_t));
 }
 
-void BinLogger::LoadLogEntry(const std::string& buf, LogEntry* log_entry) {
+bool BinLogger::LoadLogEntry(const std::string& buf, LogEntry* log_entry) {
     assert(log_entry);  
     const char* p = buf.data();
+    const char* limit = buf.data() + buf.size();
     int32_t key_size = 0;
     int32_t value_size = 0;
     uint8_t opcode = 0;
+    if (buf.size() < sizeof(uint8_t) + sizeof(int32_t) * 2 + sizeof(int64_t)) {
+        return false;
+    }
     memcpy(static_cast<void*>(&opcode), p, sizeof(uint8_t));
-    log_entry->op = static_cast<LogOperation>(opcode);
+    if (opcode & kChecksumFlag) {
+        limit -= sizeof(uint32_t);
+        uint32_t crc = 0;
+        memcpy(static_cast<void*>(&crc), limit, sizeof(uint32_t));
+        if (crc != crc32c::Value(buf.data(), limit - buf.data())) {
+            return false;
+        }
+    }
+    log_entry->op = static_cast<LogOperation>(opcode
+                                              & ~(kBlobFlag | kChecksumFlag));
     p += sizeof(uint8_t);
     memcpy(static_cast<void*>(&key_size), p, sizeof(int32_t));
-    log_entry->key.resize(key_size);
     p += sizeof(int32_t);
-    memcpy(static_cast<void*>(&log_entry->key[0]), p, key_size);
+    if (key_size < 0 || key_size > limit - p) {
+        return false;
+    }
+    log_entry->key.assign(p, key_size);
     p += key_size;
+    if (limit - p < static_cast<int64_t>(sizeof(int32_t))) {
+        return false;
+    }
     memcpy(static_cast<void*>(&value_size), p, sizeof(int32_t));
-    log_entry->value.resize(value_size);
     p += sizeof(int32_t);
-    memcpy(static_cast<void*>(&log_entry->value[0]), p, value_size);
+    if (value_size < 0 || value_size > limit - p) {
+        return false;
+    }
+    log_entry->value.assign(p, value_size);
     p += value_size;
+    if (limit - p != static_cast<int64_t>(sizeof(int64_t))) {
+        return false;
+    }
     memcpy(static_cast<void*>(&log_entry->term), p , sizeof(int64_t));
+    return true;
 }
 
 } //namespace ins 
@@ -12,6 +12,12 @@
 namespace galaxy {
 namespace ins {
 
+class BlobStore;
+
+// set on the op byte of a binlog record that ends with a crc32c of all
+// the bytes before it; records written before checksums have it clear
+const uint8_t kChecksumFlag = 0x40;
+
 struct LogEntry {
     LogOperation op;
     std::string key;
@@ -21,22 +27,37 @@ struct LogEntry {
 
 class BinLogger {
 public:
-    BinLogger(const std::string& data_dir);
+    // big kPut values go to blob_store if there is one
+    BinLogger(const std::string& data_dir, BlobStore* blob_store = NULL);
     ~BinLogger();
     int64_t GetLength();
     bool ReadSlot(int64_t slot_index, LogEntry* log_entry);
+    // leaves a blob value unread: value is empty and blob_ref is set
+    bool ReadSlotRef(int64_t slot_index, LogEntry* log_entry,
+                     std::string* blob_ref);
     void AppendEntry(const LogEntry& log_entry);
     void Truncate(int64_t trunc_slot_index);
+    // start the log over, log_entry becomes its only slot
+    void Reset(int64_t slot_index, const LogEntry& log_entry);
     void DumpLogEntry(const LogEntry& log_entry, std::string* buf);
-    void LoadLogEntry(const std::string& buf, LogEntry* log_entry);
-    void AppendEntryList(
+    // false if the record is truncated or its checksum does not match
+    bool LoadLogEntry(const std::string& buf, LogEntry* log_entry);
+    // false and nothing written if an entry fails its replication checksum
+    bool AppendEntryList(
        const ::google::protobuf::RepeatedPtrField< ::galaxy::ins::Entry > &entries
     );
     bool RemoveSlot(int64_t slot_index);
+    static bool IsBlobRecord(const std::string& buf);
+    // checksum carried by Entry while a log entry is replicated
+    static uint32_t EntryChecksum(const LogEntry& log_entry);
     static std::string IntToString(int64_t num);
     static int64_t StringToInt(const std::string& s);
 private:
+    void DumpSlot(int64_t slot_index, const LogEntry& log_entry,
+                  std::string* buf);
+    static void SealRecord(std::string* buf);
     leveldb::DB* db_;
+    BlobStore* blob_store_;
     int64_t length_;
     Mutex mu_;
 };
@@ -2,7 +2,10 @@
 #include <boost/bind.hpp>
 #include <string>
 #include <stdlib.h>
+#include <unistd.h>
+#include <set>
 #include "binlog.h"
+#include "blob_store.h"
 
 using namespace galaxy::ins;
 
@@ -15,7 +18,7 @@ TEST(BinLogTest, LogEntryDumpLoad) {
     log_entry.term = 1;
     std::string buf;
     bin_logger.DumpLogEntry(log_entry, &buf);
-    EXPECT_EQ(buf.size(), 23u); //#1+4+3+4+3+8
+    EXPECT_EQ(buf.size(), 27u); //#1+4+3+4+3+8+4
     std::string buf2 = buf;
     bin_logger.LoadLogEntry(buf2, &log_entry2);
     EXPECT_EQ(log_entry.key, log_entry2.key);
@@ -84,6 +87,120 @@ TEST(BinLogTest, SlotTruncate) {
     EXPECT_EQ(bin_logger.GetLength(), 0);
 }
 
+TEST(BinLogTest, BlobSlot) {
+    BlobStore blob_store("/tmp/binlog_blob_test/blob", 1024, 4096, 50);
+    BinLogger bin_logger("/tmp/binlog_blob_test", &blob_store);
+    LogEntry log_entry;
+    log_entry.op = kPut;
+    log_entry.key = "big";
+    log_entry.value = std::string(3000, 'x');
+    log_entry.term = 1;
+    bin_logger.AppendEntry(log_entry);
+    int64_t slot = bin_logger.GetLength() - 1;
+    LogEntry log_entry2;
+    EXPECT_TRUE(bin_logger.ReadSlot(slot, &log_entry2));
+    EXPECT_EQ(log_entry2.value, log_entry.value);
+    EXPECT_EQ(log_entry2.op, kPut);
+    LogEntry log_entry3;
+    std::string blob_ref;
+    EXPECT_TRUE(bin_logger.ReadSlotRef(slot, &log_entry3, &blob_ref));
+    EXPECT_TRUE(log_entry3.value.empty());
+    std::string value;
+    EXPECT_TRUE(blob_store.Read(blob_ref, &value));
+    EXPECT_EQ(value, log_entry.value);
+}
+
+TEST(BinLogTest, BlobChecksum) {
+    system("rm -rf /tmp/blob_checksum_test");
+    BlobStore blob_store("/tmp/blob_checksum_test", 1024, 4096, 50);
+    std::string ref;
+    EXPECT_TRUE(blob_store.Append(1, std::string(2000, 'x'), &ref));
+    std::string value;
+    EXPECT_TRUE(blob_store.Read(ref, &value));
+    FILE* fp = fopen("/tmp/blob_checksum_test/000000000001.blob", "r+b");
+    ASSERT_TRUE(fp != NULL);
+    fseek(fp, 100, SEEK_SET);
+    fputc('y', fp);
+    fclose(fp);
+    EXPECT_FALSE(blob_store.Read(ref, &value));
+}
+
+TEST(BinLogTest, BlobGarbage) {
+    system("rm -rf /tmp/blob_garbage_test");
+    BlobStore blob_store("/tmp/blob_garbage_test", 1024, 4096, 60);
+    std::string refs[4];
+    for (int64_t i = 0; i < 4; i++) { //two files of two blobs
+        EXPECT_TRUE(blob_store.Append(i, std::string(2500, 'a' + i), &refs[i]));
+        blob_store.Ref(refs[i]);
+    }
+    EXPECT_EQ(BlobStore::FileNumber(refs[1]), 1);
+    EXPECT_EQ(BlobStore::FileNumber(refs[2]), 2);
+    std::string ref;
+    EXPECT_TRUE(blob_store.Append(4, std::string(2500, 'e'), &ref)); //seals 2
+    blob_store.Unref(refs[0]);
+    blob_store.Unref(refs[2]);
+    blob_store.Unref(refs[3]);
+    std::set<int64_t> sparse_files;
+    blob_store.CollectGarbage(3, &sparse_files);
+    EXPECT_EQ(sparse_files.size(), 1u); //only half of file 1 is live
+    EXPECT_EQ(*sparse_files.begin(), 1);
+    EXPECT_TRUE(access("/tmp/blob_garbage_test/000000000002.blob", F_OK) != 0);
+    std::string new_ref;
+    EXPECT_TRUE(blob_store.Relocate(refs[1], &new_ref));
+    blob_store.Unref(refs[1]);
+    sparse_files.clear();
+    blob_store.CollectGarbage(3, &sparse_files);
+    EXPECT_TRUE(sparse_files.empty());
+    EXPECT_TRUE(access("/tmp/blob_garbage_test/000000000001.blob", F_OK) != 0);
+    std::string value;
+    EXPECT_TRUE(blob_store.Read(new_ref, &value));
+    EXPECT_EQ(value, std::string(2500, 'b'));
+}
+
+TEST(BinLogTest, CorruptedRecord) {
+    BinLogger bin_logger("/tmp/");
+    LogEntry log_entry, log_entry2;
+    log_entry.op = kPut;
+    log_entry.key = "abc";
+    log_entry.value = "123";
+    log_entry.term = 1;
+    std::string buf;
+    bin_logger.DumpLogEntry(log_entry, &buf);
+    EXPECT_TRUE(bin_logger.LoadLogEntry(buf, &log_entry2));
+    std::string flipped = buf;
+    flipped[6] ^= 0x01;
+    EXPECT_FALSE(bin_logger.LoadLogEntry(flipped, &log_entry2));
+    std::string truncated = buf.substr(0, buf.size() - 6);
+    EXPECT_FALSE(bin_logger.LoadLogEntry(truncated, &log_entry2));
+    std::string old_format = buf.substr(0, buf.size() - 4); //no checksum
+    old_format[0] = static_cast<char>(kPut);
+    EXPECT_TRUE(bin_logger.LoadLogEntry(old_format, &log_entry2));
+    EXPECT_EQ(log_entry2.value, "123");
+    EXPECT_EQ(log_entry2.op, kPut);
+}
+
+TEST(BinLogTest, EntryChecksum) {
+    BinLogger bin_logger("/tmp/binlog_checksum_test");
+    ::google::protobuf::RepeatedPtrField< ::galaxy::ins::Entry > entries;
+    LogEntry log_entry;
+    log_entry.op = kPut;
+    log_entry.key = "key";
+    log_entry.value = "value";
+    log_entry.term = 1;
+    ::galaxy::ins::Entry* entry = entries.Add();
+    entry->set_key(log_entry.key);
+    entry->set_value(log_entry.value);
+    entry->set_term(log_entry.term);
+    entry->set_op(log_entry.op);
+    entry->set_checksum(BinLogger::EntryChecksum(log_entry));
+    int64_t length = bin_logger.GetLength();
+    EXPECT_TRUE(bin_logger.AppendEntryList(entries));
+    EXPECT_EQ(bin_logger.GetLength(), length + 1);
+    entry->set_value("valuf");
+    EXPECT_FALSE(bin_logger.AppendEntryList(entries));
+    EXPECT_EQ(bin_logger.GetLength(), length + 1);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
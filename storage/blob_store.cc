@@ -0,0 +1,274 @@
+#include "blob_store.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <vector>
+#include "common/logging.h"
+#include "crc32c.h"
+#include "utils.h"
+
+namespace galaxy {
+namespace ins {
+
+const std::string blob_file_suffix = ".blob";
+static const size_t kRecordHeader = sizeof(int64_t) * 3;
+static const size_t kRefSize = sizeof(int64_t) * 3;
+
+static void ParseRef(const leveldb::Slice& ref, int64_t* file_no,
+                     int64_t* offset, int64_t* size) {
+    memcpy(file_no, ref.data(), sizeof(int64_t));
+    memcpy(offset, ref.data() + sizeof(int64_t), sizeof(int64_t));
+    memcpy(size, ref.data() + sizeof(int64_t) * 2, sizeof(int64_t));
+}
+
+BlobStore::BlobStore(const std::string& data_dir,
+                     int64_t min_blob_size,
+                     int64_t max_file_size,
+                     int32_t min_live_percent) : data_dir_(data_dir),
+                                                 min_blob_size_(min_blob_size),
+                                                 max_file_size_(max_file_size),
+                                                 min_live_percent_(min_live_percent),
+                                                 cur_fp_(NULL),
+                                                 cur_file_no_(0),
+                                                 cur_offset_(0) {
+    bool ok = ins_common::Mkdirs(data_dir.c_str());
+    if (!ok) {
+        LOG(FATAL, "failed to create dir :%s", data_dir.c_str());
+        abort();
+    }
+    DIR* dir = opendir(data_dir.c_str());
+    assert(dir);
+    struct dirent* ent = NULL;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        if (name.size() <= blob_file_suffix.size()
+            || name.substr(name.size() - blob_file_suffix.size())
+               != blob_file_suffix) {
+            continue;
+        }
+        int64_t file_no = atol(name.c_str());
+        ScanFile(file_no, &files_[file_no]);
+        cur_file_no_ = std::max(cur_file_no_, file_no);
+    }
+    closedir(dir);
+    LOG(INFO, "%ld blob files in %s", files_.size(), data_dir.c_str());
+}
+
+BlobStore::~BlobStore() {
+    if (cur_fp_) {
+        fclose(cur_fp_);
+    }
+}
+
+std::string BlobStore::FileName(int64_t file_no) {
+    char buf[64] = {'\0'};
+    snprintf(buf, sizeof(buf), "/%012ld", file_no);
+    return data_dir_ + buf + blob_file_suffix;
+}
+
+void BlobStore::ScanFile(int64_t file_no, BlobFile* file) {
+    std::string file_name = FileName(file_no);
+    FILE* fp = fopen(file_name.c_str(), "rb");
+    if (!fp) {
+        return;
+    }
+    int64_t header[3];
+    while (fread(header, sizeof(int64_t), 3, fp) == 3) {
+        file->max_slot = std::max(file->max_slot, header[0]);
+        file->total_bytes += header[1];
+        if (fseek(fp, header[1], SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+bool BlobStore::OpenNewFile() {
+    mu_.AssertHeld();
+    if (cur_fp_) {
+        fclose(cur_fp_);
+    }
+    //never append to a file of an earlier run, its tail may be torn
+    cur_file_no_++;
+    std::string file_name = FileName(cur_file_no_);
+    cur_fp_ = fopen(file_name.c_str(), "ab");
+    if (!cur_fp_) {
+        LOG(FATAL, "failed to open blob file %s", file_name.c_str());
+        return false;
+    }
+    cur_offset_ = 0;
+    files_[cur_file_no_] = BlobFile();
+    return true;
+}
+
+bool BlobStore::ShouldStore(const std::string& value) const {
+    return min_blob_size_ > 0
+           && static_cast<int64_t>(value.size()) >= min_blob_size_;
+}
+
+bool BlobStore::Append(int64_t slot_index,
+                       const std::string& value,
+                       std::string* ref) {
+    MutexLock lock(&mu_);
+    if (cur_fp_ == NULL || cur_offset_ >= max_file_size_) {
+        if (!OpenNewFile()) {
+            return false;
+        }
+    }
+    int64_t header[3] = {slot_index, static_cast<int64_t>(value.size()),
+                         crc32c::Value(value.data(), value.size())};
+    //the binlog record pointing here is written right after, it must not
+    //outlive the blob in a crash
+    bool ok = fwrite(header, sizeof(int64_t), 3, cur_fp_) == 3
+              && fwrite(value.data(), 1, value.size(), cur_fp_) == value.size()
+              && fflush(cur_fp_) == 0
+              && fsync(fileno(cur_fp_)) == 0;
+    if (!ok) {
+        LOG(FATAL, "failed to append blob of slot %ld", slot_index);
+        return false;
+    }
+    int64_t offset = cur_offset_ + kRecordHeader;
+    int64_t size = value.size();
+    ref->resize(kRefSize);
+    memcpy(&(*ref)[0], &cur_file_no_, sizeof(int64_t));
+    memcpy(&(*ref)[sizeof(int64_t)], &offset, sizeof(int64_t));
+    memcpy(&(*ref)[sizeof(int64_t) * 2], &size, sizeof(int64_t));
+    cur_offset_ += kRecordHeader + value.size();
+    BlobFile& file = files_[cur_file_no_];
+    file.max_slot = std::max(file.max_slot, slot_index);
+    file.total_bytes += size;
+    return true;
+}
+
+int64_t BlobStore::FileNumber(const leveldb::Slice& ref) {
+    assert(ref.size() == kRefSize);
+    int64_t file_no = 0;
+    memcpy(&file_no, ref.data(), sizeof(int64_t));
+    return file_no;
+}
+
+bool BlobStore::ReadRecord(const leveldb::Slice& ref, int64_t* slot_index,
+                           std::string* value) {
+    if (ref.size() != kRefSize) {
+        LOG(FATAL, "bad blob reference, size: %ld", ref.size());
+        return false;
+    }
+    int64_t file_no = 0;
+    int64_t offset = 0;
+    int64_t size = 0;
+    ParseRef(ref, &file_no, &offset, &size);
+    std::string file_name = FileName(file_no);
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(FATAL, "failed to open blob file %s", file_name.c_str());
+        return false;
+    }
+    std::string buf(kRecordHeader + size, '\0');
+    ssize_t n = pread(fd, &buf[0], buf.size(), offset - kRecordHeader);
+    close(fd);
+    if (n != static_cast<ssize_t>(buf.size())) {
+        LOG(FATAL, "short read on blob file %s at %ld", file_name.c_str(), offset);
+        return false;
+    }
+    int64_t header[3];
+    memcpy(header, buf.data(), kRecordHeader);
+    if (header[1] != size
+        || static_cast<uint32_t>(header[2])
+           != crc32c::Value(buf.data() + kRecordHeader, size)) {
+        LOG(FATAL, "blob checksum mismatch in %s at %ld",
+            file_name.c_str(), offset);
+        return false;
+    }
+    *slot_index = header[0];
+    value->assign(buf, kRecordHeader, size);
+    return true;
+}
+
+bool BlobStore::Read(const leveldb::Slice& ref, std::string* value) {
+    int64_t slot_index = 0;
+    return ReadRecord(ref, &slot_index, value);
+}
+
+bool BlobStore::Relocate(const leveldb::Slice& ref, std::string* new_ref) {
+    int64_t slot_index = 0;
+    std::string value;
+    if (!ReadRecord(ref, &slot_index, &value)
+        || !Append(slot_index, value, new_ref)) {
+        return false;
+    }
+    Ref(*new_ref);
+    return true;
+}
+
+void BlobStore::Ref(const leveldb::Slice& ref) {
+    int64_t file_no = 0;
+    int64_t offset = 0;
+    int64_t size = 0;
+    ParseRef(ref, &file_no, &offset, &size);
+    MutexLock lock(&mu_);
+    std::map<int64_t, BlobFile>::iterator it = files_.find(file_no);
+    if (it == files_.end()) {
+        LOG(WARNING, "reference to missing blob file %ld", file_no);
+        return;
+    }
+    if (it->second.refs[offset]++ == 0) {
+        it->second.live_bytes += size;
+    }
+}
+
+void BlobStore::Unref(const leveldb::Slice& ref) {
+    int64_t file_no = 0;
+    int64_t offset = 0;
+    int64_t size = 0;
+    ParseRef(ref, &file_no, &offset, &size);
+    MutexLock lock(&mu_);
+    std::map<int64_t, BlobFile>::iterator it = files_.find(file_no);
+    if (it == files_.end()) {
+        return;
+    }
+    std::map<int64_t, int32_t>::iterator rt = it->second.refs.find(offset);
+    if (rt != it->second.refs.end() && --rt->second <= 0) {
+        it->second.refs.erase(rt);
+        it->second.live_bytes -= size;
+    }
+}
+
+void BlobStore::CollectGarbage(int64_t cleaned_slot_index,
+                               std::set<int64_t>* sparse_files) {
+    std::vector<int64_t> dead_files;
+    {
+        MutexLock lock(&mu_);
+        std::map<int64_t, BlobFile>::iterator it = files_.begin();
+        while (it != files_.end()) {
+            BlobFile& file = it->second;
+            if (it->first == cur_file_no_
+                || file.max_slot > cleaned_slot_index) {
+                it++;
+            } else if (file.refs.empty()) {
+                dead_files.push_back(it->first);
+                files_.erase(it++);
+            } else {
+                if (sparse_files && !file.rewritten
+                    && file.live_bytes * 100
+                       < file.total_bytes * min_live_percent_) {
+                    LOG(INFO, "blob file %ld keeps %ld of %ld bytes, rewrite it",
+                        it->first, file.live_bytes, file.total_bytes);
+                    file.rewritten = true;
+                    sparse_files->insert(it->first);
+                }
+                it++;
+            }
+        }
+    }
+    for (size_t i = 0; i < dead_files.size(); i++) {
+        std::string file_name = FileName(dead_files[i]);
+        LOG(INFO, "remove blob file %s", file_name.c_str());
+        if (unlink(file_name.c_str()) != 0) {
+            LOG(WARNING, "failed to remove %s", file_name.c_str());
+        }
+    }
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,79 @@
+#ifndef GALAXY_INS_BLOB_STORE_H_
+#define GALAXY_INS_BLOB_STORE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <string>
+#include "common/mutex.h"
+#include "leveldb/slice.h"
+
+namespace galaxy {
+namespace ins {
+
+// set on the op byte of a binlog record or a store value whose payload is
+// a blob reference instead of the value itself
+const uint8_t kBlobFlag = 0x80;
+
+// Append-only files holding values too big to be written inline into the
+// binlog and the store, so leveldb compactions never rewrite them.
+// A record is [slot index][value size][crc32c][value], a reference names
+// the file, the offset and the size. References are local to one node,
+// replication always ships the real value.
+// The owner counts every store key holding a reference with Ref/Unref, a
+// sealed file is deleted once the binlog was cleaned past every slot it
+// holds and nothing refers to it, one mostly dead is handed back to be
+// rewritten.
+class BlobStore {
+public:
+    BlobStore(const std::string& data_dir,
+              int64_t min_blob_size,
+              int64_t max_file_size,
+              int32_t min_live_percent);
+    ~BlobStore();
+    bool ShouldStore(const std::string& value) const;
+    // the record is on disk when this returns
+    bool Append(int64_t slot_index, const std::string& value, std::string* ref);
+    bool Read(const leveldb::Slice& ref, std::string* value);
+    // copies the blob into the current file, the copy holds one reference
+    bool Relocate(const leveldb::Slice& ref, std::string* new_ref);
+    void Ref(const leveldb::Slice& ref);
+    void Unref(const leveldb::Slice& ref);
+    static bool IsBlobValue(const leveldb::Slice& value) {
+        return value.size() >= 1 && (value[0] & kBlobFlag);
+    }
+    static int64_t FileNumber(const leveldb::Slice& ref);
+    // sparse_files: cleaned files to rewrite, each one is reported once
+    void CollectGarbage(int64_t cleaned_slot_index,
+                        std::set<int64_t>* sparse_files);
+private:
+    struct BlobFile {
+        int64_t max_slot;
+        int64_t total_bytes;
+        int64_t live_bytes;
+        bool rewritten;
+        std::map<int64_t, int32_t> refs; //offset -> references
+        BlobFile() : max_slot(-1), total_bytes(0), live_bytes(0),
+                     rewritten(false) {}
+    };
+    std::string FileName(int64_t file_no);
+    bool OpenNewFile();
+    void ScanFile(int64_t file_no, BlobFile* file);
+    bool ReadRecord(const leveldb::Slice& ref, int64_t* slot_index,
+                    std::string* value);
+    std::string data_dir_;
+    int64_t min_blob_size_;
+    int64_t max_file_size_;
+    int32_t min_live_percent_;
+    FILE* cur_fp_;
+    int64_t cur_file_no_;
+    int64_t cur_offset_;
+    std::map<int64_t, BlobFile> files_;
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
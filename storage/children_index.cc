@@ -0,0 +1,88 @@
+#include "children_index.h"
+
+namespace galaxy {
+namespace ins {
+
+ChildrenIndex::ChildrenIndex() : size_(0) {
+}
+
+bool ChildrenIndex::SplitKey(const std::string& key,
+                             std::string* parent,
+                             std::string* name) {
+    std::string::size_type tail_index = key.rfind("/");
+    if (tail_index == std::string::npos) {
+        return false;
+    }
+    *parent = key.substr(0, tail_index);
+    *name = key.substr(tail_index + 1);
+    return true;
+}
+
+void ChildrenIndex::Add(const std::string& key) {
+    std::string parent;
+    std::string name;
+    if (!SplitKey(key, &parent, &name)) {
+        return;
+    }
+    MutexLock lock(&mu_);
+    if (children_[parent].insert(name).second) {
+        size_++;
+    }
+}
+
+void ChildrenIndex::Remove(const std::string& key) {
+    std::string parent;
+    std::string name;
+    if (!SplitKey(key, &parent, &name)) {
+        return;
+    }
+    MutexLock lock(&mu_);
+    ChildrenMap::iterator it = children_.find(parent);
+    if (it == children_.end()) {
+        return;
+    }
+    if (it->second.erase(name) > 0) {
+        size_--;
+    }
+    if (it->second.empty()) {
+        children_.erase(it);
+    }
+}
+
+void ChildrenIndex::Clear() {
+    MutexLock lock(&mu_);
+    children_.clear();
+    size_ = 0;
+}
+
+void ChildrenIndex::List(const std::string& parent,
+                         const std::string& start_after,
+                         int32_t size_limit,
+                         std::vector<std::string>* names,
+                         bool* has_more) {
+    *has_more = false;
+    MutexLock lock(&mu_);
+    ChildrenMap::const_iterator it = children_.find(parent);
+    if (it == children_.end()) {
+        return;
+    }
+    std::set<std::string>::const_iterator jt = it->second.begin();
+    if (!start_after.empty()) {
+        jt = it->second.upper_bound(start_after);
+    }
+    for (; jt != it->second.end(); jt++) {
+        if (static_cast<int32_t>(names->size()) >= size_limit) {
+            *has_more = true;
+            break;
+        }
+        names->push_back(*jt);
+    }
+}
+
+int64_t ChildrenIndex::Size() {
+    MutexLock lock(&mu_);
+    return size_;
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,45 @@
+#ifndef GALAXY_INS_CHILDREN_INDEX_H_
+#define GALAXY_INS_CHILDREN_INDEX_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/mutex.h"
+
+namespace galaxy {
+namespace ins {
+
+// Direct children of every parent path, the same split on the last '/'
+// that watches use to notify a parent: "/a/b/c" is child "c" of "/a/b",
+// "/a" is child "a" of the root "". Keys without '/' have no parent and
+// are not indexed. Only names are kept, values stay in the store.
+class ChildrenIndex {
+public:
+    ChildrenIndex();
+    void Add(const std::string& key);
+    void Remove(const std::string& key);
+    void Clear();
+    // names after start_after in order, at most size_limit of them
+    void List(const std::string& parent,
+              const std::string& start_after,
+              int32_t size_limit,
+              std::vector<std::string>* names,
+              bool* has_more);
+    int64_t Size();
+    // false if the key has no parent
+    static bool SplitKey(const std::string& key,
+                         std::string* parent,
+                         std::string* name);
+private:
+    typedef std::map<std::string, std::set<std::string> > ChildrenMap;
+    ChildrenMap children_;
+    int64_t size_;
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "children_index.h"
+
+using namespace galaxy::ins;
+
+TEST(ChildrenIndexTest, OnlyDirectChildren) {
+    ChildrenIndex index;
+    index.Add("/services/web/host1");
+    index.Add("/services/web/host2");
+    index.Add("/services/web/host2/detail");
+    index.Add("/services/db");
+    std::vector<std::string> names;
+    bool has_more = true;
+    index.List("/services/web", "", 100, &names, &has_more);
+    ASSERT_EQ(names.size(), 2u);
+    EXPECT_EQ(names[0], "host1");
+    EXPECT_EQ(names[1], "host2");
+    EXPECT_FALSE(has_more);
+    EXPECT_EQ(index.Size(), 4);
+}
+
+TEST(ChildrenIndexTest, Paging) {
+    ChildrenIndex index;
+    index.Add("/dir/a");
+    index.Add("/dir/b");
+    index.Add("/dir/c");
+    index.Add("/dir/a"); //no duplicates
+    std::vector<std::string> names;
+    bool has_more = false;
+    index.List("/dir", "", 2, &names, &has_more);
+    ASSERT_EQ(names.size(), 2u);
+    EXPECT_TRUE(has_more);
+    std::vector<std::string> rest;
+    index.List("/dir", names.back(), 2, &rest, &has_more);
+    ASSERT_EQ(rest.size(), 1u);
+    EXPECT_EQ(rest[0], "c");
+    EXPECT_FALSE(has_more);
+}
+
+TEST(ChildrenIndexTest, Remove) {
+    ChildrenIndex index;
+    index.Add("/dir/a");
+    index.Add("/top");
+    index.Add("no_parent");
+    index.Remove("/dir/a");
+    index.Remove("/dir/missing");
+    std::vector<std::string> names;
+    bool has_more = false;
+    index.List("/dir", "", 10, &names, &has_more);
+    EXPECT_TRUE(names.empty());
+    index.List("", "", 10, &names, &has_more);
+    ASSERT_EQ(names.size(), 1u);
+    EXPECT_EQ(names[0], "top");
+    EXPECT_EQ(index.Size(), 1);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
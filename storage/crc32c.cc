@@ -0,0 +1,123 @@
+#include "crc32c.h"
+
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define INS_CRC32C_SSE42 1
+#endif
+
+namespace galaxy {
+namespace ins {
+namespace crc32c {
+
+static const uint32_t kPoly = 0x82f63b78; //reversed Castagnoli polynomial
+
+// slicing by 4: table[k][b] is the crc of byte b followed by k zero bytes
+struct Table {
+    uint32_t t[4][256];
+    Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kPoly : 0);
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 4; k++) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static const Table table;
+
+uint32_t ExtendPortable(uint32_t init, const char* data, size_t n) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint32_t crc = init ^ 0xffffffffu;
+    while (n >= 4) {
+        uint32_t word = 0;
+        memcpy(&word, p, sizeof(word)); //little endian only, as the binlog
+        crc ^= word;
+        crc = table.t[3][crc & 0xff] ^ table.t[2][(crc >> 8) & 0xff]
+              ^ table.t[1][(crc >> 16) & 0xff] ^ table.t[0][crc >> 24];
+        p += 4;
+        n -= 4;
+    }
+    while (n > 0) {
+        crc = table.t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+        p++;
+        n--;
+    }
+    return crc ^ 0xffffffffu;
+}
+
+#ifdef INS_CRC32C_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t ExtendHardware(uint32_t init, const char* data, size_t n) {
+    const char* p = data;
+    uint32_t crc = init ^ 0xffffffffu;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t word = 0;
+        memcpy(&word, p, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    while (n >= 4) {
+        uint32_t word = 0;
+        memcpy(&word, p, sizeof(word));
+        crc = __builtin_ia32_crc32si(crc, word);
+        p += 4;
+        n -= 4;
+    }
+    while (n > 0) {
+        crc = __builtin_ia32_crc32qi(crc, static_cast<uint8_t>(*p));
+        p++;
+        n--;
+    }
+    return crc ^ 0xffffffffu;
+}
+
+static bool DetectSSE42() {
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_SSE4_2) != 0;
+}
+
+static const bool has_sse42 = DetectSSE42();
+
+bool IsHardwareAccelerated() {
+    return has_sse42;
+}
+
+uint32_t Extend(uint32_t init, const char* data, size_t n) {
+    if (has_sse42) {
+        return ExtendHardware(init, data, n);
+    }
+    return ExtendPortable(init, data, n);
+}
+
+#else
+
+bool IsHardwareAccelerated() {
+    return false;
+}
+
+uint32_t Extend(uint32_t init, const char* data, size_t n) {
+    return ExtendPortable(init, data, n);
+}
+
+#endif
+
+} //namespace crc32c
+} //namespace ins
+} //namespace galaxy
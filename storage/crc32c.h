@@ -0,0 +1,28 @@
+#ifndef GALAXY_INS_CRC32C_H_
+#define GALAXY_INS_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace galaxy {
+namespace ins {
+namespace crc32c {
+
+// CRC32C (Castagnoli) of data appended to a stream whose crc is init.
+// Uses the SSE4.2 crc32 instruction when the cpu has it, a table otherwise.
+uint32_t Extend(uint32_t init, const char* data, size_t n);
+
+inline uint32_t Value(const char* data, size_t n) {
+    return Extend(0, data, n);
+}
+
+// the table version, always available
+uint32_t ExtendPortable(uint32_t init, const char* data, size_t n);
+
+bool IsHardwareAccelerated();
+
+} //namespace crc32c
+} //namespace ins
+} //namespace galaxy
+
+#endif
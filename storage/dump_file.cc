@@ -0,0 +1,199 @@
+#include "dump_file.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "crc32c.h"
+
+namespace galaxy {
+namespace ins {
+
+const std::string dump_magic = "INSDUMP2";
+static const int64_t kTrailerMark = -1; //in place of a chunk's raw size
+
+void DumpFile::EncodeRecord(const leveldb::Slice& key,
+                            const leveldb::Slice& value,
+                            std::string* buf) {
+    int32_t key_size = key.size();
+    int32_t value_size = value.size();
+    buf->append(reinterpret_cast<const char*>(&key_size), sizeof(int32_t));
+    buf->append(key.data(), key.size());
+    buf->append(reinterpret_cast<const char*>(&value_size), sizeof(int32_t));
+    buf->append(value.data(), value.size());
+}
+
+bool DumpFile::DecodeRecord(leveldb::Slice* input,
+                            leveldb::Slice* key,
+                            leveldb::Slice* value) {
+    int32_t key_size = 0;
+    int32_t value_size = 0;
+    if (input->size() < sizeof(int32_t)) {
+        return false;
+    }
+    memcpy(&key_size, input->data(), sizeof(int32_t));
+    input->remove_prefix(sizeof(int32_t));
+    if (key_size < 0 || input->size() < key_size + sizeof(int32_t)) {
+        return false;
+    }
+    *key = leveldb::Slice(input->data(), key_size);
+    input->remove_prefix(key_size);
+    memcpy(&value_size, input->data(), sizeof(int32_t));
+    input->remove_prefix(sizeof(int32_t));
+    if (value_size < 0 || input->size() < static_cast<size_t>(value_size)) {
+        return false;
+    }
+    *value = leveldb::Slice(input->data(), value_size);
+    input->remove_prefix(value_size);
+    return true;
+}
+
+bool DumpFile::CompressChunk(const std::string& raw,
+                             std::string* compressed,
+                             uint32_t* checksum) {
+    uLongf len = compressBound(raw.size());
+    compressed->resize(len);
+    int ret = compress2(reinterpret_cast<Bytef*>(&(*compressed)[0]), &len,
+                        reinterpret_cast<const Bytef*>(raw.data()), raw.size(),
+                        Z_BEST_SPEED);
+    if (ret != Z_OK) {
+        return false;
+    }
+    compressed->resize(len);
+    *checksum = crc32(0L, reinterpret_cast<const Bytef*>(raw.data()), raw.size());
+    return true;
+}
+
+bool DumpFile::UncompressChunk(const std::string& compressed,
+                               int64_t raw_size,
+                               uint32_t checksum,
+                               std::string* raw) {
+    if (raw_size < 0) {
+        return false;
+    }
+    raw->resize(raw_size);
+    uLongf len = raw_size;
+    if (raw_size > 0) {
+        int ret = uncompress(reinterpret_cast<Bytef*>(&(*raw)[0]), &len,
+                             reinterpret_cast<const Bytef*>(compressed.data()),
+                             compressed.size());
+        if (ret != Z_OK || len != static_cast<uLongf>(raw_size)) {
+            return false;
+        }
+    }
+    return crc32(0L, reinterpret_cast<const Bytef*>(raw->data()), raw->size())
+           == checksum;
+}
+
+DumpWriter::DumpWriter() : fp_(NULL), crc_(0), record_count_(0) {
+}
+
+DumpWriter::~DumpWriter() {
+    if (fp_) {
+        fclose(fp_);
+    }
+}
+
+bool DumpWriter::Write(const void* data, size_t size) {
+    crc_ = crc32c::Extend(crc_, static_cast<const char*>(data), size);
+    return size == 0 || fwrite(data, 1, size, fp_) == size;
+}
+
+bool DumpWriter::Open(const std::string& file_name,
+                      int64_t applied_index, int64_t term) {
+    fp_ = fopen(file_name.c_str(), "wb");
+    if (!fp_) {
+        return false;
+    }
+    crc_ = 0;
+    record_count_ = 0;
+    return Write(dump_magic.data(), dump_magic.size())
+           && Write(&applied_index, sizeof(int64_t))
+           && Write(&term, sizeof(int64_t));
+}
+
+bool DumpWriter::AppendChunk(const std::string& compressed,
+                             int64_t raw_size, uint32_t checksum,
+                             int64_t record_count) {
+    int64_t compressed_size = compressed.size();
+    record_count_ += record_count;
+    return Write(&raw_size, sizeof(int64_t))
+           && Write(&checksum, sizeof(uint32_t))
+           && Write(&compressed_size, sizeof(int64_t))
+           && Write(compressed.data(), compressed.size());
+}
+
+bool DumpWriter::Close() {
+    bool ok = Write(&kTrailerMark, sizeof(int64_t))
+              && Write(&record_count_, sizeof(int64_t));
+    uint32_t crc = crc_;
+    ok = ok && fwrite(&crc, sizeof(uint32_t), 1, fp_) == 1
+         && fflush(fp_) == 0 && fsync(fileno(fp_)) == 0;
+    ok = (fclose(fp_) == 0) && ok;
+    fp_ = NULL;
+    return ok;
+}
+
+DumpReader::DumpReader() : fp_(NULL), corrupted_(false), crc_(0),
+                           record_count_(-1) {
+}
+
+DumpReader::~DumpReader() {
+    if (fp_) {
+        fclose(fp_);
+    }
+}
+
+bool DumpReader::Read(void* data, size_t size) {
+    if (size > 0 && fread(data, 1, size, fp_) != size) {
+        return false;
+    }
+    crc_ = crc32c::Extend(crc_, static_cast<const char*>(data), size);
+    return true;
+}
+
+bool DumpReader::Open(const std::string& file_name,
+                      int64_t* applied_index, int64_t* term) {
+    fp_ = fopen(file_name.c_str(), "rb");
+    if (!fp_) {
+        return false;
+    }
+    std::string magic(dump_magic.size(), '\0');
+    return Read(&magic[0], magic.size())
+           && magic == dump_magic
+           && Read(applied_index, sizeof(int64_t))
+           && Read(term, sizeof(int64_t));
+}
+
+bool DumpReader::NextChunk(std::string* raw) {
+    int64_t raw_size = 0;
+    uint32_t checksum = 0;
+    int64_t compressed_size = 0;
+    if (!Read(&raw_size, sizeof(int64_t))) {
+        corrupted_ = true; //cut off before the trailer
+        return false;
+    }
+    if (raw_size == kTrailerMark) {
+        uint32_t crc = 0;
+        corrupted_ = !Read(&record_count_, sizeof(int64_t));
+        uint32_t expected_crc = crc_;
+        corrupted_ = corrupted_
+                     || fread(&crc, sizeof(uint32_t), 1, fp_) != 1
+                     || crc != expected_crc
+                     || fgetc(fp_) != EOF;
+        return false;
+    }
+    std::string compressed;
+    bool ok = Read(&checksum, sizeof(uint32_t))
+              && Read(&compressed_size, sizeof(int64_t))
+              && compressed_size >= 0;
+    if (ok) {
+        compressed.resize(compressed_size);
+        ok = compressed_size == 0 || Read(&compressed[0], compressed_size);
+    }
+    ok = ok && DumpFile::UncompressChunk(compressed, raw_size, checksum, raw);
+    corrupted_ = !ok;
+    return ok;
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,80 @@
+#ifndef GALAXY_INS_DUMP_FILE_H_
+#define GALAXY_INS_DUMP_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "leveldb/slice.h"
+
+namespace galaxy {
+namespace ins {
+
+// A backup of the store: a header with the applied index and its term,
+// then chunks of zlib-compressed records, each checked by the crc32 of
+// its raw bytes, then a trailer with the record count and the crc32c of
+// every byte before it. A record is [key size][key][value size][value],
+// values are stored as the store keeps them, op byte first.
+class DumpFile {
+public:
+    static void EncodeRecord(const leveldb::Slice& key,
+                             const leveldb::Slice& value,
+                             std::string* buf);
+    // advances input past the record
+    static bool DecodeRecord(leveldb::Slice* input,
+                             leveldb::Slice* key,
+                             leveldb::Slice* value);
+    static bool CompressChunk(const std::string& raw,
+                              std::string* compressed,
+                              uint32_t* checksum);
+    static bool UncompressChunk(const std::string& compressed,
+                                int64_t raw_size,
+                                uint32_t checksum,
+                                std::string* raw);
+};
+
+class DumpWriter {
+public:
+    DumpWriter();
+    ~DumpWriter();
+    bool Open(const std::string& file_name,
+              int64_t applied_index, int64_t term);
+    bool AppendChunk(const std::string& compressed,
+                     int64_t raw_size, uint32_t checksum,
+                     int64_t record_count);
+    // writes the trailer and syncs the file
+    bool Close();
+private:
+    bool Write(const void* data, size_t size);
+    FILE* fp_;
+    uint32_t crc_;
+    int64_t record_count_;
+};
+
+class DumpReader {
+public:
+    DumpReader();
+    ~DumpReader();
+    bool Open(const std::string& file_name,
+              int64_t* applied_index, int64_t* term);
+    // false at the trailer or on a broken chunk, see Corrupted
+    bool NextChunk(std::string* raw);
+    // a broken chunk, a missing trailer or a file checksum mismatch
+    bool Corrupted() const {
+        return corrupted_;
+    }
+    // as the trailer says, valid once NextChunk returned false
+    int64_t RecordCount() const {
+        return record_count_;
+    }
+private:
+    bool Read(void* data, size_t size);
+    FILE* fp_;
+    bool corrupted_;
+    uint32_t crc_;
+    int64_t record_count_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include "dump_file.h"
+
+using namespace galaxy::ins;
+
+TEST(DumpFileTest, WriteRead) {
+    std::string raw;
+    DumpFile::EncodeRecord("key1", "value1", &raw);
+    DumpFile::EncodeRecord("key2", std::string(10000, 'v'), &raw);
+    std::string compressed;
+    uint32_t checksum = 0;
+    ASSERT_TRUE(DumpFile::CompressChunk(raw, &compressed, &checksum));
+    EXPECT_LT(compressed.size(), raw.size());
+
+    DumpWriter writer;
+    ASSERT_TRUE(writer.Open("/tmp/dump_file_test.dump", 42, 3));
+    ASSERT_TRUE(writer.AppendChunk(compressed, raw.size(), checksum, 2));
+    ASSERT_TRUE(writer.Close());
+
+    DumpReader reader;
+    int64_t applied_index = 0;
+    int64_t term = 0;
+    ASSERT_TRUE(reader.Open("/tmp/dump_file_test.dump", &applied_index, &term));
+    EXPECT_EQ(applied_index, 42);
+    EXPECT_EQ(term, 3);
+    std::string raw2;
+    ASSERT_TRUE(reader.NextChunk(&raw2));
+    leveldb::Slice input(raw2);
+    leveldb::Slice key;
+    leveldb::Slice value;
+    ASSERT_TRUE(DumpFile::DecodeRecord(&input, &key, &value));
+    EXPECT_EQ(key.ToString(), "key1");
+    EXPECT_EQ(value.ToString(), "value1");
+    ASSERT_TRUE(DumpFile::DecodeRecord(&input, &key, &value));
+    EXPECT_EQ(value.size(), 10000u);
+    EXPECT_TRUE(input.empty());
+    EXPECT_FALSE(reader.NextChunk(&raw2));
+    EXPECT_FALSE(reader.Corrupted());
+    EXPECT_EQ(reader.RecordCount(), 2);
+}
+
+TEST(DumpFileTest, Trailer) {
+    std::string raw;
+    DumpFile::EncodeRecord("key", "value", &raw);
+    std::string compressed;
+    uint32_t checksum = 0;
+    ASSERT_TRUE(DumpFile::CompressChunk(raw, &compressed, &checksum));
+    DumpWriter writer;
+    ASSERT_TRUE(writer.Open("/tmp/dump_trailer_test.dump", 7, 1));
+    ASSERT_TRUE(writer.AppendChunk(compressed, raw.size(), checksum, 1));
+    ASSERT_TRUE(writer.Close());
+    FILE* fp = fopen("/tmp/dump_trailer_test.dump", "rb");
+    ASSERT_TRUE(fp != NULL);
+    std::string data;
+    char buf[4096];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(fp);
+
+    //cut off before the trailer
+    std::string cut = data.substr(0, data.size() - 20);
+    fp = fopen("/tmp/dump_trailer_test.dump", "wb");
+    fwrite(cut.data(), 1, cut.size(), fp);
+    fclose(fp);
+    DumpReader reader;
+    int64_t applied_index = 0;
+    int64_t term = 0;
+    ASSERT_TRUE(reader.Open("/tmp/dump_trailer_test.dump", &applied_index, &term));
+    std::string raw2;
+    EXPECT_TRUE(reader.NextChunk(&raw2));
+    EXPECT_FALSE(reader.NextChunk(&raw2));
+    EXPECT_TRUE(reader.Corrupted());
+
+    //a flipped byte the chunk checksum does not cover
+    std::string flipped = data;
+    flipped[10] ^= 0x01;
+    fp = fopen("/tmp/dump_trailer_test.dump", "wb");
+    fwrite(flipped.data(), 1, flipped.size(), fp);
+    fclose(fp);
+    DumpReader reader2;
+    ASSERT_TRUE(reader2.Open("/tmp/dump_trailer_test.dump", &applied_index, &term));
+    EXPECT_TRUE(reader2.NextChunk(&raw2));
+    EXPECT_FALSE(reader2.NextChunk(&raw2));
+    EXPECT_TRUE(reader2.Corrupted());
+}
+
+TEST(DumpFileTest, BadChecksum) {
+    std::string raw;
+    DumpFile::EncodeRecord("key", "value", &raw);
+    std::string compressed;
+    uint32_t checksum = 0;
+    ASSERT_TRUE(DumpFile::CompressChunk(raw, &compressed, &checksum));
+    std::string raw2;
+    EXPECT_FALSE(DumpFile::UncompressChunk(compressed, raw.size(),
+                                           checksum + 1, &raw2));
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
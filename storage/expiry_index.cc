@@ -0,0 +1,53 @@
+#include "expiry_index.h"
+
+namespace galaxy {
+namespace ins {
+
+ExpiryIndex::ExpiryIndex() {
+}
+
+void ExpiryIndex::Set(const std::string& key, int64_t expire_at) {
+    MutexLock lock(&mu_);
+    std::map<std::string, int64_t>::iterator it = deadlines_.find(key);
+    if (it != deadlines_.end()) {
+        by_time_.erase(std::make_pair(it->second, key));
+        if (expire_at <= 0) {
+            deadlines_.erase(it);
+            return;
+        }
+        it->second = expire_at;
+    } else if (expire_at <= 0) {
+        return;
+    } else {
+        deadlines_[key] = expire_at;
+    }
+    by_time_.insert(std::make_pair(expire_at, key));
+}
+
+void ExpiryIndex::Remove(const std::string& key) {
+    Set(key, 0);
+}
+
+void ExpiryIndex::Clear() {
+    MutexLock lock(&mu_);
+    deadlines_.clear();
+    by_time_.clear();
+}
+
+void ExpiryIndex::Expired(int64_t now, size_t limit,
+                          std::vector<std::pair<std::string, int64_t> >* keys) {
+    MutexLock lock(&mu_);
+    TimeSet::const_iterator it = by_time_.begin();
+    for (; it != by_time_.end() && it->first <= now && keys->size() < limit;
+         it++) {
+        keys->push_back(std::make_pair(it->second, it->first));
+    }
+}
+
+int64_t ExpiryIndex::Size() {
+    MutexLock lock(&mu_);
+    return deadlines_.size();
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,39 @@
+#ifndef GALAXY_INS_EXPIRY_INDEX_H_
+#define GALAXY_INS_EXPIRY_INDEX_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/mutex.h"
+
+namespace galaxy {
+namespace ins {
+
+// Deadlines of the keys put with a ttl, ordered by time so the leader
+// finds the expired ones without scanning the store. Kept by the applier
+// on every node, a new leader starts reaping at once.
+class ExpiryIndex {
+public:
+    ExpiryIndex();
+    // expire_at in micros, 0 drops the key
+    void Set(const std::string& key, int64_t expire_at);
+    void Remove(const std::string& key);
+    void Clear();
+    // at most limit keys with a deadline not after now, oldest first
+    void Expired(int64_t now, size_t limit,
+                 std::vector<std::pair<std::string, int64_t> >* keys);
+    int64_t Size();
+private:
+    typedef std::set<std::pair<int64_t, std::string> > TimeSet;
+    std::map<std::string, int64_t> deadlines_;
+    TimeSet by_time_;
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
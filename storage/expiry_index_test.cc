@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "expiry_index.h"
+
+using namespace galaxy::ins;
+
+TEST(ExpiryIndexTest, OldestFirst) {
+    ExpiryIndex index;
+    index.Set("/a", 300);
+    index.Set("/b", 100);
+    index.Set("/c", 200);
+    index.Set("/d", 900);
+    std::vector<std::pair<std::string, int64_t> > keys;
+    index.Expired(250, 10, &keys);
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[0].first, "/b");
+    EXPECT_EQ(keys[0].second, 100);
+    EXPECT_EQ(keys[1].first, "/c");
+    keys.clear();
+    index.Expired(1000, 3, &keys); //bounded by limit
+    ASSERT_EQ(keys.size(), 3u);
+    EXPECT_EQ(keys[2].first, "/a");
+    EXPECT_EQ(index.Size(), 4);
+}
+
+TEST(ExpiryIndexTest, SetMovesAndRemoves) {
+    ExpiryIndex index;
+    index.Set("/a", 100);
+    index.Set("/a", 500); //put again with a new ttl
+    index.Set("/b", 100);
+    index.Set("/b", 0); //put again without a ttl
+    index.Set("/c", 100);
+    index.Remove("/c");
+    std::vector<std::pair<std::string, int64_t> > keys;
+    index.Expired(200, 10, &keys);
+    EXPECT_TRUE(keys.empty());
+    index.Expired(500, 10, &keys);
+    ASSERT_EQ(keys.size(), 1u);
+    EXPECT_EQ(keys[0].first, "/a");
+    EXPECT_EQ(index.Size(), 1);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,75 @@
+#include "history.h"
+
+#include "state_store.h"
+
+namespace galaxy {
+namespace ins {
+
+static void AppendEscapedKey(const std::string& key, std::string* dst) {
+    dst->append(history_key_prefix);
+    for (size_t i = 0; i < key.size(); i++) {
+        dst->push_back(key[i]);
+        if (key[i] == '\0') {
+            dst->push_back('\xff');
+        }
+    }
+    dst->push_back('\0'); //"\0\x01" ends the key, below any escaped '\0'
+    dst->push_back('\x01');
+}
+
+std::string VersionKey(const std::string& key, int64_t index) {
+    std::string version_key;
+    AppendEscapedKey(key, &version_key);
+    uint64_t inverted = ~static_cast<uint64_t>(index);
+    for (int shift = 56; shift >= 0; shift -= 8) { //big endian
+        version_key.push_back(static_cast<char>((inverted >> shift) & 0xff));
+    }
+    return version_key;
+}
+
+std::string VersionKeyLimit(const std::string& key) {
+    std::string limit;
+    AppendEscapedKey(key, &limit);
+    limit[limit.size() - 1] = '\x02';
+    return limit;
+}
+
+bool ParseVersionKey(const leveldb::Slice& version_key,
+                     std::string* key, int64_t* index) {
+    leveldb::Slice input = version_key;
+    if (!input.starts_with(history_key_prefix)) {
+        return false;
+    }
+    input.remove_prefix(history_key_prefix.size());
+    key->clear();
+    size_t i = 0;
+    while (true) {
+        if (i + 1 >= input.size()) {
+            return false;
+        }
+        if (input[i] != '\0') {
+            key->push_back(input[i]);
+            i++;
+        } else if (input[i + 1] == '\xff') {
+            key->push_back('\0');
+            i += 2;
+        } else if (input[i + 1] == '\x01') {
+            i += 2;
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (input.size() - i != sizeof(uint64_t)) {
+        return false;
+    }
+    uint64_t inverted = 0;
+    for (; i < input.size(); i++) {
+        inverted = (inverted << 8) | static_cast<uint8_t>(input[i]);
+    }
+    *index = static_cast<int64_t>(~inverted);
+    return true;
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,28 @@
+#ifndef GALAXY_INS_HISTORY_H_
+#define GALAXY_INS_HISTORY_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/slice.h"
+
+namespace galaxy {
+namespace ins {
+
+// Keys of the version history under history_key_prefix.
+// A version key is the client key with '\0' escaped, a terminator and the
+// bitwise inverted log index that wrote it, so versions sort by client key
+// and, within one key, newest first. Seeking to VersionKey(key, index)
+// lands on the newest version of key not after index, if there is one.
+// Versions carry the store value, a lone kDel byte marks a delete.
+std::string VersionKey(const std::string& key, int64_t index);
+
+// every version of key sorts before it
+std::string VersionKeyLimit(const std::string& key);
+
+bool ParseVersionKey(const leveldb::Slice& version_key,
+                     std::string* key, int64_t* index);
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <stdio.h>
+#include "history.h"
+#include "state_store.h"
+
+using namespace galaxy::ins;
+
+TEST(HistoryTest, ParseVersionKey) {
+    std::string key;
+    int64_t index = 0;
+    EXPECT_TRUE(ParseVersionKey(VersionKey("a/b", 42), &key, &index));
+    EXPECT_EQ(key, "a/b");
+    EXPECT_EQ(index, 42);
+    std::string binary_key("a\0b\0", 4);
+    EXPECT_TRUE(ParseVersionKey(VersionKey(binary_key, 0), &key, &index));
+    EXPECT_EQ(key, binary_key);
+    EXPECT_EQ(index, 0);
+    EXPECT_FALSE(ParseVersionKey(meta_history_floor, &key, &index));
+    EXPECT_FALSE(ParseVersionKey(VersionKeyLimit("a"), &key, &index));
+}
+
+TEST(HistoryTest, VersionOrder) {
+    //newest first within a key
+    EXPECT_LT(VersionKey("a", 9), VersionKey("a", 8));
+    EXPECT_LT(VersionKey("a", 1000), VersionKey("a", 999));
+    //keys keep their order, prefixes and '\0' included
+    EXPECT_LT(VersionKey("a", 0), VersionKey("ab", 100));
+    EXPECT_LT(VersionKey("a", 0), VersionKey(std::string("a\0", 2), 100));
+    EXPECT_LT(VersionKey(std::string("a\0", 2), 0), VersionKey("a\x01", 100));
+    EXPECT_LT(VersionKey("a", 0), VersionKeyLimit("a"));
+    EXPECT_LT(VersionKeyLimit("a"), VersionKey(std::string("a\0", 2), 100));
+    EXPECT_LT(VersionKeyLimit("a"), VersionKey("ab", 100));
+    //all of it inside the reserved keyspace
+    EXPECT_TRUE(IsReservedKey(VersionKey("", 0)));
+    EXPECT_FALSE(leveldb::Slice(meta_history_floor).starts_with(history_key_prefix));
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
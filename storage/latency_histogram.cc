@@ -0,0 +1,80 @@
+#include "latency_histogram.h"
+
+namespace galaxy {
+namespace ins {
+
+static const int kSubBits = 3; //2^3 buckets to each power of two
+static const int kMaxBits = 40; //about 12 days in micros, longer is clamped
+static const size_t kBucketNum = (kMaxBits - kSubBits + 2) << kSubBits;
+
+LatencyHistogram::LatencyHistogram() : buckets_(kBucketNum, 0),
+                                       count_(0),
+                                       max_(0) {
+}
+
+size_t LatencyHistogram::BucketOf(int64_t micros) {
+    if (micros < (1 << (kSubBits + 1))) {
+        return micros < 0 ? 0 : micros;
+    }
+    int high_bit = 63 - __builtin_clzll(micros);
+    if (high_bit >= kMaxBits) {
+        return kBucketNum - 1;
+    }
+    int shift = high_bit - kSubBits;
+    return (shift << kSubBits) + (micros >> shift);
+}
+
+int64_t LatencyHistogram::UpperBound(size_t bucket) {
+    if (bucket < (1u << (kSubBits + 1))) {
+        return bucket;
+    }
+    int shift = (bucket >> kSubBits) - 1;
+    int64_t lower = static_cast<int64_t>((bucket & ((1 << kSubBits) - 1))
+                                         | (1 << kSubBits)) << shift;
+    return lower + (static_cast<int64_t>(1) << shift) - 1;
+}
+
+void LatencyHistogram::Add(int64_t micros, int64_t times) {
+    if (times <= 0) {
+        return;
+    }
+    MutexLock lock(&mu_);
+    buckets_[BucketOf(micros)] += times;
+    count_ += times;
+    if (micros > max_) {
+        max_ = micros;
+    }
+}
+
+int64_t LatencyHistogram::Percentile(double percent) {
+    MutexLock lock(&mu_);
+    if (count_ == 0) {
+        return 0;
+    }
+    int64_t rank = static_cast<int64_t>(count_ * percent / 100);
+    if (rank < 1) {
+        rank = 1;
+    }
+    int64_t seen = 0;
+    for (size_t i = 0; i < buckets_.size(); i++) {
+        seen += buckets_[i];
+        if (seen >= rank && i + 1 < buckets_.size()) {
+            int64_t bound = UpperBound(i);
+            return bound < max_ ? bound : max_;
+        }
+    }
+    return max_;
+}
+
+int64_t LatencyHistogram::Count() {
+    MutexLock lock(&mu_);
+    return count_;
+}
+
+int64_t LatencyHistogram::Max() {
+    MutexLock lock(&mu_);
+    return max_;
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,34 @@
+#ifndef GALAXY_INS_LATENCY_HISTOGRAM_H_
+#define GALAXY_INS_LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <vector>
+#include "common/mutex.h"
+
+namespace galaxy {
+namespace ins {
+
+// Counts latencies in micros in log-linear buckets, eight to each power
+// of two, so a percentile is off by at most an eighth of itself and the
+// buckets stay a fixed few hundred counters however many are added.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void Add(int64_t micros, int64_t times);
+    // the least latency not below percent of those added, 0 if none
+    int64_t Percentile(double percent);
+    int64_t Count();
+    int64_t Max();
+private:
+    static size_t BucketOf(int64_t micros);
+    static int64_t UpperBound(size_t bucket);
+    std::vector<int64_t> buckets_;
+    int64_t count_;
+    int64_t max_;
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+#include "latency_histogram.h"
+
+using namespace galaxy::ins;
+
+TEST(LatencyHistogramTest, Percentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.Percentile(50), 0);
+    for (int64_t i = 1; i <= 1000; i++) {
+        histogram.Add(i, 1);
+    }
+    EXPECT_EQ(histogram.Count(), 1000);
+    EXPECT_EQ(histogram.Max(), 1000);
+    int64_t p50 = histogram.Percentile(50);
+    EXPECT_GE(p50, 500);
+    EXPECT_LE(p50, 500 + 500 / 8);
+    int64_t p99 = histogram.Percentile(99);
+    EXPECT_GE(p99, 990);
+    EXPECT_LE(p99, 1000);
+    EXPECT_EQ(histogram.Percentile(100), 1000);
+}
+
+TEST(LatencyHistogramTest, SmallAndHugeValues) {
+    LatencyHistogram histogram;
+    histogram.Add(3, 10);
+    EXPECT_EQ(histogram.Percentile(50), 3);
+    histogram.Add(-5, 1); //clock stepped back, counted as 0
+    histogram.Add(static_cast<int64_t>(1) << 50, 1);
+    EXPECT_EQ(histogram.Count(), 12);
+    EXPECT_EQ(histogram.Percentile(1), 0);
+    EXPECT_EQ(histogram.Percentile(100), static_cast<int64_t>(1) << 50);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
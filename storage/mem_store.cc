@@ -0,0 +1,420 @@
+#include "mem_store.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "common/logging.h"
+#include "utils.h"
+
+namespace galaxy {
+namespace ins {
+
+const std::string snapshot_file_name = "snapshot.data";
+
+// Iterators do not pin the table, every step re-seeks from the current
+// key under the lock, so a long scan never holds back a writer.
+class MemStoreIterator : public leveldb::Iterator {
+public:
+    MemStoreIterator(MemStore* store) : store_(store), valid_(false) {
+    }
+    virtual bool Valid() const {
+        return valid_;
+    }
+    virtual void SeekToFirst() {
+        MutexLock lock(&store_->mu_);
+        Set(store_->table_.begin());
+    }
+    virtual void SeekToLast() {
+        MutexLock lock(&store_->mu_);
+        if (store_->table_.empty()) {
+            valid_ = false;
+            return;
+        }
+        Set(--store_->table_.end());
+    }
+    virtual void Seek(const leveldb::Slice& target) {
+        MutexLock lock(&store_->mu_);
+        Set(store_->table_.lower_bound(target.ToString()));
+    }
+    virtual void Next() {
+        assert(valid_);
+        MutexLock lock(&store_->mu_);
+        Set(store_->table_.upper_bound(key_));
+    }
+    virtual void Prev() {
+        assert(valid_);
+        MutexLock lock(&store_->mu_);
+        MemStore::Table::const_iterator it = store_->table_.lower_bound(key_);
+        if (it == store_->table_.begin()) {
+            valid_ = false;
+            return;
+        }
+        Set(--it);
+    }
+    virtual leveldb::Slice key() const {
+        return key_;
+    }
+    virtual leveldb::Slice value() const {
+        return value_;
+    }
+    virtual leveldb::Status status() const {
+        return leveldb::Status::OK();
+    }
+private:
+    void Set(MemStore::Table::const_iterator it) {
+        valid_ = (it != store_->table_.end());
+        if (valid_) {
+            key_ = it->first;
+            value_ = it->second;
+        }
+    }
+    MemStore* store_;
+    bool valid_;
+    std::string key_;
+    std::string value_;
+};
+
+// Re-seeks like MemStoreIterator, but reads each key as of its sequence
+class MemStoreSnapshotIterator : public leveldb::Iterator {
+public:
+    MemStoreSnapshotIterator(MemStore* store) : store_(store), valid_(false) {
+        MutexLock lock(&store_->mu_);
+        seq_ = store_->OpenSnapshot();
+    }
+    virtual ~MemStoreSnapshotIterator() {
+        MutexLock lock(&store_->mu_);
+        store_->CloseSnapshot(seq_);
+    }
+    virtual bool Valid() const {
+        return valid_;
+    }
+    virtual void SeekToFirst() {
+        MutexLock lock(&store_->mu_);
+        valid_ = store_->SeekAt(seq_, "", true, false, &key_, &value_);
+    }
+    virtual void SeekToLast() {
+        MutexLock lock(&store_->mu_);
+        valid_ = store_->SeekAt(seq_, "", true, true, &key_, &value_);
+    }
+    virtual void Seek(const leveldb::Slice& target) {
+        MutexLock lock(&store_->mu_);
+        valid_ = store_->SeekAt(seq_, target.ToString(), true, false,
+                                &key_, &value_);
+    }
+    virtual void Next() {
+        assert(valid_);
+        MutexLock lock(&store_->mu_);
+        valid_ = store_->SeekAt(seq_, key_, false, false, &key_, &value_);
+    }
+    virtual void Prev() {
+        assert(valid_);
+        MutexLock lock(&store_->mu_);
+        valid_ = store_->SeekAt(seq_, key_, false, true, &key_, &value_);
+    }
+    virtual leveldb::Slice key() const {
+        return key_;
+    }
+    virtual leveldb::Slice value() const {
+        return value_;
+    }
+    virtual leveldb::Status status() const {
+        return leveldb::Status::OK();
+    }
+private:
+    MemStore* store_;
+    uint64_t seq_;
+    bool valid_;
+    std::string key_;
+    std::string value_;
+};
+
+class MemStoreBatchHandler : public leveldb::WriteBatch::Handler {
+public:
+    MemStoreBatchHandler(MemStore* store) : store_(store) {
+    }
+    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
+        store_->PutLocked(key.ToString(), value.ToString());
+    }
+    virtual void Delete(const leveldb::Slice& key) {
+        store_->DeleteLocked(key.ToString());
+    }
+private:
+    MemStore* store_;
+};
+
+MemStore::MemStore(const std::string& data_dir) : data_dir_(data_dir),
+                                                  seq_(0) {
+    bool ok = ins_common::Mkdirs(data_dir.c_str());
+    if (!ok) {
+        LOG(FATAL, "failed to create dir :%s", data_dir.c_str());
+        abort();
+    }
+    ok = LoadSnapshot();
+    assert(ok);
+}
+
+MemStore::~MemStore() {
+}
+
+void MemStore::SaveUndo(const std::string& key) {
+    mu_.AssertHeld();
+    if (snapshots_.empty()) {
+        return;
+    }
+    uint64_t newest = *snapshots_.rbegin();
+    UndoLog::iterator it = undo_.find(key);
+    if (it != undo_.end() && it->second.back().seq > newest) {
+        return; //every open snapshot reads an older saved value
+    }
+    Undo undo;
+    undo.seq = seq_;
+    Table::const_iterator t = table_.find(key);
+    undo.existed = (t != table_.end());
+    if (undo.existed) {
+        undo.value = t->second;
+    }
+    undo_[key].push_back(undo);
+}
+
+void MemStore::PutLocked(const std::string& key, const std::string& value) {
+    mu_.AssertHeld();
+    seq_++;
+    SaveUndo(key);
+    table_[key] = value;
+}
+
+void MemStore::DeleteLocked(const std::string& key) {
+    mu_.AssertHeld();
+    seq_++;
+    SaveUndo(key);
+    table_.erase(key);
+}
+
+uint64_t MemStore::OpenSnapshot() {
+    mu_.AssertHeld();
+    snapshots_.insert(seq_);
+    return seq_;
+}
+
+void MemStore::CloseSnapshot(uint64_t seq) {
+    mu_.AssertHeld();
+    snapshots_.erase(snapshots_.find(seq));
+    if (snapshots_.empty()) {
+        undo_.clear();
+        return;
+    }
+    // an undo is read by the snapshots between the one before it and it
+    UndoLog::iterator it = undo_.begin();
+    while (it != undo_.end()) {
+        std::vector<Undo>& undos = it->second;
+        std::vector<Undo> kept;
+        uint64_t prev_seq = 0;
+        for (size_t i = 0; i < undos.size(); i++) {
+            std::multiset<uint64_t>::const_iterator s =
+                snapshots_.lower_bound(prev_seq);
+            if (s != snapshots_.end() && *s < undos[i].seq) {
+                kept.push_back(undos[i]);
+            }
+            prev_seq = undos[i].seq;
+        }
+        if (kept.empty()) {
+            undo_.erase(it++);
+        } else {
+            undos.swap(kept);
+            it++;
+        }
+    }
+}
+
+bool MemStore::GetAt(uint64_t seq, const std::string& key,
+                     std::string* value) {
+    mu_.AssertHeld();
+    UndoLog::const_iterator u = undo_.find(key);
+    if (u != undo_.end()) {
+        const std::vector<Undo>& undos = u->second;
+        for (size_t i = 0; i < undos.size(); i++) {
+            if (undos[i].seq > seq) { //the first write after the snapshot
+                if (undos[i].existed) {
+                    value->assign(undos[i].value);
+                }
+                return undos[i].existed;
+            }
+        }
+    }
+    Table::const_iterator t = table_.find(key);
+    if (t == table_.end()) {
+        return false;
+    }
+    value->assign(t->second);
+    return true;
+}
+
+bool MemStore::SeekAt(uint64_t seq, const std::string& target, bool inclusive,
+                      bool backward, std::string* key, std::string* value) {
+    mu_.AssertHeld();
+    std::string bound = target; //key may be target itself
+    bool from_end = backward && inclusive && target.empty();
+    while (true) {
+        //a key the snapshot may see is in the table, or only saved
+        const std::string* next = NULL;
+        if (!backward) {
+            Table::const_iterator t = inclusive ? table_.lower_bound(bound)
+                                                : table_.upper_bound(bound);
+            UndoLog::const_iterator u = inclusive ? undo_.lower_bound(bound)
+                                                  : undo_.upper_bound(bound);
+            if (t != table_.end()) {
+                next = &t->first;
+            }
+            if (u != undo_.end() && (next == NULL || u->first < *next)) {
+                next = &u->first;
+            }
+        } else {
+            Table::const_iterator t = from_end ? table_.end()
+                : (inclusive ? table_.upper_bound(bound)
+                             : table_.lower_bound(bound));
+            UndoLog::const_iterator u = from_end ? undo_.end()
+                : (inclusive ? undo_.upper_bound(bound)
+                             : undo_.lower_bound(bound));
+            if (t != table_.begin()) {
+                next = &(--t)->first;
+            }
+            if (u != undo_.begin()) {
+                --u;
+                if (next == NULL || u->first > *next) {
+                    next = &u->first;
+                }
+            }
+        }
+        if (next == NULL) {
+            return false;
+        }
+        bound = *next;
+        if (GetAt(seq, bound, value)) {
+            key->assign(bound);
+            return true;
+        }
+        inclusive = false; //written after the snapshot, skip it
+        from_end = false;
+    }
+}
+
+leveldb::Status MemStore::Get(const std::string& key, std::string* value) {
+    MutexLock lock(&mu_);
+    Table::const_iterator it = table_.find(key);
+    if (it == table_.end()) {
+        return leveldb::Status::NotFound(key);
+    }
+    value->assign(it->second);
+    return leveldb::Status::OK();
+}
+
+leveldb::Status MemStore::Put(const std::string& key,
+                              const std::string& value) {
+    MutexLock lock(&mu_);
+    PutLocked(key, value);
+    return leveldb::Status::OK();
+}
+
+leveldb::Status MemStore::Delete(const std::string& key) {
+    MutexLock lock(&mu_);
+    DeleteLocked(key);
+    return leveldb::Status::OK();
+}
+
+leveldb::Status MemStore::Write(leveldb::WriteBatch* batch) {
+    MutexLock lock(&mu_);
+    MemStoreBatchHandler handler(this);
+    return batch->Iterate(&handler);
+}
+
+leveldb::Iterator* MemStore::NewIterator() {
+    return new MemStoreIterator(this);
+}
+
+leveldb::Iterator* MemStore::NewSnapshotIterator() {
+    return new MemStoreSnapshotIterator(this);
+}
+
+bool MemStore::Checkpoint() {
+    MutexLock lock_cp(&checkpoint_mu_);
+    int64_t start = ins_common::timer::get_micros();
+    int64_t count = 0;
+    bool ok = DumpSnapshot(&count);
+    LOG(INFO, "checkpoint %ld keys, cost %ld ms, %s",
+        count, (ins_common::timer::get_micros() - start) / 1000,
+        ok ? "ok" : "failed");
+    return ok;
+}
+
+static bool WriteRecord(FILE* fp, const leveldb::Slice& s) {
+    int32_t len = s.size();
+    return fwrite(&len, sizeof(int32_t), 1, fp) == 1
+           && fwrite(s.data(), 1, s.size(), fp) == s.size();
+}
+
+static bool ReadRecord(FILE* fp, std::string* s) {
+    int32_t len = 0;
+    if (fread(&len, sizeof(int32_t), 1, fp) != 1 || len < 0) {
+        return false;
+    }
+    s->resize(len);
+    return len == 0 || fread(&(*s)[0], 1, len, fp) == static_cast<size_t>(len);
+}
+
+bool MemStore::DumpSnapshot(int64_t* count) {
+    std::string file_name = data_dir_ + "/" + snapshot_file_name;
+    std::string tmp_name = file_name + ".tmp";
+    FILE* fp = fopen(tmp_name.c_str(), "wb");
+    if (!fp) {
+        LOG(FATAL, "failed to open %s", tmp_name.c_str());
+        return false;
+    }
+    *count = 0;
+    bool ok = fwrite(count, sizeof(int64_t), 1, fp) == 1; //filled in below
+    leveldb::Iterator* it = NewSnapshotIterator();
+    for (it->SeekToFirst(); ok && it->Valid(); it->Next()) {
+        ok = WriteRecord(fp, it->key()) && WriteRecord(fp, it->value());
+        (*count)++;
+    }
+    delete it;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0
+         && fwrite(count, sizeof(int64_t), 1, fp) == 1;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    fclose(fp);
+    if (ok && rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+bool MemStore::LoadSnapshot() {
+    std::string file_name = data_dir_ + "/" + snapshot_file_name;
+    FILE* fp = fopen(file_name.c_str(), "rb");
+    if (!fp) {
+        LOG(INFO, "no snapshot found in %s, start with empty store",
+            data_dir_.c_str());
+        return true;
+    }
+    int64_t count = 0;
+    bool ok = fread(&count, sizeof(int64_t), 1, fp) == 1;
+    MutexLock lock(&mu_);
+    for (int64_t i = 0; ok && i < count; i++) {
+        std::string key;
+        std::string value;
+        ok = ReadRecord(fp, &key) && ReadRecord(fp, &value);
+        if (ok) {
+            table_[key] = value;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        LOG(FATAL, "broken snapshot: %s", file_name.c_str());
+    } else {
+        LOG(INFO, "load %ld keys from snapshot %s", count, file_name.c_str());
+    }
+    return ok;
+}
+
+} //namespace ins
+} //namespace galaxy
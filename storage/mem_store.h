@@ -0,0 +1,71 @@
+#ifndef GALAXY_INS_MEM_STORE_H_
+#define GALAXY_INS_MEM_STORE_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/mutex.h"
+#include "state_store.h"
+
+namespace galaxy {
+namespace ins {
+
+// An ordered in-memory engine. The whole table lives in RAM and is
+// persisted by periodic snapshot files; entries applied after the last
+// snapshot are replayed from the binlog on restart.
+// Checkpoints and snapshot iterators never copy the table: while one is
+// open, a write first saves the value it replaces, tagged with its
+// sequence, and a snapshot reads a key through the saved values written
+// after it. Saved values go once no open snapshot needs them.
+class MemStore : public StateStore {
+public:
+    MemStore(const std::string& data_dir);
+    virtual ~MemStore();
+    virtual leveldb::Status Get(const std::string& key, std::string* value);
+    virtual leveldb::Status Put(const std::string& key, const std::string& value);
+    virtual leveldb::Status Delete(const std::string& key);
+    virtual leveldb::Status Write(leveldb::WriteBatch* batch);
+    virtual leveldb::Iterator* NewIterator();
+    virtual leveldb::Iterator* NewSnapshotIterator();
+    virtual bool Checkpoint();
+private:
+    typedef std::map<std::string, std::string> Table;
+    // the value a key had before the write numbered seq replaced it
+    struct Undo {
+        uint64_t seq;
+        bool existed;
+        std::string value;
+    };
+    typedef std::map<std::string, std::vector<Undo> > UndoLog;
+    friend class MemStoreIterator;
+    friend class MemStoreSnapshotIterator;
+    friend class MemStoreBatchHandler;
+    void PutLocked(const std::string& key, const std::string& value);
+    void DeleteLocked(const std::string& key);
+    void SaveUndo(const std::string& key);
+    uint64_t OpenSnapshot();
+    void CloseSnapshot(uint64_t seq);
+    // the value of key as the snapshot at seq sees it
+    bool GetAt(uint64_t seq, const std::string& key, std::string* value);
+    // the first key after target (or at it if inclusive) the snapshot
+    // sees, or the last one before it when backward; an empty target
+    // with backward means from the end
+    bool SeekAt(uint64_t seq, const std::string& target, bool inclusive,
+                bool backward, std::string* key, std::string* value);
+    bool LoadSnapshot();
+    bool DumpSnapshot(int64_t* count);
+    std::string data_dir_;
+    Table table_;
+    UndoLog undo_;
+    std::multiset<uint64_t> snapshots_; //seq of each open snapshot
+    uint64_t seq_; //of the last write
+    Mutex mu_;
+    Mutex checkpoint_mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,41 @@
+#include "session_ids.h"
+
+namespace galaxy {
+namespace ins {
+
+SessionIds::SessionIds() : next_id_(0) {
+}
+
+uint32_t SessionIds::Intern(const std::string& session_id) {
+    MutexLock lock(&mu_);
+    std::pair<boost::unordered_map<std::string, uint32_t>::iterator, bool> ret =
+        ids_.insert(std::make_pair(session_id, next_id_ + 1));
+    if (ret.second) {
+        next_id_++;
+    }
+    return ret.first->second;
+}
+
+bool SessionIds::Find(const std::string& session_id, uint32_t* id) {
+    MutexLock lock(&mu_);
+    boost::unordered_map<std::string, uint32_t>::iterator it =
+        ids_.find(session_id);
+    if (it == ids_.end()) {
+        return false;
+    }
+    *id = it->second;
+    return true;
+}
+
+void SessionIds::Forget(const std::string& session_id) {
+    MutexLock lock(&mu_);
+    ids_.erase(session_id);
+}
+
+int64_t SessionIds::Size() {
+    MutexLock lock(&mu_);
+    return ids_.size();
+}
+
+} //namespace ins
+} //namespace galaxy
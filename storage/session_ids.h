@@ -0,0 +1,32 @@
+#ifndef GALAXY_INS_SESSION_IDS_H_
+#define GALAXY_INS_SESSION_IDS_H_
+
+#include <stdint.h>
+#include <string>
+#include <boost/unordered_map.hpp>
+#include "common/mutex.h"
+
+namespace galaxy {
+namespace ins {
+
+// Numbers the session ids ("hostname#uuid") once, so a watch keeps 4
+// bytes instead of its own copy of the id. A number is never given to
+// another session, a record left with a forgotten one matches nothing.
+class SessionIds {
+public:
+    SessionIds();
+    uint32_t Intern(const std::string& session_id);
+    // false if the session was never interned or is forgotten
+    bool Find(const std::string& session_id, uint32_t* id);
+    void Forget(const std::string& session_id);
+    int64_t Size();
+private:
+    boost::unordered_map<std::string, uint32_t> ids_;
+    uint32_t next_id_;
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,29 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "session_ids.h"
+
+using namespace galaxy::ins;
+
+TEST(SessionIdsTest, InternAndForget) {
+    SessionIds ids;
+    uint32_t a = ids.Intern("host1#uuid-a");
+    uint32_t b = ids.Intern("host2#uuid-b");
+    EXPECT_NE(a, b);
+    EXPECT_EQ(ids.Intern("host1#uuid-a"), a);
+    uint32_t found = 0;
+    ASSERT_TRUE(ids.Find("host2#uuid-b", &found));
+    EXPECT_EQ(found, b);
+    EXPECT_FALSE(ids.Find("host3#uuid-c", &found));
+    EXPECT_EQ(ids.Size(), 2);
+    ids.Forget("host1#uuid-a");
+    EXPECT_FALSE(ids.Find("host1#uuid-a", &found));
+    uint32_t again = ids.Intern("host1#uuid-a");
+    EXPECT_NE(again, a); //numbers are not reused
+    EXPECT_NE(again, b);
+    EXPECT_EQ(ids.Size(), 2);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+#include "state_store.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+#include "common/logging.h"
+#include "mem_store.h"
+
+namespace galaxy {
+namespace ins {
+
+const std::string meta_key_prefix = "\xff\xff\xffINS_META/";
+const std::string meta_last_applied_index = meta_key_prefix + "last_applied_index";
+const std::string meta_last_applied_term = meta_key_prefix + "last_applied_term";
+const std::string meta_history_floor = meta_key_prefix + "history_floor";
+const std::string history_key_prefix = meta_key_prefix + "history/";
+
+StateStore* StateStore::Open(const std::string& engine,
+                             const std::string& data_dir) {
+    if (engine == "leveldb") {
+        return new LevelDBStore(data_dir);
+    } else if (engine == "memory") {
+        return new MemStore(data_dir);
+    }
+    LOG(FATAL, "unknown store engine: %s", engine.c_str());
+    abort();
+}
+
+StateBatch::StateBatch(StateStore* store) : store_(store) {
+}
+
+leveldb::Status StateBatch::Get(const std::string& key, std::string* value) {
+    std::map<std::string, std::string>::const_iterator it = puts_.find(key);
+    if (it != puts_.end()) {
+        value->assign(it->second);
+        return leveldb::Status::OK();
+    }
+    if (deletes_.find(key) != deletes_.end()) {
+        return leveldb::Status::NotFound(key);
+    }
+    return store_->Get(key, value);
+}
+
+void StateBatch::Put(const std::string& key, const std::string& value) {
+    batch_.Put(key, value);
+    puts_[key] = value;
+    deletes_.erase(key);
+}
+
+void StateBatch::Delete(const std::string& key) {
+    batch_.Delete(key);
+    puts_.erase(key);
+    deletes_.insert(key);
+}
+
+static bool KeyInRange(const leveldb::Slice& key, const std::string& end,
+                       const std::string& prefix) {
+    return key.starts_with(prefix)
+           && (end.empty() || key.compare(end) < 0)
+           && key.compare(meta_key_prefix) < 0;
+}
+
+void StateBatch::ListKeys(const std::string& start, const std::string& end,
+                          const std::string& prefix, int64_t limit,
+                          std::vector<std::string>* keys) {
+    std::string seek_key = std::max(start, prefix);
+    std::set<std::string> found;
+    leveldb::Iterator* it = store_->NewIterator();
+    for (it->Seek(seek_key);
+         it->Valid() && KeyInRange(it->key(), end, prefix)
+         && (limit <= 0 || static_cast<int64_t>(found.size()) < limit);
+         it->Next()) {
+        std::string key = it->key().ToString();
+        if (deletes_.find(key) == deletes_.end()) {
+            found.insert(key);
+        }
+    }
+    assert(it->status().ok());
+    delete it;
+    std::map<std::string, std::string>::const_iterator pt;
+    for (pt = puts_.lower_bound(seek_key);
+         pt != puts_.end() && KeyInRange(pt->first, end, prefix); pt++) {
+        found.insert(pt->first); //written earlier in this round
+    }
+    std::set<std::string>::iterator last = found.end();
+    if (limit > 0 && static_cast<int64_t>(found.size()) > limit) {
+        last = found.begin();
+        std::advance(last, limit);
+    }
+    keys->assign(found.begin(), last);
+}
+
+leveldb::Status StateBatch::Commit() {
+    leveldb::Status s = store_->Write(&batch_);
+    batch_.Clear();
+    puts_.clear();
+    deletes_.clear();
+    return s;
+}
+
+LevelDBStore::LevelDBStore(const std::string& data_dir) : db_(NULL) {
+    leveldb::Options options;
+    options.create_if_missing = true;
+    leveldb::Status status = leveldb::DB::Open(options, data_dir, &db_);
+    assert(status.ok());
+}
+
+LevelDBStore::~LevelDBStore() {
+    delete db_;
+}
+
+leveldb::Status LevelDBStore::Get(const std::string& key, std::string* value) {
+    return db_->Get(leveldb::ReadOptions(), key, value);
+}
+
+leveldb::Status LevelDBStore::Put(const std::string& key,
+                                  const std::string& value) {
+    return db_->Put(leveldb::WriteOptions(), key, value);
+}
+
+leveldb::Status LevelDBStore::Delete(const std::string& key) {
+    return db_->Delete(leveldb::WriteOptions(), key);
+}
+
+leveldb::Status LevelDBStore::Write(leveldb::WriteBatch* batch) {
+    return db_->Write(leveldb::WriteOptions(), batch);
+}
+
+leveldb::Iterator* LevelDBStore::NewIterator() {
+    return db_->NewIterator(leveldb::ReadOptions());
+}
+
+leveldb::Iterator* LevelDBStore::NewSnapshotIterator() {
+    //leveldb iterators already read from an implicit snapshot
+    return db_->NewIterator(leveldb::ReadOptions());
+}
+
+bool LevelDBStore::Checkpoint() {
+    return true; //every write already reached leveldb's own log
+}
+
+} //namespace ins
+} //namespace galaxy
@@ -0,0 +1,90 @@
+#ifndef GALAXY_INS_STATE_STORE_H_
+#define GALAXY_INS_STATE_STORE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+namespace galaxy {
+namespace ins {
+
+// Keys from meta_key_prefix upwards belong to the server itself. They sort
+// after every key a client may write, so scans stop before them.
+extern const std::string meta_key_prefix;
+extern const std::string meta_last_applied_index;
+extern const std::string meta_last_applied_term; //term of that entry
+// versions of client keys kept for as-of reads, see history.h
+extern const std::string meta_history_floor;
+extern const std::string history_key_prefix;
+
+inline bool IsReservedKey(const std::string& key) {
+    return key.compare(meta_key_prefix) >= 0;
+}
+
+// The storage of the replicated state machine.
+// All engines speak leveldb's vocabulary (Status, Slice, Iterator,
+// WriteBatch) so that callers do not care which one is running.
+class StateStore {
+public:
+    virtual ~StateStore() {}
+    virtual leveldb::Status Get(const std::string& key, std::string* value) = 0;
+    virtual leveldb::Status Put(const std::string& key,
+                                const std::string& value) = 0;
+    virtual leveldb::Status Delete(const std::string& key) = 0;
+    virtual leveldb::Status Write(leveldb::WriteBatch* batch) = 0;
+    // caller owns the returned iterator
+    virtual leveldb::Iterator* NewIterator() = 0;
+    // an iterator that sees the store as of its creation for its whole life
+    virtual leveldb::Iterator* NewSnapshotIterator() = 0;
+    // make everything written so far durable, return false on failure
+    virtual bool Checkpoint() = 0;
+
+    // engine: "leveldb" or "memory"
+    static StateStore* Open(const std::string& engine,
+                            const std::string& data_dir);
+};
+
+// The writes of one apply round, committed to the store at once.
+// Get sees the writes pending in the batch before the store.
+class StateBatch {
+public:
+    StateBatch(StateStore* store);
+    leveldb::Status Get(const std::string& key, std::string* value);
+    void Put(const std::string& key, const std::string& value);
+    void Delete(const std::string& key);
+    // client keys in [start, end) with prefix, in order, as Get sees them;
+    // an empty end means up to the reserved keyspace, at most limit of
+    // them if limit > 0
+    void ListKeys(const std::string& start, const std::string& end,
+                  const std::string& prefix, int64_t limit,
+                  std::vector<std::string>* keys);
+    leveldb::Status Commit();
+private:
+    StateStore* store_;
+    leveldb::WriteBatch batch_;
+    std::map<std::string, std::string> puts_;
+    std::set<std::string> deletes_;
+};
+
+class LevelDBStore : public StateStore {
+public:
+    LevelDBStore(const std::string& data_dir);
+    virtual ~LevelDBStore();
+    virtual leveldb::Status Get(const std::string& key, std::string* value);
+    virtual leveldb::Status Put(const std::string& key, const std::string& value);
+    virtual leveldb::Status Delete(const std::string& key);
+    virtual leveldb::Status Write(leveldb::WriteBatch* batch);
+    virtual leveldb::Iterator* NewIterator();
+    virtual leveldb::Iterator* NewSnapshotIterator();
+    virtual bool Checkpoint();
+private:
+    leveldb::DB* db_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "state_store.h"
+
+using namespace galaxy::ins;
+
+class StateBatchTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        char dir[] = "/tmp/state_store_test_XXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != NULL);
+        dir_ = dir;
+        store_ = StateStore::Open("memory", dir_);
+    }
+    virtual void TearDown() {
+        delete store_;
+        std::string cmd = "rm -rf " + dir_;
+        system(cmd.c_str());
+    }
+    std::string dir_;
+    StateStore* store_;
+};
+
+TEST_F(StateBatchTest, ListKeysSeesPendingWrites) {
+    store_->Put("/job/a", "1");
+    store_->Put("/job/b", "2");
+    store_->Put("/other", "3");
+    StateBatch batch(store_);
+    batch.Delete("/job/a");
+    batch.Put("/job/c", "4");
+    batch.Put(meta_last_applied_index, "5");
+    std::vector<std::string> keys;
+    batch.ListKeys("", "", "/job/", 0, &keys);
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[0], "/job/b");
+    EXPECT_EQ(keys[1], "/job/c");
+    keys.clear();
+    batch.ListKeys("/job/b", "/other", "", 0, &keys);
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[1], "/job/c");
+    keys.clear();
+    batch.ListKeys("", "", "", 0, &keys); //never the reserved keys
+    ASSERT_EQ(keys.size(), 3u);
+    EXPECT_EQ(keys[2], "/other");
+    keys.clear();
+    batch.ListKeys("", "", "", 2, &keys);
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[1], "/job/c");
+}
+
+static std::string Dump(leveldb::Iterator* it, bool backward) {
+    std::string out;
+    if (backward) {
+        for (it->SeekToLast(); it->Valid(); it->Prev()) {
+            out += it->key().ToString() + "=" + it->value().ToString() + " ";
+        }
+    } else {
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            out += it->key().ToString() + "=" + it->value().ToString() + " ";
+        }
+    }
+    return out;
+}
+
+TEST_F(StateBatchTest, SnapshotIteratorKeepsItsView) {
+    store_->Put("/a", "1");
+    store_->Put("/b", "2");
+    store_->Put("/c", "3");
+    leveldb::Iterator* old_it = store_->NewSnapshotIterator();
+    store_->Put("/a", "10");
+    store_->Delete("/b");
+    store_->Put("/bb", "4"); //after the snapshot, never seen by it
+    leveldb::Iterator* mid_it = store_->NewSnapshotIterator();
+    store_->Put("/a", "100");
+    store_->Delete("/c");
+    EXPECT_EQ(Dump(old_it, false), "/a=1 /b=2 /c=3 ");
+    EXPECT_EQ(Dump(old_it, true), "/c=3 /b=2 /a=1 ");
+    old_it->Seek("/b");
+    ASSERT_TRUE(old_it->Valid());
+    EXPECT_EQ(old_it->key().ToString(), "/b");
+    old_it->Next();
+    ASSERT_TRUE(old_it->Valid());
+    EXPECT_EQ(old_it->key().ToString(), "/c"); //skips /bb
+    EXPECT_EQ(Dump(mid_it, false), "/a=10 /bb=4 /c=3 ");
+    delete old_it;
+    EXPECT_EQ(Dump(mid_it, true), "/c=3 /bb=4 /a=10 ");
+    delete mid_it;
+    leveldb::Iterator* it = store_->NewSnapshotIterator();
+    EXPECT_EQ(Dump(it, false), "/a=100 /bb=4 ");
+    delete it;
+    store_->Put("/a", "1000"); //nothing open, nothing saved
+    it = store_->NewIterator();
+    EXPECT_EQ(Dump(it, false), "/a=1000 /bb=4 ");
+    delete it;
+    ASSERT_TRUE(store_->Checkpoint());
+    delete store_;
+    store_ = StateStore::Open("memory", dir_);
+    it = store_->NewIterator();
+    EXPECT_EQ(Dump(it, false), "/a=1000 /bb=4 ");
+    delete it;
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+#ifndef GALAXY_INS_STORE_VALUE_H_
+#define GALAXY_INS_STORE_VALUE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "leveldb/slice.h"
+#include "proto/ins_node.pb.h"
+#include "blob_store.h"
+
+namespace galaxy {
+namespace ins {
+
+// set on the op byte of a store value followed by the revisions of its key
+const uint8_t kRevisionFlag = 0x40;
+// set if a deadline follows the revisions
+const uint8_t kExpireFlag = 0x20;
+// set if the session owning an ephemeral key follows
+const uint8_t kEphemeralFlag = 0x10;
+
+// Log indexes that created a key and that changed it last.
+// Both are 0 for values written before revisions were kept.
+// expire_at is the deadline in micros of a key put with a ttl, or 0.
+// owner is the session of an ephemeral key, or empty.
+struct ValueRevision {
+    int64_t create;
+    int64_t mod;
+    int64_t expire_at;
+    std::string owner;
+    ValueRevision() : create(0), mod(0), expire_at(0) {
+    }
+};
+
+// A store value is [op|flags][create][mod][expire_at, if any]
+// [owner size][owner, if any][value or blob reference].
+inline void EncodeStoreValue(LogOperation op, bool is_blob,
+                             const ValueRevision& revision,
+                             const leveldb::Slice& value,
+                             std::string* raw) {
+    uint8_t opcode = static_cast<uint8_t>(op) | kRevisionFlag;
+    if (is_blob) {
+        opcode |= kBlobFlag;
+    }
+    if (revision.expire_at > 0) {
+        opcode |= kExpireFlag;
+    }
+    if (!revision.owner.empty()) {
+        opcode |= kEphemeralFlag;
+    }
+    raw->clear();
+    raw->reserve(1 + sizeof(int64_t) * 3 + sizeof(int32_t)
+                 + revision.owner.size() + value.size());
+    raw->append(1, static_cast<char>(opcode));
+    raw->append(reinterpret_cast<const char*>(&revision.create), sizeof(int64_t));
+    raw->append(reinterpret_cast<const char*>(&revision.mod), sizeof(int64_t));
+    if (revision.expire_at > 0) {
+        raw->append(reinterpret_cast<const char*>(&revision.expire_at),
+                    sizeof(int64_t));
+    }
+    if (!revision.owner.empty()) {
+        int32_t owner_size = revision.owner.size();
+        raw->append(reinterpret_cast<const char*>(&owner_size),
+                    sizeof(int32_t));
+        raw->append(revision.owner);
+    }
+    raw->append(value.data(), value.size());
+}
+
+// bytes in front of the value, 0 if raw is too short to hold them
+inline size_t StoreValueHeaderSize(const leveldb::Slice& raw) {
+    if (raw.size() < 1) {
+        return 0;
+    }
+    uint8_t opcode = static_cast<uint8_t>(raw[0]);
+    if (!(opcode & kRevisionFlag)) {
+        return 1;
+    }
+    size_t size = (opcode & kExpireFlag) ? 1 + sizeof(int64_t) * 3
+                                         : 1 + sizeof(int64_t) * 2;
+    if (opcode & kEphemeralFlag) {
+        int32_t owner_size = 0;
+        if (raw.size() < size + sizeof(int32_t)) {
+            return 0;
+        }
+        memcpy(&owner_size, raw.data() + size, sizeof(int32_t));
+        if (owner_size < 0) {
+            return 0;
+        }
+        size += sizeof(int32_t) + owner_size;
+    }
+    return size;
+}
+
+// value points into raw; an empty or truncated raw decodes as kNop
+inline void DecodeStoreValue(const leveldb::Slice& raw,
+                             LogOperation* op,
+                             ValueRevision* revision,
+                             leveldb::Slice* value) {
+    *op = kNop;
+    *revision = ValueRevision();
+    *value = raw;
+    size_t header_size = StoreValueHeaderSize(raw);
+    if (header_size == 0 || raw.size() < header_size) {
+        return;
+    }
+    uint8_t opcode = static_cast<uint8_t>(raw[0]);
+    *op = static_cast<LogOperation>(
+              opcode & ~(kBlobFlag | kRevisionFlag | kExpireFlag
+                         | kEphemeralFlag));
+    if (opcode & kRevisionFlag) {
+        memcpy(&revision->create, raw.data() + 1, sizeof(int64_t));
+        memcpy(&revision->mod, raw.data() + 1 + sizeof(int64_t),
+               sizeof(int64_t));
+    }
+    if ((opcode & kRevisionFlag) && (opcode & kExpireFlag)) {
+        memcpy(&revision->expire_at, raw.data() + 1 + sizeof(int64_t) * 2,
+               sizeof(int64_t));
+    }
+    if ((opcode & kRevisionFlag) && (opcode & kEphemeralFlag)) {
+        size_t owner_offset = 1 + sizeof(int64_t) * 2 + sizeof(int32_t);
+        if (opcode & kExpireFlag) {
+            owner_offset += sizeof(int64_t);
+        }
+        revision->owner.assign(raw.data() + owner_offset,
+                               header_size - owner_offset);
+    }
+    value->remove_prefix(header_size);
+}
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,160 @@
+#include "value_cache.h"
+
+#include <boost/functional/hash.hpp>
+
+namespace galaxy {
+namespace ins {
+
+// bookkeeping bytes of one entry besides key and value
+static const int64_t kEntryOverhead = sizeof(std::string) * 3 + 64;
+
+ValueCache::ValueCache(int64_t capacity, int32_t shard_num) {
+    if (shard_num < 1) {
+        shard_num = 1;
+    }
+    shard_capacity_ = capacity / shard_num;
+    for (int32_t i = 0; i < shard_num; i++) {
+        shards_.push_back(new Shard());
+    }
+}
+
+ValueCache::~ValueCache() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        delete shards_[i];
+    }
+}
+
+ValueCache::Shard* ValueCache::GetShard(const std::string& key) {
+    size_t h = boost::hash<std::string>()(key);
+    return shards_[h % shards_.size()];
+}
+
+bool ValueCache::Lookup(const std::string& key, LogOperation* op,
+                        std::string* value, ValueRevision* revision) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it == shard->entries.end() || it->second->pending) {
+        shard->misses++;
+        return false;
+    }
+    shard->hits++;
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    *op = it->second->op;
+    value->assign(it->second->value);
+    if (revision) {
+        *revision = it->second->revision;
+    }
+    return true;
+}
+
+uint64_t ValueCache::BeginFill(const std::string& key) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    return shard->version;
+}
+
+void ValueCache::Fill(const std::string& key, uint64_t ticket,
+                      LogOperation op, const std::string& value,
+                      const ValueRevision& revision) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    if (shard->version != ticket || shard->writing > 0) { //written meanwhile
+        return;
+    }
+    Insert(shard, key, op, value, revision);
+}
+
+void ValueCache::Update(const std::string& key, LogOperation op,
+                        const std::string& value,
+                        const ValueRevision& revision) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    shard->version++;
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it != shard->entries.end()) { //only refresh keys already hot
+        Remove(shard, it);
+        Insert(shard, key, op, value, revision);
+    }
+}
+
+void ValueCache::Erase(const std::string& key) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    shard->version++;
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it != shard->entries.end()) {
+        Remove(shard, it);
+    }
+}
+
+void ValueCache::BeginWrite(const std::string& key) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    shard->version++;
+    shard->writing++;
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it != shard->entries.end()) {
+        it->second->pending = true;
+    }
+}
+
+void ValueCache::EndWrite(const std::string& key) {
+    Shard* shard = GetShard(key);
+    MutexLock lock(&shard->mu);
+    shard->version++;
+    shard->writing--;
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it != shard->entries.end() && it->second->pending) {
+        Remove(shard, it);
+    }
+}
+
+void ValueCache::GetStats(int64_t* hits, int64_t* misses, int64_t* memory) {
+    *hits = 0;
+    *misses = 0;
+    *memory = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        MutexLock lock(&shards_[i]->mu);
+        *hits += shards_[i]->hits;
+        *misses += shards_[i]->misses;
+        *memory += shards_[i]->usage;
+    }
+}
+
+void ValueCache::Insert(Shard* shard, const std::string& key,
+                        LogOperation op, const std::string& value,
+                        const ValueRevision& revision) {
+    shard->mu.AssertHeld();
+    int64_t charge = key.size() * 2 + value.size() + kEntryOverhead;
+    if (charge > shard_capacity_ / 4) { //big values would flush the hot set
+        return;
+    }
+    EntryMap::iterator it = shard->entries.find(key);
+    if (it != shard->entries.end()) {
+        Remove(shard, it);
+    }
+    Entry entry;
+    entry.key = key;
+    entry.value = value;
+    entry.op = op;
+    entry.revision = revision;
+    entry.charge = charge;
+    entry.pending = false;
+    shard->lru.push_front(entry);
+    shard->entries[key] = shard->lru.begin();
+    shard->usage += charge;
+    while (shard->usage > shard_capacity_ && !shard->lru.empty()) {
+        Remove(shard, shard->entries.find(shard->lru.back().key));
+    }
+}
+
+void ValueCache::Remove(Shard* shard, EntryMap::iterator it) {
+    shard->mu.AssertHeld();
+    shard->usage -= it->second->charge;
+    shard->lru.erase(it->second);
+    shard->entries.erase(it);
+}
+
+} //namespace ins
+} //namespace galaxy
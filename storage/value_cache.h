@@ -0,0 +1,77 @@
+#ifndef GALAXY_INS_VALUE_CACHE_H_
+#define GALAXY_INS_VALUE_CACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include "common/mutex.h"
+#include "proto/ins_node.pb.h"
+#include "store_value.h"
+
+namespace galaxy {
+namespace ins {
+
+// A sharded LRU cache of decoded store values, bounded by bytes.
+// Readers fill it on a miss, the applier updates or invalidates it after
+// each write reached the store. A fill is dropped if the shard was written
+// after BeginFill, so a slow reader never puts a stale value back.
+// The applier brackets a batch with BeginWrite and EndWrite on each of
+// its keys: in between their entries are not served and fills of the
+// shard are dropped, so no reader mixes a cached old value of one key
+// with a new value of another read from the store.
+class ValueCache {
+public:
+    ValueCache(int64_t capacity, int32_t shard_num);
+    ~ValueCache();
+    bool Lookup(const std::string& key, LogOperation* op, std::string* value,
+                ValueRevision* revision = NULL);
+    uint64_t BeginFill(const std::string& key);
+    void Fill(const std::string& key, uint64_t ticket,
+              LogOperation op, const std::string& value,
+              const ValueRevision& revision = ValueRevision());
+    void Update(const std::string& key, LogOperation op,
+                const std::string& value,
+                const ValueRevision& revision = ValueRevision());
+    void Erase(const std::string& key);
+    void BeginWrite(const std::string& key);
+    // drops the entry if no Update refreshed it since BeginWrite
+    void EndWrite(const std::string& key);
+    void GetStats(int64_t* hits, int64_t* misses, int64_t* memory);
+private:
+    struct Entry {
+        std::string key;
+        std::string value;
+        LogOperation op;
+        ValueRevision revision;
+        int64_t charge;
+        bool pending; //its key is being written, not served
+    };
+    typedef std::list<Entry> LRUList;
+    typedef boost::unordered_map<std::string, LRUList::iterator> EntryMap;
+    struct Shard {
+        Mutex mu;
+        LRUList lru; //most recently used at front
+        EntryMap entries;
+        int64_t usage;
+        uint64_t version;
+        int32_t writing; //keys between BeginWrite and EndWrite
+        int64_t hits;
+        int64_t misses;
+        Shard() : usage(0), version(0), writing(0), hits(0), misses(0) {
+        }
+    };
+    Shard* GetShard(const std::string& key);
+    void Insert(Shard* shard, const std::string& key,
+                LogOperation op, const std::string& value,
+                const ValueRevision& revision);
+    void Remove(Shard* shard, EntryMap::iterator it);
+    int64_t shard_capacity_;
+    std::vector<Shard*> shards_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <stdio.h>
+#include "value_cache.h"
+
+using namespace galaxy::ins;
+
+TEST(ValueCacheTest, LookupAfterFill) {
+    ValueCache cache(1024 * 1024, 4);
+    LogOperation op;
+    std::string value;
+    EXPECT_FALSE(cache.Lookup("key", &op, &value));
+    uint64_t ticket = cache.BeginFill("key");
+    cache.Fill("key", ticket, kPut, "v1");
+    EXPECT_TRUE(cache.Lookup("key", &op, &value));
+    EXPECT_EQ(value, "v1");
+    EXPECT_EQ(op, kPut);
+    int64_t hits, misses, memory;
+    cache.GetStats(&hits, &misses, &memory);
+    EXPECT_EQ(hits, 1);
+    EXPECT_EQ(misses, 1);
+    EXPECT_GT(memory, 0);
+}
+
+TEST(ValueCacheTest, StaleFillDropped) {
+    ValueCache cache(1024 * 1024, 1);
+    LogOperation op;
+    std::string value;
+    uint64_t ticket = cache.BeginFill("key");
+    cache.Erase("key"); //a write lands between the store read and the fill
+    cache.Fill("key", ticket, kPut, "old");
+    EXPECT_FALSE(cache.Lookup("key", &op, &value));
+}
+
+TEST(ValueCacheTest, UpdateAndErase) {
+    ValueCache cache(1024 * 1024, 2);
+    LogOperation op;
+    std::string value;
+    cache.Fill("key", cache.BeginFill("key"), kPut, "v1");
+    cache.Update("key", kLock, "session");
+    EXPECT_TRUE(cache.Lookup("key", &op, &value));
+    EXPECT_EQ(value, "session");
+    EXPECT_EQ(op, kLock);
+    cache.Update("cold", kPut, "v2"); //not cached yet, stays out
+    EXPECT_FALSE(cache.Lookup("cold", &op, &value));
+    cache.Erase("key");
+    EXPECT_FALSE(cache.Lookup("key", &op, &value));
+}
+
+TEST(ValueCacheTest, NotServedWhileWritten) {
+    ValueCache cache(1024 * 1024, 1);
+    LogOperation op;
+    std::string value;
+    cache.Fill("a", cache.BeginFill("a"), kPut, "a1");
+    cache.Fill("b", cache.BeginFill("b"), kPut, "b1");
+    cache.BeginWrite("a");
+    cache.BeginWrite("b");
+    EXPECT_FALSE(cache.Lookup("a", &op, &value)); //read from the store
+    cache.Fill("a", cache.BeginFill("a"), kPut, "a1"); //maybe the old one
+    EXPECT_FALSE(cache.Lookup("a", &op, &value));
+    cache.Update("a", kPut, "a2"); //the batch reached the store
+    EXPECT_TRUE(cache.Lookup("a", &op, &value));
+    EXPECT_EQ(value, "a2");
+    EXPECT_FALSE(cache.Lookup("b", &op, &value));
+    cache.EndWrite("a");
+    cache.EndWrite("b");
+    EXPECT_TRUE(cache.Lookup("a", &op, &value));
+    EXPECT_FALSE(cache.Lookup("b", &op, &value)); //not refreshed, dropped
+    cache.Fill("b", cache.BeginFill("b"), kPut, "b2");
+    EXPECT_TRUE(cache.Lookup("b", &op, &value));
+    EXPECT_EQ(value, "b2");
+}
+
+TEST(ValueCacheTest, BoundedBySize) {
+    ValueCache cache(64 * 1024, 1);
+    char key_buf[64] = {'\0'};
+    std::string big_value(1000, 'x');
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key_buf, sizeof(key_buf), "key_%d", i);
+        cache.Fill(key_buf, cache.BeginFill(key_buf), kPut, big_value);
+    }
+    int64_t hits, misses, memory;
+    cache.GetStats(&hits, &misses, &memory);
+    EXPECT_LE(memory, 64 * 1024);
+    LogOperation op;
+    std::string value;
+    EXPECT_TRUE(cache.Lookup("key_999", &op, &value));
+    EXPECT_FALSE(cache.Lookup("key_0", &op, &value));
+}
+
+TEST(ValueCacheTest, KeepsRevision) {
+    ValueCache cache(1024 * 1024, 2);
+    LogOperation op;
+    std::string value;
+    ValueRevision revision;
+    revision.create = 3;
+    revision.mod = 7;
+    cache.Fill("key", cache.BeginFill("key"), kPut, "v1", revision);
+    ValueRevision got;
+    EXPECT_TRUE(cache.Lookup("key", &op, &value, &got));
+    EXPECT_EQ(got.create, 3);
+    EXPECT_EQ(got.mod, 7);
+    revision.mod = 9;
+    cache.Update("key", kPut, "v2", revision);
+    EXPECT_TRUE(cache.Lookup("key", &op, &value, &got));
+    EXPECT_EQ(got.create, 3);
+    EXPECT_EQ(got.mod, 9);
+}
+
+TEST(StoreValueTest, EncodeAndDecode) {
+    ValueRevision revision;
+    revision.create = 5;
+    revision.mod = 1L << 40;
+    std::string raw;
+    EncodeStoreValue(kLock, false, revision, "session", &raw);
+    LogOperation op;
+    ValueRevision got;
+    leveldb::Slice value;
+    DecodeStoreValue(raw, &op, &got, &value);
+    EXPECT_EQ(op, kLock);
+    EXPECT_EQ(got.create, 5);
+    EXPECT_EQ(got.mod, 1L << 40);
+    EXPECT_EQ(value.ToString(), "session");
+    std::string legacy(1, static_cast<char>(kPut)); //written without revisions
+    legacy.append("v1");
+    DecodeStoreValue(legacy, &op, &got, &value);
+    EXPECT_EQ(op, kPut);
+    EXPECT_EQ(got.mod, 0);
+    EXPECT_EQ(value.ToString(), "v1");
+    EncodeStoreValue(kPut, true, revision, "ref", &raw);
+    EXPECT_TRUE(BlobStore::IsBlobValue(raw));
+    DecodeStoreValue(raw, &op, &got, &value);
+    EXPECT_EQ(op, kPut);
+    EXPECT_EQ(value.ToString(), "ref");
+    revision.expire_at = 12345;
+    EncodeStoreValue(kPut, false, revision, "short", &raw);
+    DecodeStoreValue(raw, &op, &got, &value);
+    EXPECT_EQ(op, kPut);
+    EXPECT_EQ(got.mod, 1L << 40);
+    EXPECT_EQ(got.expire_at, 12345);
+    EXPECT_EQ(value.ToString(), "short");
+    revision.owner = "host#session";
+    EncodeStoreValue(kPut, false, revision, "ephemeral", &raw);
+    DecodeStoreValue(raw, &op, &got, &value);
+    EXPECT_EQ(op, kPut);
+    EXPECT_EQ(got.expire_at, 12345);
+    EXPECT_EQ(got.owner, "host#session");
+    EXPECT_EQ(value.ToString(), "ephemeral");
+    EXPECT_EQ(StoreValueHeaderSize(raw), raw.size() - value.size());
+    raw.resize(StoreValueHeaderSize(raw) - 3); //owner cut short
+    DecodeStoreValue(raw, &op, &got, &value);
+    EXPECT_EQ(op, kNop);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
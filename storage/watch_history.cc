@@ -0,0 +1,132 @@
+#include "watch_history.h"
+
+namespace galaxy {
+namespace ins {
+
+// bookkeeping bytes of one event besides key and value
+static const int64_t kEventOverhead = sizeof(WatchHistory::Event) + 32;
+
+WatchHistory::WatchHistory(int64_t max_events, int64_t max_bytes,
+                           int64_t floor) : head_(0),
+                                            count_(0),
+                                            bytes_(0),
+                                            max_bytes_(max_bytes),
+                                            floor_(floor) {
+    if (max_events > 0) {
+        ring_.resize(max_events);
+    }
+}
+
+WatchHistory::Event& WatchHistory::At(size_t pos) {
+    return ring_[(head_ + pos) % ring_.size()];
+}
+
+void WatchHistory::PopFront() {
+    mu_.AssertHeld();
+    Event& front = At(0);
+    bytes_ -= front.key.size() + front.value.size() + kEventOverhead;
+    floor_ = front.revision.mod;
+    std::string().swap(front.key);
+    std::string().swap(front.value);
+    head_ = (head_ + 1) % ring_.size();
+    count_--;
+}
+
+void WatchHistory::Append(const std::string& key, const std::string& value,
+                          bool deleted, const ValueRevision& revision) {
+    Event event;
+    event.key = key;
+    event.value = value;
+    event.deleted = deleted;
+    event.revision = revision;
+    MutexLock lock(&mu_);
+    AppendLocked(event);
+}
+
+void WatchHistory::AppendBatch(const std::vector<Event>& events) {
+    MutexLock lock(&mu_);
+    for (size_t i = 0; i < events.size(); i++) {
+        AppendLocked(events[i]);
+    }
+}
+
+void WatchHistory::AppendLocked(const Event& event) {
+    mu_.AssertHeld();
+    int64_t charge = event.key.size() + event.value.size() + kEventOverhead;
+    if (ring_.empty() || charge > max_bytes_) { //never kept
+        while (count_ > 0) {
+            PopFront();
+        }
+        floor_ = event.revision.mod;
+        return;
+    }
+    while (count_ > 0
+           && (count_ == ring_.size() || bytes_ + charge > max_bytes_)) {
+        PopFront();
+    }
+    At(count_) = event;
+    count_++;
+    bytes_ += charge;
+}
+
+WatchHistory::FindResult WatchHistory::Find(
+        int64_t from_index,
+        const boost::function<bool (const std::string&)>& covers,
+        Event* event) {
+    MutexLock lock(&mu_);
+    if (from_index < floor_) {
+        return kCompacted;
+    }
+    for (size_t pos = Locate(from_index); pos < count_; pos++) {
+        if (covers(At(pos).key)) {
+            *event = At(pos);
+            return kFound;
+        }
+    }
+    return kNotYet;
+}
+
+WatchHistory::FindResult WatchHistory::Collect(
+        int64_t from_index,
+        const boost::function<bool (const std::string&)>& covers,
+        std::vector<Event>* events) {
+    MutexLock lock(&mu_);
+    if (from_index < floor_) {
+        return kCompacted;
+    }
+    for (size_t pos = Locate(from_index); pos < count_; pos++) {
+        if (covers(At(pos).key)) {
+            events->push_back(At(pos));
+        }
+    }
+    return events->empty() ? kNotYet : kFound;
+}
+
+size_t WatchHistory::Locate(int64_t from_index) {
+    mu_.AssertHeld();
+    size_t low = 0;
+    size_t high = count_;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (At(mid).revision.mod <= from_index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int64_t WatchHistory::Floor() {
+    MutexLock lock(&mu_);
+    return floor_;
+}
+
+void WatchHistory::GetStats(int64_t* events, int64_t* bytes) {
+    MutexLock lock(&mu_);
+    *events = count_;
+    *bytes = bytes_;
+}
+
+} //namespace ins
+} //namespace galaxy
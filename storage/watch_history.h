@@ -0,0 +1,65 @@
+#ifndef GALAXY_INS_WATCH_HISTORY_H_
+#define GALAXY_INS_WATCH_HISTORY_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include "common/mutex.h"
+#include "store_value.h"
+
+namespace galaxy {
+namespace ins {
+
+// A ring of the latest applied changes, in log order, bounded by count
+// and by bytes. A watch that names the index it has seen is answered
+// from here instead of the store, or told the ring no longer reaches
+// back that far.
+class WatchHistory {
+public:
+    struct Event {
+        std::string key;
+        std::string value;
+        bool deleted;
+        ValueRevision revision; //mod is the log index of the change
+    };
+    enum FindResult {
+        kFound = 0,
+        kNotYet = 1, //nothing after the index yet, wait for it
+        kCompacted = 2 //changes after the index were trimmed
+    };
+    // every change after floor will be appended
+    WatchHistory(int64_t max_events, int64_t max_bytes, int64_t floor);
+    void Append(const std::string& key, const std::string& value,
+                bool deleted, const ValueRevision& revision);
+    // the changes of one applied batch, Find and Collect see all of them
+    // or none; the keys of one entry share its index
+    void AppendBatch(const std::vector<Event>& events);
+    // the first change after from_index whose key covers accepts
+    FindResult Find(int64_t from_index,
+                    const boost::function<bool (const std::string&)>& covers,
+                    Event* event);
+    // every such change after from_index, in log order
+    FindResult Collect(int64_t from_index,
+                       const boost::function<bool (const std::string&)>& covers,
+                       std::vector<Event>* events);
+    int64_t Floor();
+    void GetStats(int64_t* events, int64_t* bytes);
+private:
+    Event& At(size_t pos);
+    size_t Locate(int64_t from_index); //position of the first change after it
+    void PopFront();
+    void AppendLocked(const Event& event);
+    std::vector<Event> ring_;
+    size_t head_;
+    size_t count_;
+    int64_t bytes_;
+    int64_t max_bytes_;
+    int64_t floor_; //every change after it is still in the ring
+    Mutex mu_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include "common/thread_pool.h"
+#include "watch_history.h"
+
+using namespace galaxy::ins;
+
+static bool SameKey(const std::string& watch_key, const std::string& key) {
+    return watch_key == key;
+}
+
+static void AppendAt(WatchHistory* history, const std::string& key,
+                     int64_t index) {
+    ValueRevision revision;
+    revision.create = 1;
+    revision.mod = index;
+    history->Append(key, "v" + key, false, revision);
+}
+
+TEST(WatchHistoryTest, FirstChangeAfterIndex) {
+    WatchHistory history(100, 1024 * 1024, 10);
+    AppendAt(&history, "/a", 11);
+    AppendAt(&history, "/b", 12);
+    AppendAt(&history, "/a", 15);
+    WatchHistory::Event event;
+    EXPECT_EQ(history.Find(10, boost::bind(&SameKey, "/a", _1), &event),
+              WatchHistory::kFound);
+    EXPECT_EQ(event.revision.mod, 11);
+    EXPECT_EQ(event.value, "v/a");
+    EXPECT_EQ(history.Find(11, boost::bind(&SameKey, "/a", _1), &event),
+              WatchHistory::kFound);
+    EXPECT_EQ(event.revision.mod, 15);
+    EXPECT_EQ(history.Find(15, boost::bind(&SameKey, "/a", _1), &event),
+              WatchHistory::kNotYet);
+    EXPECT_EQ(history.Find(12, boost::bind(&SameKey, "/c", _1), &event),
+              WatchHistory::kNotYet);
+    EXPECT_EQ(history.Find(9, boost::bind(&SameKey, "/a", _1), &event),
+              WatchHistory::kCompacted);
+}
+
+TEST(WatchHistoryTest, CollectAfterIndex) {
+    WatchHistory history(100, 1024 * 1024, 10);
+    AppendAt(&history, "/a", 11);
+    AppendAt(&history, "/b", 12);
+    AppendAt(&history, "/a", 15);
+    std::vector<WatchHistory::Event> events;
+    EXPECT_EQ(history.Collect(10, boost::bind(&SameKey, "/a", _1), &events),
+              WatchHistory::kFound);
+    ASSERT_EQ(events.size(), 2u);
+    EXPECT_EQ(events[0].revision.mod, 11);
+    EXPECT_EQ(events[1].revision.mod, 15);
+    events.clear();
+    EXPECT_EQ(history.Collect(15, boost::bind(&SameKey, "/a", _1), &events),
+              WatchHistory::kNotYet);
+    EXPECT_TRUE(events.empty());
+    EXPECT_EQ(history.Collect(9, boost::bind(&SameKey, "/a", _1), &events),
+              WatchHistory::kCompacted);
+}
+
+TEST(WatchHistoryTest, TrimmedByCount) {
+    WatchHistory history(3, 1024 * 1024, 0);
+    for (int64_t i = 1; i <= 5; i++) {
+        AppendAt(&history, "/k", i);
+    }
+    int64_t events = 0;
+    int64_t bytes = 0;
+    history.GetStats(&events, &bytes);
+    EXPECT_EQ(events, 3);
+    EXPECT_EQ(history.Floor(), 2);
+    WatchHistory::Event event;
+    EXPECT_EQ(history.Find(1, boost::bind(&SameKey, "/k", _1), &event),
+              WatchHistory::kCompacted);
+    EXPECT_EQ(history.Find(2, boost::bind(&SameKey, "/k", _1), &event),
+              WatchHistory::kFound);
+    EXPECT_EQ(event.revision.mod, 3);
+}
+
+TEST(WatchHistoryTest, TrimmedByBytes) {
+    WatchHistory history(1000, 1024, 0);
+    std::string big(600, 'x');
+    ValueRevision revision;
+    revision.mod = 1;
+    history.Append("/big", big, false, revision);
+    revision.mod = 2;
+    history.Append("/big", big, false, revision); //pushes the first out
+    EXPECT_EQ(history.Floor(), 1);
+    revision.mod = 3;
+    history.Append("/huge", std::string(4096, 'x'), false, revision);
+    EXPECT_EQ(history.Floor(), 3); //never fits, nothing before it is usable
+    int64_t events = 0;
+    int64_t bytes = 0;
+    history.GetStats(&events, &bytes);
+    EXPECT_EQ(events, 0);
+    EXPECT_EQ(bytes, 0);
+}
+
+static bool AnyKey(const std::string& /*key*/) {
+    return true;
+}
+
+static void AppendEntries(WatchHistory* history, int64_t entries,
+                          int64_t keys) {
+    for (int64_t i = 1; i <= entries; i++) {
+        std::vector<WatchHistory::Event> batch(keys);
+        for (int64_t k = 0; k < keys; k++) {
+            batch[k].key = "/k" + std::string(1, 'a' + k);
+            batch[k].deleted = true;
+            batch[k].revision.mod = i; //one entry, every key at its index
+        }
+        history->AppendBatch(batch);
+    }
+}
+
+TEST(WatchHistoryTest, StreamInMiddleOfEntry) {
+    const int64_t entries = 2000;
+    const int64_t keys = 5;
+    WatchHistory history(entries * keys, 1024 * 1024 * 1024, 0);
+    ins_common::ThreadPool applier(1);
+    applier.AddTask(boost::bind(&AppendEntries, &history, entries, keys));
+    int64_t after_index = 0;
+    while (after_index < entries) {
+        //a stream registering now raises after_index to what it replayed
+        std::vector<WatchHistory::Event> events;
+        history.Collect(after_index, boost::bind(&AnyKey, _1), &events);
+        ASSERT_EQ(events.size() % keys, 0u);
+        for (size_t i = 0; i < events.size(); i++) {
+            EXPECT_EQ(events[i].revision.mod,
+                      after_index + 1 + static_cast<int64_t>(i / keys));
+        }
+        if (!events.empty()) {
+            after_index = events.back().revision.mod;
+        }
+    }
+    applier.Stop(true);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
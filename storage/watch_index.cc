@@ -0,0 +1,152 @@
+#include "watch_index.h"
+
+namespace galaxy {
+namespace ins {
+
+WatchIndex::WatchIndex() : root_(new TrieNode()) {
+}
+
+WatchIndex::~WatchIndex() {
+    DeleteTrie(root_);
+}
+
+void WatchIndex::DeleteTrie(TrieNode* node) {
+    std::map<char, TrieNode*>::iterator it = node->children.begin();
+    for (; it != node->children.end(); it++) {
+        DeleteTrie(it->second);
+    }
+    delete node;
+}
+
+void WatchIndex::AddPrefix(const std::string& prefix, int64_t id) {
+    TrieNode* node = root_;
+    for (size_t i = 0; i < prefix.size(); i++) {
+        TrieNode*& child = node->children[prefix[i]];
+        if (child == NULL) {
+            child = new TrieNode();
+        }
+        node = child;
+    }
+    node->ids.insert(id);
+    Bound& bound = bounds_[id];
+    bound.prefix = true;
+    bound.start_key = prefix;
+}
+
+void WatchIndex::AddRange(const std::string& start_key,
+                          const std::string& end_key,
+                          int64_t id) {
+    if (!end_key.empty() && end_key <= start_key) {
+        return; //covers nothing
+    }
+    SegmentMap::iterator it = Split(start_key);
+    if (!end_key.empty()) {
+        Split(end_key);
+    }
+    for (; it != segments_.end() && (end_key.empty() || it->first < end_key);
+         it++) {
+        it->second.insert(id);
+    }
+    Bound& bound = bounds_[id];
+    bound.prefix = false;
+    bound.start_key = start_key;
+    bound.end_key = end_key;
+}
+
+void WatchIndex::Remove(int64_t id) {
+    std::map<int64_t, Bound>::iterator bt = bounds_.find(id);
+    if (bt == bounds_.end()) {
+        return;
+    }
+    const Bound& bound = bt->second;
+    if (bound.prefix) {
+        RemovePrefix(root_, bound.start_key, 0, id);
+    } else {
+        SegmentMap::iterator it = segments_.find(bound.start_key);
+        for (; it != segments_.end()
+               && (bound.end_key.empty() || it->first < bound.end_key);
+             it++) {
+            it->second.erase(id);
+        }
+        Merge(bound.start_key);
+        if (!bound.end_key.empty()) {
+            Merge(bound.end_key);
+        }
+    }
+    bounds_.erase(bt);
+}
+
+void WatchIndex::RemovePrefix(TrieNode* node, const std::string& prefix,
+                              size_t depth, int64_t id) {
+    if (depth == prefix.size()) {
+        node->ids.erase(id);
+        return;
+    }
+    std::map<char, TrieNode*>::iterator it = node->children.find(prefix[depth]);
+    if (it == node->children.end()) {
+        return;
+    }
+    TrieNode* child = it->second;
+    RemovePrefix(child, prefix, depth + 1, id);
+    if (child->ids.empty() && child->children.empty()) {
+        delete child;
+        node->children.erase(it);
+    }
+}
+
+void WatchIndex::Match(const std::string& key, std::vector<int64_t>* ids) {
+    TrieNode* node = root_;
+    ids->insert(ids->end(), node->ids.begin(), node->ids.end());
+    for (size_t i = 0; i < key.size(); i++) {
+        std::map<char, TrieNode*>::iterator it = node->children.find(key[i]);
+        if (it == node->children.end()) {
+            break;
+        }
+        node = it->second;
+        ids->insert(ids->end(), node->ids.begin(), node->ids.end());
+    }
+    SegmentMap::iterator it = segments_.upper_bound(key);
+    if (it != segments_.begin()) {
+        --it;
+        ids->insert(ids->end(), it->second.begin(), it->second.end());
+    }
+}
+
+int64_t WatchIndex::Size() {
+    return bounds_.size();
+}
+
+WatchIndex::SegmentMap::iterator WatchIndex::Split(const std::string& key) {
+    SegmentMap::iterator it = segments_.lower_bound(key);
+    if (it != segments_.end() && it->first == key) {
+        return it;
+    }
+    std::set<int64_t> ids;
+    if (it != segments_.begin()) { //starts inside the segment before it
+        SegmentMap::iterator prev = it;
+        --prev;
+        ids = prev->second;
+    }
+    return segments_.insert(it, std::make_pair(key, ids));
+}
+
+void WatchIndex::Merge(const std::string& key) {
+    SegmentMap::iterator it = segments_.find(key);
+    if (it == segments_.end()) {
+        return;
+    }
+    if (it == segments_.begin()) {
+        if (it->second.empty()) {
+            segments_.erase(it);
+        }
+        return;
+    }
+    SegmentMap::iterator prev = it;
+    --prev;
+    if (prev->second == it->second) {
+        segments_.erase(it);
+    }
+}
+
+} //namespace ins
+} //namespace galaxy
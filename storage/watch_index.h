@@ -0,0 +1,55 @@
+#ifndef GALAXY_INS_WATCH_INDEX_H_
+#define GALAXY_INS_WATCH_INDEX_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace galaxy {
+namespace ins {
+
+// Finds the prefix and range watches a written key falls into.
+// Prefixes hang in a trie, a key walks it once and collects the watches
+// of every node on its path. Ranges cut the key space into segments at
+// their bounds, each segment keeps the ranges covering it, so a key only
+// looks up the segment it lies in.
+// Not thread safe, the owner keeps its watch table under the same lock.
+class WatchIndex {
+public:
+    WatchIndex();
+    ~WatchIndex();
+    void AddPrefix(const std::string& prefix, int64_t id);
+    // [start_key, end_key), an empty end_key has no upper bound
+    void AddRange(const std::string& start_key, const std::string& end_key,
+                  int64_t id);
+    void Remove(int64_t id);
+    // ids of the watches covering key, in no particular order
+    void Match(const std::string& key, std::vector<int64_t>* ids);
+    int64_t Size();
+private:
+    struct TrieNode {
+        std::map<char, TrieNode*> children;
+        std::set<int64_t> ids;
+    };
+    struct Bound {
+        bool prefix;
+        std::string start_key;
+        std::string end_key;
+    };
+    typedef std::map<std::string, std::set<int64_t> > SegmentMap;
+    void RemovePrefix(TrieNode* node, const std::string& prefix, size_t depth,
+                      int64_t id);
+    void DeleteTrie(TrieNode* node);
+    SegmentMap::iterator Split(const std::string& key);
+    void Merge(const std::string& key);
+    TrieNode* root_;
+    SegmentMap segments_; //segment from each key up to the next one
+    std::map<int64_t, Bound> bounds_;
+};
+
+} //namespace ins
+} //namespace galaxy
+
+#endif
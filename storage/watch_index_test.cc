@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "watch_index.h"
+
+using namespace galaxy::ins;
+
+static std::vector<int64_t> MatchSorted(WatchIndex* index,
+                                        const std::string& key) {
+    std::vector<int64_t> ids;
+    index->Match(key, &ids);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+TEST(WatchIndexTest, PrefixMatch) {
+    WatchIndex index;
+    index.AddPrefix("/jobs/", 1);
+    index.AddPrefix("/jobs/web/", 2);
+    index.AddPrefix("", 3); //every key
+    std::vector<int64_t> ids = MatchSorted(&index, "/jobs/web/task1");
+    ASSERT_EQ(ids.size(), 3u);
+    EXPECT_EQ(ids[0], 1);
+    EXPECT_EQ(ids[1], 2);
+    EXPECT_EQ(ids[2], 3);
+    ids = MatchSorted(&index, "/jobs/db");
+    ASSERT_EQ(ids.size(), 2u);
+    EXPECT_EQ(ids[0], 1);
+    ids = MatchSorted(&index, "/job");
+    ASSERT_EQ(ids.size(), 1u);
+    EXPECT_EQ(ids[0], 3);
+    index.Remove(2);
+    index.Remove(3);
+    ids = MatchSorted(&index, "/jobs/web/task1");
+    ASSERT_EQ(ids.size(), 1u);
+    EXPECT_EQ(ids[0], 1);
+    EXPECT_EQ(index.Size(), 1);
+}
+
+TEST(WatchIndexTest, RangeMatch) {
+    WatchIndex index;
+    index.AddRange("b", "d", 1);
+    index.AddRange("c", "", 2); //no upper bound
+    index.AddRange("c", "c", 3); //empty, ignored
+    EXPECT_TRUE(MatchSorted(&index, "a").empty());
+    std::vector<int64_t> ids = MatchSorted(&index, "b");
+    ASSERT_EQ(ids.size(), 1u);
+    EXPECT_EQ(ids[0], 1);
+    ids = MatchSorted(&index, "c1");
+    ASSERT_EQ(ids.size(), 2u);
+    ids = MatchSorted(&index, "d");
+    ASSERT_EQ(ids.size(), 1u);
+    EXPECT_EQ(ids[0], 2);
+    index.Remove(1);
+    EXPECT_TRUE(MatchSorted(&index, "b").empty());
+    ids = MatchSorted(&index, "zz");
+    ASSERT_EQ(ids.size(), 1u);
+    EXPECT_EQ(ids[0], 2);
+    index.Remove(2);
+    EXPECT_TRUE(MatchSorted(&index, "zz").empty());
+    EXPECT_EQ(index.Size(), 0);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}